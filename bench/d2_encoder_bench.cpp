@@ -0,0 +1,148 @@
+// Encode time per cell of a dashboard like frame, with and without the SGR cache
+// Usage: DeltaEncoderBench [width] [height] [iterations]
+
+#include <core/platform/d2_terminal_encoder.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    using d2::pixel;
+
+    // Panels with a title bar, labels and values in a few color schemes (about 40 combinations)
+    std::vector<pixel> make_frame(std::size_t width, std::size_t height, std::size_t seed)
+    {
+        static constexpr std::array<std::array<std::uint8_t, 3>, 6> accents{{
+            {64, 160, 255},
+            {255, 96, 96},
+            {96, 220, 120},
+            {240, 200, 64},
+            {200, 120, 255},
+            {128, 128, 128},
+        }};
+        static constexpr auto text = std::string_view("cpu 42% mem 3.1G net 12M/s io 7k ");
+
+        std::vector<pixel> frame(width * height);
+        const std::size_t panel_w = 40;
+        const std::size_t panel_h = 12;
+        for (std::size_t y = 0; y < height; y++)
+        {
+            for (std::size_t x = 0; x < width; x++)
+            {
+                auto& px = frame[y * width + x];
+                const auto panel = (y / panel_h) * (width / panel_w + 1) + x / panel_w;
+                const auto& accent = accents[panel % accents.size()];
+                const auto px_y = y % panel_h;
+                const auto px_x = x % panel_w;
+
+                px.r = 16;
+                px.g = 16;
+                px.b = 24;
+                if (px_x == 0 || px_x == panel_w - 1 || px_y == panel_h - 1)
+                {
+                    px.rf = accent[0] / 2;
+                    px.gf = accent[1] / 2;
+                    px.bf = accent[2] / 2;
+                    px.v = '|';
+                }
+                else if (px_y == 0)
+                {
+                    // Title bar
+                    px.r = accent[0];
+                    px.g = accent[1];
+                    px.b = accent[2];
+                    px.rf = 0;
+                    px.gf = 0;
+                    px.bf = 0;
+                    px.style = d2::px::style::Bold;
+                    px.v = text[(px_x + panel) % text.size()];
+                }
+                else
+                {
+                    // Values change between frames, labels do not
+                    const auto value = (px_x / 8) % 2 == 1;
+                    px.rf = value ? accent[0] : 200;
+                    px.gf = value ? accent[1] : 200;
+                    px.bf = value ? accent[2] : 200;
+                    px.style = value && px_y % 3 == 0 ? d2::px::style::Underline
+                                                      : d2::px::style::None;
+                    px.v = text[(px_x + px_y + (value ? seed : 0)) % text.size()];
+                }
+            }
+        }
+        return frame;
+    }
+
+    double run(
+        bool cache,
+        bool redraw,
+        const std::array<std::vector<pixel>, 2>& frames,
+        std::size_t width,
+        std::size_t height,
+        std::size_t iterations
+    )
+    {
+        d2::TerminalEncoder encoder;
+        auto opts = encoder.options();
+        opts.sgr_cache = cache;
+        // Measured on the calling thread only
+        opts.parallel_cells = 0;
+        encoder.set_options(opts);
+
+        d2::TerminalEncoder::buffer out;
+        out.reserve(width * height * 32);
+        std::size_t bytes = 0;
+
+        const auto beg = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < iterations; i++)
+        {
+            if (redraw)
+                encoder.invalidate();
+            out.clear();
+            encoder.encode(out, frames[i % 2], width, height);
+            encoder.commit();
+            bytes += out.size();
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        const auto ns = std::chrono::duration<double, std::nano>(end - beg).count();
+        const auto per_cell = ns / double(iterations * width * height);
+        std::printf(
+            "%-8s %-6s %8.2f ns/cell %10zu B/frame\n",
+            redraw ? "redraw" : "diff",
+            cache ? "cache" : "none",
+            per_cell,
+            bytes / iterations
+        );
+        return per_cell;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const std::size_t width = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 240;
+    const std::size_t height = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 64;
+    const std::size_t iterations = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 500;
+    if (width == 0 || height == 0 || iterations == 0)
+        return EXIT_FAILURE;
+
+    const std::array<std::vector<pixel>, 2> frames{
+        make_frame(width, height, 0),
+        make_frame(width, height, 1),
+    };
+    std::printf("%zux%zu, %zu frames\n", width, height, iterations);
+    for (const auto redraw : {true, false})
+    {
+        // Warm up
+        run(true, redraw, frames, width, height, iterations / 10 + 1);
+        const auto before = run(false, redraw, frames, width, height, iterations);
+        const auto after = run(true, redraw, frames, width, height, iterations);
+        std::printf("%-8s speedup %.2fx\n", redraw ? "redraw" : "diff", before / after);
+    }
+    return EXIT_SUCCESS;
+}
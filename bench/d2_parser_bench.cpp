@@ -0,0 +1,140 @@
+// Input parser throughput in MB/s
+// Usage: DeltaParserBench [dump...]
+// Dumps are raw terminal input (e.g. recorded with `script -I dump.raw`), without any dump
+// a mix of typing, SGR mouse motion, wheel scrolls, key sequences and a paste is generated
+
+#include <core/platform/d2_terminal_parser.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace
+{
+    class Counter : public d2::TerminalParser::Handler
+    {
+    public:
+        std::size_t text{0};
+        std::size_t controls{0};
+        std::size_t sequences{0};
+        std::size_t paste{0};
+
+        void on_text(std::string_view data) override
+        {
+            text += data.size();
+        }
+        void on_control(unsigned char) override
+        {
+            controls++;
+        }
+        void on_sequence(const d2::TerminalParser::Sequence&) override
+        {
+            sequences++;
+        }
+        void on_paste(std::string_view data) override
+        {
+            paste += data.size();
+        }
+    };
+
+    std::string synthesize()
+    {
+        std::string out;
+        char buf[64];
+        for (int i = 0; i < 2000; i++)
+        {
+            // Typing with the occasional Alt+key and arrows
+            out += "the quick brown fox ";
+            out += "\033b\033[A\033[1;5C\r";
+            // Motion and wheel
+            for (int j = 0; j < 20; j++)
+            {
+                const auto len = std::snprintf(
+                    buf, sizeof(buf), "\033[<35;%d;%dM", 10 + (i + j) % 200, 5 + j
+                );
+                out.append(buf, len);
+            }
+            for (int j = 0; j < 5; j++)
+                out += "\033[<65;40;20M";
+            // Click
+            out += "\033[<0;12;8M\033[<0;12;8m";
+            // Kitty keyboard
+            out += "\033[97;5u\033[13u\033[57441;2u";
+            if (i % 100 == 0)
+            {
+                out += "\033[200~";
+                for (int j = 0; j < 64; j++)
+                    out += "int main() { return 0; }\n";
+                out += "\033[201~";
+            }
+        }
+        return out;
+    }
+
+    bool read(const char* path, std::string& out)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+        out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    void run(const char* name, std::string_view input, std::size_t chunk)
+    {
+        // Repeat small inputs to get a stable figure
+        const std::size_t target = 256 * 1024 * 1024;
+        const auto iterations = input.empty() ? 0 : target / input.size() + 1;
+
+        d2::TerminalParser parser;
+        Counter counter;
+        const auto beg = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < iterations; i++)
+        {
+            // Fed the way reads deliver it
+            for (std::size_t off = 0; off < input.size(); off += chunk)
+                parser.feed(input.substr(off, chunk), counter);
+            parser.flush(counter);
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        const auto sec = std::chrono::duration<double>(end - beg).count();
+        const auto mb = double(input.size() * iterations) / (1024.0 * 1024.0);
+        std::printf(
+            "%-24s chunk %5zu %9.1f MB/s (%zu seq, %zu text, %zu paste)\n",
+            name,
+            chunk,
+            sec > 0 ? mb / sec : 0.0,
+            counter.sequences / (iterations ? iterations : 1),
+            counter.text / (iterations ? iterations : 1),
+            counter.paste / (iterations ? iterations : 1)
+        );
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::vector<std::pair<std::string, std::string>> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string data;
+        if (!read(argv[i], data))
+        {
+            std::fprintf(stderr, "Failed to read %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        inputs.emplace_back(argv[i], std::move(data));
+    }
+    if (inputs.empty())
+        inputs.emplace_back("generated", synthesize());
+
+    for (const auto& [name, data] : inputs)
+        for (const auto chunk : {std::size_t(64), std::size_t(4096)})
+            run(name.c_str(), data, chunk);
+    return EXIT_SUCCESS;
+}
@@ -560,6 +560,21 @@ namespace d2
     {
         return std::this_thread::get_id() == _main_thread;
     }
+    bool IOContext::is_element_synced(const TreeState* state) const
+    {
+        if (is_synced())
+            return true;
+        // Subtrees built from the tree have states of their own which share its root
+        return _detached != nullptr && state != nullptr &&
+               (state == _detached || state->root_state().get() == _detached);
+    }
+    void IOContext::wait_until(const std::function<bool()>& ready)
+    {
+        if (!is_synced())
+            D2_THRW("Only the main thread can wait for tasks it has to run");
+        while (!ready())
+            _worker->wait(std::chrono::steady_clock::now() + std::chrono::milliseconds(1));
+    }
 
     void IOContext::ping()
     {
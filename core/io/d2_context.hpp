@@ -18,6 +18,8 @@
 
 namespace d2
 {
+    class TreeState;
+
     class IOContext : public Signals
     {
         D2_TAG_MODULE(ctx)
@@ -34,6 +36,8 @@ namespace d2
         };
     private:
         static inline thread_local ptr _ptr{nullptr};
+        // Tree the calling thread prepares (see DetachedScope)
+        static inline thread_local const TreeState* _detached{nullptr};
 
         std::shared_mutex _module_mtx{};
         absl::flat_hash_map<std::type_index, ModuleEntry> _modules{};
@@ -160,6 +164,36 @@ namespace d2
         mt::ConcurrentPool::ptr scheduler();
 
         bool is_synced() const;
+        // Elements of the state can be accessed in place (on the main thread, or on the thread
+        // preparing the detached tree they belong to)
+        bool is_element_synced(const TreeState* state) const;
+
+        // Marks the calling thread as the owner of the tree of the state, which nothing else can
+        // reach yet
+        // Access to its elements is not routed to the main thread, anything else still is
+        class DetachedScope
+        {
+        private:
+            const TreeState* _restore{nullptr};
+        public:
+            explicit DetachedScope(const TreeState* state) : _restore(_detached)
+            {
+                _detached = state;
+            }
+            DetachedScope(const DetachedScope&) = delete;
+            DetachedScope(DetachedScope&&) = delete;
+            ~DetachedScope()
+            {
+                _detached = _restore;
+            }
+
+            DetachedScope& operator=(const DetachedScope&) = delete;
+            DetachedScope& operator=(DetachedScope&&) = delete;
+        };
+
+        // Blocks the main thread until the predicate holds, tasks posted to it still run meanwhile
+        // (threads waiting on sync() could never finish otherwise)
+        void wait_until(const std::function<bool()>& ready);
 
         template<typename Func, typename... Argv>
         auto sync(Func&& callback, Argv&&... args) -> std::invoke_result_t<Func&, Argv...>
@@ -41,6 +41,10 @@ namespace d2::in
     {
         return _BoundingBox;
     }
+    std::chrono::steady_clock::time_point InputFrame::input_time() const
+    {
+        return _input_time;
+    }
     BoundingBox InputFrame::screen_capacity()
     {
         return _screen_capacity;
@@ -126,10 +130,22 @@ namespace d2::in
         return _sequence;
     }
 
+    std::string_view InputFrame::paste()
+    {
+        if (_consume)
+        {
+            if (_active_consume.consumed_paste && _consume_ctx == std::this_thread::get_id())
+                return "";
+            _consume_swap.consumed_paste = true;
+        }
+        return _paste;
+    }
+
     void InputFrame::mask()
     {
         _active_consume.consumed_scroll = true;
         _active_consume.consumed_sequence = true;
+        _active_consume.consumed_paste = true;
         _active_consume.keys_consumed.set();
     }
 
@@ -153,6 +169,10 @@ namespace d2::in
                 _ptr->_event_state |= static_cast<unsigned char>(Event::KeyInput);
             _ptr->_scroll_delta = {0, 0};
             _ptr->_sequence.clear();
+            // Released rather than cleared, pastes can be large
+            if (!_ptr->_paste.empty())
+                _ptr->_paste = std::string();
+            _ptr->_input_time = {};
             _ptr->_pulse.reset();
         }
 
@@ -209,6 +229,14 @@ namespace d2::in
                 _ptr->_scroll_delta = pos;
             }
         }
+        void InputFrameView::add_scroll_delta(Position delta)
+        {
+            if (delta != Position{0, 0})
+            {
+                _ptr->_event_state |= static_cast<unsigned char>(Event::ScrollWheelMovement);
+                _ptr->_scroll_delta += delta;
+            }
+        }
         void InputFrameView::set_mouse_position(Position pos)
         {
             if (_ptr->mouse_position() != pos)
@@ -240,6 +268,26 @@ namespace d2::in
             if (!_ptr->_sequence.empty())
                 _ptr->_event_state |= static_cast<unsigned char>(Event::KeySequenceInput);
         }
+        void InputFrameView::set_paste(std::string in)
+        {
+            if (in.empty())
+                return;
+            _ptr->_paste = std::move(in);
+            _ptr->_event_state |= static_cast<unsigned char>(Event::Paste);
+        }
+        void InputFrameView::set_input_time(std::chrono::steady_clock::time_point time)
+        {
+            if (_ptr->_input_time == std::chrono::steady_clock::time_point{} ||
+                time < _ptr->_input_time)
+                _ptr->_input_time = time;
+        }
+        void InputFrameView::append_text(std::string_view in)
+        {
+            if (in.empty())
+                return;
+            _ptr->_sequence.append(in);
+            _ptr->_event_state |= static_cast<unsigned char>(Event::KeySequenceInput);
+        }
 
         std::pair<bool, std::thread::id> InputFrameView::get_consume()
         {
@@ -260,6 +308,7 @@ namespace d2::in
             _ptr->_active_consume.keys_consumed.reset();
             _ptr->_active_consume.consumed_scroll = false;
             _ptr->_active_consume.consumed_sequence = false;
+            _ptr->_active_consume.consumed_paste = false;
             _ptr->_consume_swap = _ptr->_active_consume;
         }
         void InputFrameView::apply_consume()
@@ -3,6 +3,7 @@
 #include <absl/container/inlined_vector.h>
 #include <array>
 #include <bitset>
+#include <chrono>
 #include <core/types/d2_vtypes.hpp>
 #include <memory>
 #include <memory_resource>
@@ -58,6 +59,7 @@ namespace d2::in
     };
     enum class Event : unsigned char
     {
+        Paste = 1 << 0,
         ScreenResize = 1 << 1,
         ScreenCapacityChange = 1 << 2,
         MouseMovement = 1 << 3,
@@ -133,6 +135,7 @@ namespace d2::in
             keymap keys_consumed{};
             bool consumed_scroll{false};
             bool consumed_sequence{false};
+            bool consumed_paste{false};
         };
     private:
         // Consumed
@@ -163,6 +166,10 @@ namespace d2::in
         keymap _pulse{};
 
         std::string _sequence{""};
+        // Bracketed paste, delivered whole in the cycle in which it ended
+        std::string _paste{};
+        // When the earliest input of the cycle was received
+        std::chrono::steady_clock::time_point _input_time{};
 
         std::size_t _cur_poll_idx() const;
         std::size_t _prev_poll_idx() const;
@@ -185,6 +192,8 @@ namespace d2::in
         Position mouse_position();
         BoundingBox screen_capacity();
         BoundingBox screen_size();
+        // Time the earliest input of this cycle arrived (epoch if there was none)
+        std::chrono::steady_clock::time_point input_time() const;
 
         absl::InlinedVector<std::pair<keytype, mode>, 8> active_list() const;
 
@@ -195,6 +204,7 @@ namespace d2::in
         ExportKeymap<keymap> map() const noexcept;
 
         std::string_view sequence();
+        std::string_view paste();
 
         void mask();
 
@@ -230,10 +240,17 @@ namespace d2::in
             void pulse(keytype key);
 
             void set_scroll_delta(Position pos);
+            // Accumulates wheel movement within a cycle
+            void add_scroll_delta(Position delta);
             void set_mouse_position(Position pos);
             void set_screen_size(BoundingBox size);
             void set_screen_capacity(BoundingBox size);
             void set_text(std::string in);
+            // Same as set_text but reuses the storage of the frame
+            void append_text(std::string_view in);
+            void set_paste(std::string in);
+            // Keeps the earliest time
+            void set_input_time(std::chrono::steady_clock::time_point time);
 
             std::pair<bool, std::thread::id> get_consume();
             void restore_consume(std::pair<bool, std::thread::id> data);
@@ -118,7 +118,7 @@ namespace d2::sys
         Status status();
         void load();
         void unload();
-        bool accessible() const;
+        virtual bool accessible() const;
 
         template<typename Type> Type* as()
         {
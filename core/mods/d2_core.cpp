@@ -94,7 +94,8 @@ namespace d2::sys
     {
         FrameLock lock(this, true);
         if (!_enabled && (ev == in::Event::KeyInput || ev == in::Event::KeyMouseInput ||
-                          ev == in::Event::KeySequenceInput || ev == in::Event::MouseMovement))
+                          ev == in::Event::KeySequenceInput || ev == in::Event::MouseMovement ||
+                          ev == in::Event::Paste))
             return false;
         return _frame_impl()->had_event(ev);
     }
@@ -145,4 +146,51 @@ namespace d2::sys
             return _frame_impl()->sequence();
         return "";
     }
+    std::string_view SystemInput::paste()
+    {
+        FrameLock lock(this, true);
+        if (_enabled)
+            return _frame_impl()->paste();
+        return "";
+    }
+    std::chrono::steady_clock::time_point SystemInput::input_time()
+    {
+        FrameLock lock(this, false);
+        return _frame_impl()->input_time();
+    }
+
+    std::chrono::steady_clock::time_point SystemOutput::_take_input()
+    {
+        std::unique_lock lock(_latency_mtx);
+        return std::exchange(_input_mark, {});
+    }
+    void SystemOutput::_record_input(std::chrono::steady_clock::time_point input)
+    {
+        if (input == std::chrono::steady_clock::time_point{})
+            return;
+        const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - input
+        );
+        std::unique_lock lock(_latency_mtx);
+        _input_latency.record(latency);
+    }
+
+    void SystemOutput::mark_input(std::chrono::steady_clock::time_point input)
+    {
+        if (input == std::chrono::steady_clock::time_point{})
+            return;
+        std::unique_lock lock(_latency_mtx);
+        if (_input_mark == std::chrono::steady_clock::time_point{} || input < _input_mark)
+            _input_mark = input;
+    }
+    LatencyHistogram SystemOutput::input_latency()
+    {
+        std::unique_lock lock(_latency_mtx);
+        return _input_latency;
+    }
+    void SystemOutput::reset_input_latency()
+    {
+        std::unique_lock lock(_latency_mtx);
+        _input_latency.reset();
+    }
 } // namespace d2::sys
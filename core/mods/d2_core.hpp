@@ -4,8 +4,11 @@
 #include <core/io/d2_main_worker.hpp>
 #include <core/io/d2_module.hpp>
 #include <core/types/d2_pixel.hpp>
+#include <core/utils/d2_histogram.hpp>
 #include <mt/pool.hpp>
 
+#include <mutex>
+
 namespace d2::sys
 {
     // Generic base for system input
@@ -79,6 +82,9 @@ namespace d2::sys
         bool active(in::keytype key, in::Mode mode);
 
         std::string_view sequence();
+        std::string_view paste();
+        // See InputFrame::input_time()
+        std::chrono::steady_clock::time_point input_time();
     };
 
     // Generic base for system output
@@ -131,16 +137,44 @@ namespace d2::sys
             RGBA8,
             PNG,
         };
+    private:
+        std::mutex _latency_mtx{};
+        LatencyHistogram _input_latency{};
+        std::chrono::steady_clock::time_point _input_mark{};
+    protected:
+        // Earliest input marked since the last call (epoch if none)
+        std::chrono::steady_clock::time_point _take_input();
+        // Called by implementations once the bytes of a frame reflecting the input are written
+        void _record_input(std::chrono::steady_clock::time_point input);
     public:
         using ModuleDecl::ModuleDecl;
 
+        // Input to photon latency
+        // The screen marks the earliest input that the next written frame reflects
+        void mark_input(std::chrono::steady_clock::time_point input);
+        LatencyHistogram input_latency();
+        void reset_input_latency();
+
         virtual void load_image(const std::string& path, ImageInstance img) = 0;
         virtual void release_image(const std::string& path) = 0;
         virtual ImageInstance image_info(const std::string& path) = 0;
         virtual image image_id(const std::string& path) = 0;
 
+        // Bytes submitted for the last frame
         virtual std::size_t delta_size() = 0;
         virtual std::size_t swapframe_size() = 0;
+        // Bytes the reference encoder would have produced for the last frame (0 if not measured)
+        virtual std::size_t reference_size() = 0;
+        // Syscalls issued to present the last frame
+        virtual std::size_t syscall_count() = 0;
+        virtual std::chrono::microseconds frame_time() = 0;
+        // Frames replaced by a newer one before they were presented (asynchronous output only)
+        virtual std::size_t dropped_frames() = 0;
+        // Time between a frame being submitted and it reaching the terminal
+        virtual std::chrono::microseconds encode_latency() = 0;
+        // Minimum interval between frames that the terminal currently keeps up with
+        // (0 if it is not throttling)
+        virtual std::chrono::microseconds frame_budget() = 0;
 
         virtual void
         write(std::span<const pixel> buffer, std::size_t width, std::size_t height) = 0;
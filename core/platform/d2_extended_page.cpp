@@ -34,6 +34,17 @@ namespace d2
             global_extended_code_page.deactivate();
 #       endif
     }
+    void ExtendedCodePage::bind_thread([[maybe_unused]] ExtendedCodePage* page)
+    {
+#       if D2_LOCALE_MODE == UNICODE
+            global_extended_code_page._bound = page == &global_extended_code_page ? nullptr : page;
+#       endif
+    }
+    std::mutex& ExtendedCodePage::_share_mutex()
+    {
+        static std::mutex mtx;
+        return mtx;
+    }
 
     bool ExtendedCodePage::is_activated() const
     {
@@ -49,6 +60,20 @@ namespace d2
             return ' ';
         if (value.size() == 1)
             return value[0];
+        if (_bound != nullptr)
+        {
+            std::lock_guard lock(_share_mutex());
+            return _bound->_write(value);
+        }
+        if (_shared)
+        {
+            std::lock_guard lock(_share_mutex());
+            return _write(value);
+        }
+        return _write(value);
+    }
+    standard_value_type ExtendedCodePage::_write(std::string_view value)
+    {
         auto str = std::string(value);
         if (auto f = _map.find(str);
             f != _map.end())
@@ -71,6 +96,8 @@ namespace d2
     }
     std::string_view ExtendedCodePage::read(standard_value_type value) const
     {
+        if (_bound != nullptr)
+            return _bound->read(value);
         const auto idx = _value_to_index(value);
         return std::string_view(
             _page.data() + _link[idx].first,
@@ -91,4 +118,13 @@ namespace d2
     {
         _activated = false;
     }
+    void ExtendedCodePage::share()
+    {
+        _shared++;
+    }
+    void ExtendedCodePage::unshare()
+    {
+        if (_shared)
+            _shared--;
+    }
 }
@@ -4,6 +4,7 @@
 #include <absl/container/flat_hash_map.h>
 #include <string>
 #include <array>
+#include <mutex>
 
 namespace d2
 {
@@ -65,12 +66,22 @@ namespace d2
         std::size_t _append_page{ 0 };
         std::size_t _ctr{ 0 };
         bool _activated{ false };
+        // Page that writes of the owning thread are forwarded to (see bind_thread)
+        ExtendedCodePage* _bound{ nullptr };
+        // Other threads are bound to the page, writes are serialized
+        std::size_t _shared{ 0 };
+
+        static std::mutex& _share_mutex();
 
         std::size_t _value_to_index(standard_value_type value) const;
         standard_value_type _index_to_value(std::size_t idx) const;
+        standard_value_type _write(std::string_view value);
     public:
         static void activate_thread();
         static void deactivate_thread();
+        // Forwards the page of the calling thread to another one (nullptr to undo)
+        // Used by threads rendering on behalf of another, the target has to be shared meanwhile
+        static void bind_thread(ExtendedCodePage* page);
 
         ExtendedCodePage() = default;
         ExtendedCodePage(const ExtendedCodePage&) = delete;
@@ -83,6 +94,9 @@ namespace d2
         void clear();
         void activate();
         void deactivate();
+        // Called by the owning thread around the time other threads are bound to the page
+        void share();
+        void unshare();
 
         ExtendedCodePage& operator=(const ExtendedCodePage&) = delete;
         ExtendedCodePage& operator=(ExtendedCodePage&&) = default;
@@ -0,0 +1,1380 @@
+#include "core/platform/d2_terminal_encoder.hpp"
+
+#include <core/mods/d2_core.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#   include <immintrin.h>
+#elif defined(__SSE2__)
+#   include <emmintrin.h>
+#endif
+
+namespace d2
+{
+    namespace
+    {
+        constexpr std::array<const char*, 7> style_on = {"1", "4", "3", "9", "5", "7", "8"};
+        constexpr std::array<const char*, 7> style_off = {"22", "24", "23", "29", "25", "27", "28"};
+
+        // Styles which are visible on a blank cell
+        constexpr auto blank_styles =
+            px::to_underlying(px::style::Underline) |
+            px::to_underlying(px::style::Strikethrough) |
+            px::to_underlying(px::style::Inverse);
+
+        constexpr auto marker = sys::SystemOutput::image_constant.v;
+
+        std::uint32_t image_id(std::span<const pixel> unit)
+        {
+            std::uint32_t id = 0;
+            id |= static_cast<std::uint32_t>(unit[1].v);
+            id |= (static_cast<std::uint32_t>(unit[2].v) << 1) & 0xF0;
+            id |= (static_cast<std::uint32_t>(unit[3].v) << 2) & 0xF00;
+            id |= (static_cast<std::uint32_t>(unit[4].v) << 3) & 0xF000;
+            return id;
+        }
+
+        bool is_blank(const pixel& px)
+        {
+            return px.v == ' ' && !(px::to_underlying(px.style) & blank_styles);
+        }
+
+        // Small fixed buffer for building a single sequence
+        template<std::size_t Size> struct Builder
+        {
+            std::array<char, Size> data{};
+            std::size_t size{0};
+
+            void append(std::string_view str)
+            {
+                std::copy(str.begin(), str.end(), data.begin() + size);
+                size += str.size();
+            }
+            void append(char ch)
+            {
+                data[size++] = ch;
+            }
+            void number(std::size_t value)
+            {
+                const auto [ptr, _] =
+                    std::to_chars(data.data() + size, data.data() + data.size(), value);
+                size = ptr - data.data();
+            }
+            // CSI with a single count parameter, a count of one is implied
+            void csi(std::size_t n, char final)
+            {
+                append("\033[");
+                if (n != 1)
+                    number(n);
+                append(final);
+            }
+            void param(std::string_view str)
+            {
+                if (data[size - 1] != '[')
+                    append(';');
+                append(str);
+            }
+            void color(std::string_view code, std::uint32_t rgb)
+            {
+                param(code);
+                number((rgb >> 16) & 0xFF);
+                append(';');
+                number((rgb >> 8) & 0xFF);
+                append(';');
+                number(rgb & 0xFF);
+            }
+        };
+
+        std::size_t csi_size(std::size_t n)
+        {
+            return 3 + (n == 1 ? 0 : n < 10 ? 1 : n < 100 ? 2 : n < 1000 ? 3 : 4);
+        }
+        // Previous state classes
+        constexpr std::uint8_t sgr_known = 1 << 0;
+        constexpr std::uint8_t sgr_fg = 1 << 1;
+        constexpr std::uint8_t sgr_bg = 1 << 2;
+
+        std::size_t sgr_hash(const auto& tr)
+        {
+            std::uint64_t h = (std::uint64_t(tr.fg) << 32) | tr.bg;
+            h ^= (std::uint64_t(px::to_underlying(tr.style)) << 16 |
+                  std::uint64_t(px::to_underlying(tr.from_style)) << 8 | tr.from_class) *
+                 0xC2B2AE3D27D4EB4Full;
+            h *= 0x9E3779B97F4A7C15ull;
+            return std::size_t(h ^ (h >> 32));
+        }
+        std::size_t glyph_size(const ExtendedCodePage* page, const pixel& px)
+        {
+            if (page && page->is_extended(px.v))
+                return page->read(px.v).size();
+            return 1;
+        }
+
+        static_assert(
+            std::has_unique_object_representations_v<pixel>,
+            "Row hashing requires pixels without padding"
+        );
+
+        std::uint64_t row_hash(std::span<const pixel> row)
+        {
+            // Multiply-xorshift over the raw cells, 8 bytes at a time
+            const auto* data = reinterpret_cast<const unsigned char*>(row.data());
+            const auto size = row.size_bytes();
+
+            std::uint64_t hash = 0x9e3779b97f4a7c15ull ^ size;
+            std::size_t i = 0;
+            for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
+            {
+                std::uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+                hash = (hash ^ word) * 0xff51afd7ed558ccdull;
+                hash ^= hash >> 32;
+            }
+
+            std::uint64_t tail = 0;
+            std::memcpy(&tail, data + i, size - i);
+            hash = (hash ^ tail) * 0xc4ceb9fe1a85ec53ull;
+            return hash ^ (hash >> 29);
+        }
+
+        // Index of the first cell at or after from that differs between the rows
+        std::size_t mismatch(std::span<const pixel> a, std::span<const pixel> b, std::size_t from)
+        {
+            const auto* pa = reinterpret_cast<const unsigned char*>(a.data());
+            const auto* pb = reinterpret_cast<const unsigned char*>(b.data());
+            const auto size = a.size_bytes();
+
+            std::size_t i = from * sizeof(pixel);
+#if defined(__AVX2__)
+            for (; i + 32 <= size; i += 32)
+            {
+                const auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa + i));
+                const auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb + i));
+                const auto mask =
+                    ~static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+                if (mask)
+                    return (i + std::countr_zero(mask)) / sizeof(pixel);
+            }
+#endif
+#if defined(__SSE2__)
+            for (; i + 16 <= size; i += 16)
+            {
+                const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i));
+                const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i));
+                const auto mask =
+                    ~static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb))) &
+                    0xFFFF;
+                if (mask)
+                    return (i + std::countr_zero(mask)) / sizeof(pixel);
+            }
+#endif
+            for (; i < size; i++)
+                if (pa[i] != pb[i])
+                    return i / sizeof(pixel);
+            return a.size();
+        }
+
+        // Palette quantization
+
+        using rgb = std::array<px::component, 3>;
+
+        constexpr std::array<px::component, 6> cube_levels = {0, 95, 135, 175, 215, 255};
+        // xterm defaults, the actual colors depend on the terminal theme
+        constexpr std::array<rgb, 16> ansi_colors = {{
+            {0, 0, 0},
+            {205, 0, 0},
+            {0, 205, 0},
+            {205, 205, 0},
+            {0, 0, 238},
+            {205, 0, 205},
+            {0, 205, 205},
+            {229, 229, 229},
+            {127, 127, 127},
+            {255, 0, 0},
+            {0, 255, 0},
+            {255, 255, 0},
+            {92, 92, 255},
+            {255, 0, 255},
+            {0, 255, 255},
+            {255, 255, 255},
+        }};
+
+        int distance(const rgb& a, const rgb& b)
+        {
+            const auto dr = int(a[0]) - b[0];
+            const auto dg = int(a[1]) - b[1];
+            const auto db = int(a[2]) - b[2];
+            return dr * dr + dg * dg + db * db;
+        }
+    } // namespace
+
+    struct TerminalEncoder::Palette
+    {
+        static constexpr auto lut_bits = 5;
+
+        struct Code
+        {
+            std::array<char, 8> data{};
+            std::size_t size{0};
+
+            std::string_view view() const
+            {
+                return {data.data(), size};
+            }
+        };
+
+        // Palette index for every color truncated to lut_bits per channel
+        std::array<std::uint8_t, 1 << (lut_bits * 3)> lut{};
+        // Rendered SGR parameters per palette index
+        std::array<Code, 256> fg{};
+        std::array<Code, 256> bg{};
+
+        std::uint8_t index(px::component r, px::component g, px::component b) const
+        {
+            constexpr auto shift = 8 - lut_bits;
+            return lut
+                [((r >> shift) << (lut_bits * 2)) | ((g >> shift) << lut_bits) | (b >> shift)];
+        }
+
+        template<typename Func> void build(Func&& nearest)
+        {
+            constexpr auto shift = 8 - lut_bits;
+            constexpr auto half = 1 << (shift - 1);
+            for (std::size_t i = 0; i < lut.size(); i++)
+            {
+                const rgb color{
+                    px::component(((i >> (lut_bits * 2)) << shift) | half),
+                    px::component((((i >> lut_bits) & ((1 << lut_bits) - 1)) << shift) | half),
+                    px::component(((i & ((1 << lut_bits) - 1)) << shift) | half),
+                };
+                lut[i] = nearest(color);
+            }
+        }
+        static void code(Code& out, std::string_view prefix, std::size_t value)
+        {
+            std::copy(prefix.begin(), prefix.end(), out.data.begin());
+            const auto [ptr, _] = std::to_chars(
+                out.data.data() + prefix.size(), out.data.data() + out.data.size(), value
+            );
+            out.size = ptr - out.data.data();
+        }
+
+        static const Palette& get(Colors colors)
+        {
+            static const auto p256 = []
+            {
+                Palette result;
+                result.build(
+                    [](const rgb& color)
+                    {
+                        // Nearest point of the cube, each channel independently
+                        rgb cube{};
+                        std::size_t idx = 0;
+                        for (std::size_t c = 0; c < 3; c++)
+                        {
+                            std::size_t best = 0;
+                            for (std::size_t l = 1; l < cube_levels.size(); l++)
+                                if (std::abs(int(cube_levels[l]) - color[c]) <
+                                    std::abs(int(cube_levels[best]) - color[c]))
+                                    best = l;
+                            cube[c] = cube_levels[best];
+                            idx = idx * 6 + best;
+                        }
+
+                        // Nearest step of the grayscale ramp
+                        std::size_t gray = 0;
+                        for (std::size_t l = 1; l < 24; l++)
+                        {
+                            const auto lv = px::component(8 + l * 10);
+                            const auto bv = px::component(8 + gray * 10);
+                            if (distance(color, {lv, lv, lv}) < distance(color, {bv, bv, bv}))
+                                gray = l;
+                        }
+                        const auto gv = px::component(8 + gray * 10);
+
+                        return distance(color, {gv, gv, gv}) < distance(color, cube)
+                                   ? std::uint8_t(232 + gray)
+                                   : std::uint8_t(16 + idx);
+                    }
+                );
+                for (std::size_t i = 0; i < 256; i++)
+                {
+                    code(result.fg[i], "38;5;", i);
+                    code(result.bg[i], "48;5;", i);
+                }
+                return result;
+            }();
+            static const auto p16 = []
+            {
+                Palette result;
+                result.build(
+                    [](const rgb& color)
+                    {
+                        std::size_t best = 0;
+                        for (std::size_t i = 1; i < ansi_colors.size(); i++)
+                        {
+                            if (distance(color, ansi_colors[i]) <
+                                distance(color, ansi_colors[best]))
+                                best = i;
+                        }
+                        return std::uint8_t(best);
+                    }
+                );
+                for (std::size_t i = 0; i < 16; i++)
+                {
+                    code(result.fg[i], "", i < 8 ? 30 + i : 90 + i - 8);
+                    code(result.bg[i], "", i < 8 ? 40 + i : 100 + i - 8);
+                }
+                return result;
+            }();
+            return colors == Colors::Palette256 ? p256 : p16;
+        }
+    };
+
+    //
+    // Legacy
+    //
+
+    TerminalEncoder::position_type
+    TerminalEncoder::_generate_position(int x, int y, bool skip)
+    {
+        using buffer = std::array<char, _max_pos_len>;
+
+        if (skip)
+            return std::make_pair(buffer(), 0);
+
+        buffer result{"\x1b["};
+
+        const auto [ptr1, _1] = std::to_chars(result.begin() + 2, result.end(), y + 1);
+        const auto [ptr2, _2] = std::to_chars(ptr1 + 1, result.end(), x + 1);
+
+        *ptr1 = ';';
+        *ptr2 = 'H';
+
+        return std::make_pair(result, int(ptr2 - result.begin() + 1));
+    }
+    TerminalEncoder::color_type TerminalEncoder::_generate_color(const pixel& px, bool force)
+    {
+        using buffer = std::array<char, _max_color_len>;
+
+        constexpr auto style_code = std::string_view("\033[");
+        constexpr auto bg_code = std::string_view("48;2;");
+        constexpr auto fg_code = std::string_view("38;2;");
+
+        // Preds
+
+        const auto do_background = force || px.r != _track_background.r ||
+                                   px.g != _track_background.g || px.b != _track_background.b;
+        const auto do_foreground = force || px.rf != _track_foreground.r ||
+                                   px.gf != _track_foreground.g || px.bf != _track_foreground.b;
+
+        if (px.style == _track_style && !do_background && !do_foreground)
+            return std::make_pair(buffer(), 0);
+
+        buffer code{"\033["};
+
+        // Styles
+
+        buffer::iterator ptr = code.begin() + style_code.size();
+        if (force || px.style != _track_style)
+        {
+            for (std::size_t i = 0; i < 7; i++)
+            {
+                const auto ns = px::style(std::uint8_t(px.style) & (1 << i));
+                const auto ps = px::style(std::uint8_t(_track_style) & (1 << i));
+                if (ns != ps)
+                {
+                    if (bool(ns))
+                    {
+                        *(ptr++) = style_on[i][0];
+                    }
+                    else
+                    {
+                        *(ptr++) = style_off[i][0];
+                        *(ptr++) = style_off[i][1];
+                    }
+                    *(ptr++) = ';';
+                }
+            }
+            _track_style = px.style;
+        }
+
+        if (!(do_foreground || do_background))
+            *ptr = 'm';
+
+        // Background
+        buffer::iterator ptrbe = ptr;
+        if (do_background)
+        {
+            const auto ptrb = std::copy(bg_code.begin(), bg_code.end(), ptrbe);
+
+            const auto [ptr1b, _1b] = std::to_chars(ptrb, code.end(), px.r);
+            const auto [ptr2b, _2b] = std::to_chars(ptr1b + 1, code.end(), px.g);
+            const auto [ptr3b, _3b] = std::to_chars(ptr2b + 1, code.end(), px.b);
+
+            *ptr1b = ';';
+            *ptr2b = ';';
+            *ptr3b = do_foreground ? ';' : 'm';
+
+            ptrbe = ptr3b + 1;
+
+            _track_background.r = px.r;
+            _track_background.g = px.g;
+            _track_background.b = px.b;
+        }
+
+        // Foreground
+        buffer::iterator ptrfe = ptrbe;
+        if (do_foreground)
+        {
+            const auto ptrf = std::copy(fg_code.begin(), fg_code.end(), ptrfe);
+
+            const auto [ptr1f, _1f] = std::to_chars(ptrf, code.end(), px.rf);
+            const auto [ptr2f, _2f] = std::to_chars(ptr1f + 1, code.end(), px.gf);
+            const auto [ptr3f, _3f] = std::to_chars(ptr2f + 1, code.end(), px.bf);
+
+            *ptr1f = ';';
+            *ptr2f = ';';
+            *ptr3f = 'm';
+
+            ptrfe = ptr3f;
+
+            _track_foreground.r = px.rf;
+            _track_foreground.g = px.gf;
+            _track_foreground.b = px.bf;
+        }
+
+        return std::make_pair(code, int(ptrfe - code.begin() + 1));
+    }
+    void TerminalEncoder::_kitty_id(buffer& out, std::uint32_t id)
+    {
+        constexpr auto c1 = std::string_view("\x1b_Ga=p,i=");
+        constexpr auto c3 = std::string_view(",q=2\x1b\\");
+
+        std::array<char, 10> id_out;
+        const auto [end, _] = std::to_chars(id_out.data(), id_out.data() + id_out.size(), id);
+
+        out.insert(out.end(), c1.begin(), c1.end());
+        out.insert(out.end(), id_out.data(), end);
+        out.insert(out.end(), c3.begin(), c3.end());
+    }
+    const ExtendedCodePage* TerminalEncoder::_page() const
+    {
+#if D2_LOCALE_MODE == UNICODE
+        return _code_page ? _code_page : &global_extended_code_page;
+#else
+        return nullptr;
+#endif
+    }
+    void TerminalEncoder::_push(buffer& out, const pixel& px)
+    {
+        if (px.v == '\t')
+        {
+            out.push_back(' ');
+            return;
+        }
+
+        const auto* page = _page();
+        if (page && page->is_extended(px.v))
+        {
+            const auto ext = page->read(px.v);
+            out.insert(out.end(), ext.begin(), ext.end());
+        }
+        else
+        {
+            out.push_back(px.v);
+        }
+    }
+
+    bool TerminalEncoder::_encode_legacy(
+        buffer& out, std::span<const pixel> buffer, std::size_t width, bool clean
+    )
+    {
+        _track_style = px::style::None;
+        _track_foreground = px::foreground(255, 255, 255);
+        _track_background = px::background(0, 0, 0);
+
+        // Move to zero
+        {
+            const auto [pos, plen] = _generate_position(0, 0, false);
+            out.insert(out.end(), pos.begin(), pos.begin() + plen);
+        }
+        const auto prefix = out.size();
+
+        // Clean redraw
+        if (clean)
+        {
+            std::size_t x = 0;
+            std::size_t y = 0;
+            out.insert(out.end(), _cls_code.begin(), _cls_code.end());
+            for (auto it = buffer.begin(); it != buffer.end();)
+            {
+                const auto& px = *it;
+                const auto [code, len] = _generate_color(px);
+
+                auto sit = it;
+                while (sit != buffer.end() && px.compare_colors(*sit))
+                    ++sit;
+
+                const auto abs_start = it - buffer.begin();
+                const auto abs_end = sit - buffer.begin();
+                const auto edls = (abs_end - abs_start) / width;
+
+                out.reserve(out.size() + len + ((sit - it) * sizeof(value_type)) + edls);
+                out.insert(out.end(), code.begin(), code.begin() + len);
+
+                while (it != sit)
+                {
+                    const auto abs = it - buffer.begin();
+                    if (abs && !(abs % width) && abs != abs_start)
+                    {
+                        out.push_back('\n');
+                        y++;
+                        x = 0;
+                    }
+                    else
+                        x++;
+
+                    // Image support
+                    [[unlikely]] if (it->v == marker)
+                    {
+                        // Explicitly move cursor
+                        const auto [pos, plen] = _generate_position(x + 1, y + 1, false);
+                        out.insert(out.end(), pos.begin(), pos.begin() + plen);
+                        _kitty_id(out, image_id({it, 5}));
+                        it += 5;
+                        for (std::size_t i = 0; i < 5; i++)
+                            _push(out, {});
+                    }
+                    else
+                    {
+                        _push(out, *it);
+                        ++it;
+                    }
+                }
+
+                if (sit == buffer.end())
+                    break;
+            }
+        }
+        else
+        {
+            bool sequential = false;
+            bool linear = false;
+            auto pv_it = _previous.begin();
+            for (auto it = buffer.begin(); it != buffer.end();)
+            {
+                if (const auto& px = *it; px != *pv_it)
+                {
+                    const auto idx = it - buffer.begin();
+                    const auto x = idx % width;
+                    const auto y = idx / width;
+                    const auto [pos, plen] = _generate_position(x, y, linear && sequential);
+                    const auto [code, len] = _generate_color(px, !sequential);
+
+                    auto sit = it;
+                    while (sit != buffer.end() && *sit != *pv_it && px.compare_colors(*sit))
+                    {
+                        ++pv_it;
+                        ++sit;
+                    }
+
+                    const auto end = sit - buffer.begin();
+                    const auto edls = (end - idx) / width;
+
+                    out.reserve(
+                        out.size() + len + plen + ((sit - it) * sizeof(value_type)) + edls
+                    );
+                    out.insert(out.end(), pos.begin(), pos.begin() + plen);
+                    out.insert(out.end(), code.begin(), code.begin() + len);
+
+                    linear = true;
+                    sequential = true;
+                    while (it != sit)
+                    {
+                        const auto abs = it - buffer.begin();
+                        if (abs && !(abs % width) && abs != idx)
+                        {
+                            linear = false;
+                            out.push_back('\n');
+                        }
+                        // Image support
+                        [[unlikely]] if (it->v == marker)
+                        {
+                            // Explicitly move cursor
+                            const auto [pos, plen] = _generate_position(x + 1, y + 1, false);
+                            out.insert(out.end(), pos.begin(), pos.begin() + plen);
+                            _kitty_id(out, image_id({it, 5}));
+                            it += 5;
+                            for (std::size_t i = 0; i < 5; i++)
+                                _push(out, {});
+                        }
+                        else
+                        {
+                            _push(out, *it);
+                            ++it;
+                        }
+                    }
+                    if (sit == buffer.end())
+                        break;
+                }
+                else
+                {
+                    const auto abs = it - buffer.begin();
+                    linear = !(abs && !(abs % width));
+                    sequential = false;
+                    ++pv_it;
+                    ++it;
+                }
+            }
+        }
+        return out.size() > prefix;
+    }
+
+    //
+    // Optimal
+    //
+
+    bool TerminalEncoder::_overprintable(const pixel& px) const
+    {
+        const auto ch = static_cast<unsigned char>(px.v);
+        if (px.v == marker || (ch < ' ' && ch != '\t'))
+            return false;
+        if (is_blank(px))
+            return _background(px) == _attr_bg &&
+                   !(px::to_underlying(_attr_style) & blank_styles);
+        return px.style == _attr_style && _background(px) == _attr_bg &&
+               _foreground(px) == _attr_fg;
+    }
+    std::size_t TerminalEncoder::_next_change(
+        std::span<const pixel> row, std::span<const pixel> prev, std::size_t x
+    ) const
+    {
+        while (x < row.size())
+        {
+            x = mismatch(row, prev, x);
+            if (x == row.size() || _palette == nullptr || _changed(row[x], prev[x]))
+                break;
+            x++;
+        }
+        return x;
+    }
+    bool TerminalEncoder::_changed(const pixel& a, const pixel& b) const
+    {
+        if (_palette == nullptr)
+            return a != b;
+        return a.v != b.v || a.style != b.style || _background(a) != _background(b) ||
+               _foreground(a) != _foreground(b);
+    }
+    std::uint32_t TerminalEncoder::_foreground(const pixel& px) const
+    {
+        if (_palette == nullptr)
+            return (std::uint32_t(px.rf) << 16) | (std::uint32_t(px.gf) << 8) | px.bf;
+        return _palette->index(px.rf, px.gf, px.bf);
+    }
+    std::uint32_t TerminalEncoder::_background(const pixel& px) const
+    {
+        if (_palette == nullptr)
+            return (std::uint32_t(px.r) << 16) | (std::uint32_t(px.g) << 8) | px.b;
+        return _palette->index(px.r, px.g, px.b);
+    }
+    void
+    TerminalEncoder::_move(buffer& out, std::span<const pixel> row, std::size_t x, std::size_t y)
+    {
+        if (_cursor_known && _cx == x && _cy == y)
+            return;
+
+        const auto width = row.size();
+
+        sequence best{};
+        best.second = std::numeric_limits<std::size_t>::max();
+        const auto consider = [&](const Builder<_max_move_len>& seq)
+        {
+            if (seq.size < best.second)
+            {
+                std::copy(seq.data.begin(), seq.data.begin() + seq.size, best.first.begin());
+                best.second = seq.size;
+            }
+        };
+        const auto horizontal = [](Builder<_max_move_len>& seq, std::size_t from, std::size_t to)
+        {
+            if (to > from)
+                seq.csi(to - from, 'C');
+            else if (to < from)
+                seq.csi(from - to, 'D');
+        };
+
+        // Absolute
+        {
+            Builder<_max_move_len> seq;
+            seq.append("\033[");
+            if (x || y)
+                seq.number(y + 1);
+            if (x)
+            {
+                seq.append(';');
+                seq.number(x + 1);
+            }
+            seq.append('H');
+            consider(seq);
+        }
+
+        if (_cursor_known)
+        {
+            // The column is ambiguous with a pending wrap so only carriage return is relative to it
+            const auto pending = _cx >= width;
+            const auto vertical = [&](Builder<_max_move_len>& seq)
+            {
+                if (y > _cy)
+                    seq.csi(y - _cy, 'B');
+                else if (y < _cy)
+                    seq.csi(_cy - y, 'A');
+            };
+
+            if (!pending)
+            {
+                Builder<_max_move_len> seq;
+                vertical(seq);
+                horizontal(seq, _cx, x);
+                consider(seq);
+            }
+            {
+                Builder<_max_move_len> seq;
+                seq.append('\r');
+                vertical(seq);
+                horizontal(seq, 0, x);
+                consider(seq);
+            }
+            // The output post processing turns a newline into CR LF
+            if (y > _cy && y - _cy < _max_move_len / 2)
+            {
+                Builder<_max_move_len> seq;
+                for (std::size_t i = _cy; i < y; i++)
+                    seq.append('\n');
+                horizontal(seq, 0, x);
+                consider(seq);
+            }
+
+            // Reprint the cells in between if they are already in the right attributes
+            if (!pending && y == _cy && x > _cx && _attr_known)
+            {
+                std::size_t cost = 0;
+                for (std::size_t i = _cx; i < x && cost < best.second; i++)
+                {
+                    if (!_overprintable(row[i]))
+                    {
+                        cost = best.second;
+                        break;
+                    }
+                    cost += glyph_size(_page(), row[i]);
+                }
+                if (cost < best.second)
+                {
+                    for (std::size_t i = _cx; i < x; i++)
+                        _push(out, row[i]);
+                    _cx = x;
+                    return;
+                }
+            }
+        }
+
+        out.insert(out.end(), best.first.begin(), best.first.begin() + best.second);
+        _cx = x;
+        _cy = y;
+        _cursor_known = true;
+    }
+    void TerminalEncoder::_sgr(buffer& out, const pixel& px)
+    {
+        const auto bg = _background(px);
+        auto fg = _foreground(px);
+        auto style = px.style;
+        if (is_blank(px) && _attr_known)
+        {
+            // Only the background is visible on a blank cell
+            fg = _attr_fg;
+            style = px::as_style(px::to_underlying(_attr_style) & ~blank_styles);
+        }
+
+        if (_attr_known && bg == _attr_bg && fg == _attr_fg && style == _attr_style)
+            return;
+
+        Transition tr{.fg = fg, .bg = bg, .style = style};
+        if (_attr_known)
+        {
+            tr.from_style = _attr_style;
+            tr.from_class = sgr_known | (fg != _attr_fg ? sgr_fg : 0) |
+                            (bg != _attr_bg ? sgr_bg : 0);
+        }
+
+        const auto& entry = _options.sgr_cache ? _sgr_cached(tr) : _sgr_uncached(tr);
+        out.insert(out.end(), entry.data.begin(), entry.data.begin() + entry.size);
+
+        _attr_fg = fg;
+        _attr_bg = bg;
+        _attr_style = style;
+        _attr_known = true;
+    }
+    const TerminalEncoder::SgrEntry& TerminalEncoder::_sgr_uncached(const Transition& tr)
+    {
+        _sgr_scratch.key = tr;
+        _sgr_build(_sgr_scratch);
+        return _sgr_scratch;
+    }
+    const TerminalEncoder::SgrEntry& TerminalEncoder::_sgr_cached(const Transition& tr)
+    {
+        // Frames usually have only a handful of distinct transitions
+        if (_sgr_cache.empty())
+            _sgr_cache.resize(_sgr_cache_size);
+        const auto hash = sgr_hash(tr);
+        SgrEntry* slot = nullptr;
+        for (std::size_t i = 0; i < _sgr_cache_probe; i++)
+        {
+            auto& entry = _sgr_cache[(hash + i) & (_sgr_cache_size - 1)];
+            if (entry.size == 0)
+            {
+                if (slot == nullptr)
+                    slot = &entry;
+                break;
+            }
+            if (entry.key == tr)
+            {
+                slot = &entry;
+                break;
+            }
+        }
+        // Probe window is full, evict the home slot
+        if (slot == nullptr)
+            slot = &_sgr_cache[hash & (_sgr_cache_size - 1)];
+        if (slot->size == 0 || !(slot->key == tr))
+        {
+            slot->key = tr;
+            _sgr_build(*slot);
+        }
+        return *slot;
+    }
+    void TerminalEncoder::_sgr_build(SgrEntry& entry) const
+    {
+        const auto& tr = entry.key;
+        const auto color = [this](Builder<_max_sgr_len>& seq, std::uint32_t key, bool foreground)
+        {
+            if (_palette == nullptr)
+                seq.color(foreground ? "38;2;" : "48;2;", key);
+            else
+                seq.param(foreground ? _palette->fg[key].view() : _palette->bg[key].view());
+        };
+
+        // From the default state
+        Builder<_max_sgr_len> reset;
+        reset.append("\033[0");
+        for (std::size_t i = 0; i < 7; i++)
+            if (px::to_underlying(tr.style) & (1 << i))
+                reset.param(style_on[i]);
+        color(reset, tr.bg, false);
+        color(reset, tr.fg, true);
+        reset.append('m');
+
+        // From the current state
+        const auto known = bool(tr.from_class & sgr_known);
+        Builder<_max_sgr_len> delta;
+        if (known)
+        {
+            delta.append("\033[");
+            for (std::size_t i = 0; i < 7; i++)
+            {
+                const auto ns = px::to_underlying(tr.style) & (1 << i);
+                const auto ps = px::to_underlying(tr.from_style) & (1 << i);
+                if (ns != ps)
+                    delta.param(ns ? style_on[i] : style_off[i]);
+            }
+            if (tr.from_class & sgr_bg)
+                color(delta, tr.bg, false);
+            if (tr.from_class & sgr_fg)
+                color(delta, tr.fg, true);
+            delta.append('m');
+        }
+
+        const auto& seq = known && delta.size <= reset.size ? delta : reset;
+        std::copy(seq.data.begin(), seq.data.begin() + seq.size, entry.data.begin());
+        entry.size = std::uint8_t(seq.size);
+    }
+
+    void TerminalEncoder::_encode_image(
+        buffer& out, std::span<const pixel> unit, std::size_t x, std::size_t y
+    )
+    {
+        // Same placement as the legacy encoder
+        const auto [pos, plen] = _generate_position(x + 1, y + 1, false);
+        out.insert(out.end(), pos.begin(), pos.begin() + plen);
+        _kitty_id(out, image_id(unit));
+        for (std::size_t i = 0; i < unit.size(); i++)
+            _push(out, {});
+
+        // The placement might move the cursor
+        _cursor_known = false;
+    }
+    void TerminalEncoder::_encode_row(
+        buffer& out, std::span<const pixel> row, std::span<const pixel> prev, std::size_t y
+    )
+    {
+        const auto width = row.size();
+        const auto dirty = [&](std::size_t x) { return prev.empty() || _changed(row[x], prev[x]); };
+
+        for (std::size_t x = 0; x < width;)
+        {
+            if (!prev.empty())
+            {
+                x = _next_change(row, prev, x);
+                if (x == width)
+                    break;
+
+                // Image ids are only written together with their marker
+                for (std::size_t i = 1; i < 5 && i <= x; i++)
+                {
+                    if (row[x - i].v == marker)
+                    {
+                        x -= i;
+                        break;
+                    }
+                }
+            }
+
+            const auto& px = row[x];
+
+            // Images are always written as a whole unit
+            [[unlikely]] if (px.v == marker)
+            {
+                const auto cnt = std::min<std::size_t>(5, width - x);
+                bool changed = false;
+                for (std::size_t i = 0; i < cnt; i++)
+                    changed = changed || dirty(x + i);
+                if (changed && cnt == 5)
+                    _encode_image(out, row.subspan(x, cnt), x, y);
+                x += cnt;
+                continue;
+            }
+
+            if (!dirty(x))
+            {
+                x++;
+                continue;
+            }
+
+            _move(out, row, x, y);
+
+            // Blank runs
+            if (_options.erase && is_blank(px))
+            {
+                std::size_t end = x + 1;
+                std::size_t changed = 1;
+                while (end < width && is_blank(row[end]) &&
+                       _background(row[end]) == _background(px))
+                {
+                    changed += dirty(end);
+                    end++;
+                }
+
+                const auto cnt = end - x;
+                if (end == width && changed > 3)
+                {
+                    // Erase in line
+                    constexpr auto el = std::string_view("\033[K");
+                    _sgr(out, px);
+                    out.insert(out.end(), el.begin(), el.end());
+                    break;
+                }
+                if (cnt > csi_size(cnt) + csi_size(cnt))
+                {
+                    // Erase characters, the cursor stays in place
+                    Builder<_max_move_len> ech;
+                    ech.csi(cnt, 'X');
+                    _sgr(out, px);
+                    out.insert(out.end(), ech.data.begin(), ech.data.begin() + ech.size);
+                    x = end;
+                    continue;
+                }
+            }
+
+            _sgr(out, px);
+            _push(out, px);
+            x++;
+            _cx++;
+
+            // Repeated glyphs
+            if (const auto ch = static_cast<unsigned char>(px.v);
+                _options.repeat && ch > ' ' && ch < 127)
+            {
+                std::size_t end = x;
+                while (end < width && !_changed(row[end], px))
+                    end++;
+
+                const auto cnt = end - x;
+                if (cnt > csi_size(cnt))
+                {
+                    Builder<_max_move_len> rep;
+                    rep.csi(cnt, 'b');
+                    out.insert(out.end(), rep.data.begin(), rep.data.begin() + rep.size);
+                    x = end;
+                    _cx = end;
+                }
+            }
+        }
+    }
+    void TerminalEncoder::_encode_scroll(
+        buffer& out, std::span<const pixel> frame, std::size_t width, std::size_t height
+    )
+    {
+        struct Band
+        {
+            std::size_t top{0};
+            std::size_t bottom{0};
+            std::size_t shift{0};
+            bool up{false};
+            std::size_t gain{0};
+        };
+
+        const auto row = [&](std::span<const pixel> buffer, std::size_t y)
+        { return buffer.subspan(y * width, width); };
+        const auto has_image = [&](std::span<const pixel> row)
+        {
+            return std::any_of(
+                row.begin(), row.end(), [](const pixel& px) { return px.v == marker; }
+            );
+        };
+
+        std::size_t changed = 0;
+        for (std::size_t y = 0; y < height; y++)
+            changed += _cur_hash[y] != _prev_hash[y];
+        if (changed < 2)
+            return;
+
+        // Runs of rows that match the previous frame shifted by a constant offset
+        // The exposed rows have to be repainted so they count against the gain
+        std::vector<Band> bands;
+        for (std::size_t k = 1; k < height; k++)
+        {
+            for (const auto up : {true, false})
+            {
+                std::size_t start = 0;
+                std::size_t gain = 0;
+                bool run = false;
+                for (std::size_t y = 0; y <= height; y++)
+                {
+                    const auto valid = up ? y + k < height : y >= k && y < height;
+                    const auto src = up ? y + k : y - k;
+                    if (valid && _cur_hash[y] == _prev_hash[src])
+                    {
+                        if (!run)
+                        {
+                            start = y;
+                            gain = 0;
+                            run = true;
+                        }
+                        gain += _cur_hash[y] != _prev_hash[y];
+                        continue;
+                    }
+                    if (run && gain > k && (gain - k) * width > _min_scroll_gain)
+                    {
+                        bands.push_back({
+                            .top = up ? start : start - k,
+                            .bottom = up ? y - 1 + k : y - 1,
+                            .shift = k,
+                            .up = up,
+                            .gain = gain - k,
+                        });
+                    }
+                    run = false;
+                }
+            }
+        }
+        if (bands.empty())
+            return;
+
+        std::sort(
+            bands.begin(), bands.end(), [](const Band& a, const Band& b) { return a.gain > b.gain; }
+        );
+
+        std::vector<Band> selected;
+        for (const auto& band : bands)
+        {
+            if (selected.size() == _max_scroll_bands)
+                break;
+            if (std::any_of(
+                    selected.begin(),
+                    selected.end(),
+                    [&](const Band& other)
+                    { return band.top <= other.bottom && other.top <= band.bottom; }
+                ))
+                continue;
+
+            // Hashes only nominate the band, the rows are compared before committing to it
+            // Images are placed by the terminal and would not move along with the text
+            bool valid = true;
+            for (std::size_t y = band.top; y <= band.bottom && valid; y++)
+            {
+                valid = !has_image(row(frame, y)) && !has_image(row(_previous, y));
+                const auto exposed =
+                    band.up ? y + band.shift > band.bottom : y < band.top + band.shift;
+                if (valid && !exposed)
+                {
+                    const auto src = band.up ? y + band.shift : y - band.shift;
+                    const auto cur = row(frame, y);
+                    const auto prev = row(_previous, src);
+                    valid = std::equal(cur.begin(), cur.end(), prev.begin());
+                }
+            }
+            if (valid)
+                selected.push_back(band);
+        }
+        if (selected.empty())
+            return;
+
+        for (const auto& band : selected)
+        {
+            Builder<_max_move_len> seq;
+            seq.append("\033[");
+            seq.number(band.top + 1);
+            seq.append(';');
+            seq.number(band.bottom + 1);
+            seq.append('r');
+            seq.csi(band.shift, band.up ? 'S' : 'T');
+            out.insert(out.end(), seq.data.begin(), seq.data.begin() + seq.size);
+
+            // Mirror the scroll on the previous frame
+            const auto rows = band.bottom - band.top + 1 - band.shift;
+            const auto dst = band.up ? band.top : band.top + band.shift;
+            const auto src = band.up ? band.top + band.shift : band.top;
+            const auto first = _previous.begin() + src * width;
+            const auto last = first + rows * width;
+            if (band.up)
+            {
+                std::copy(first, last, _previous.begin() + dst * width);
+                std::copy(
+                    _prev_hash.begin() + src,
+                    _prev_hash.begin() + src + rows,
+                    _prev_hash.begin() + dst
+                );
+            }
+            else
+            {
+                std::copy_backward(first, last, _previous.begin() + (dst + rows) * width);
+                std::copy_backward(
+                    _prev_hash.begin() + src,
+                    _prev_hash.begin() + src + rows,
+                    _prev_hash.begin() + dst + rows
+                );
+            }
+            const auto exposed = band.up ? band.bottom + 1 - band.shift : band.top;
+            for (std::size_t y = exposed; y < exposed + band.shift; y++)
+                _exposed[y] = true;
+        }
+
+        // Reset the scrolling region, this also homes the cursor
+        constexpr auto reset = std::string_view("\033[r");
+        out.insert(out.end(), reset.begin(), reset.end());
+        _cursor_known = false;
+    }
+    void TerminalEncoder::_encode_optimal(
+        buffer& out, std::span<const pixel> frame, std::size_t width, std::size_t height, bool clean
+    )
+    {
+        if (clean)
+        {
+            _cursor_known = false;
+            _attr_known = false;
+        }
+
+        _exposed.assign(height, false);
+        if (!clean && _options.scroll)
+            _encode_scroll(out, frame, width, height);
+
+        _dirty_rows.clear();
+        for (std::size_t y = 0; y < height; y++)
+            if (clean || _exposed[y] || _cur_hash[y] != _prev_hash[y])
+                _dirty_rows.push_back(y);
+
+        // Small diffs are not worth the synchronization
+        if (_executor != nullptr && _options.parallel_cells != 0 && _options.max_bands > 1 &&
+            _dirty_rows.size() > 1 && _dirty_rows.size() * width >= _options.parallel_cells)
+        {
+            _encode_bands(out, frame, width, clean);
+            return;
+        }
+
+        for (decltype(auto) y : _dirty_rows)
+        {
+            const auto row = frame.subspan(y * width, width);
+            const auto prev = clean || _exposed[y]
+                                  ? std::span<const pixel>()
+                                  : std::span<const pixel>(_previous).subspan(y * width, width);
+            _encode_row(out, row, prev, y);
+        }
+    }
+    void TerminalEncoder::_encode_bands(
+        buffer& out, std::span<const pixel> frame, std::size_t width, bool clean
+    )
+    {
+        const auto count = std::min(_options.max_bands, _dirty_rows.size());
+        if (_bands.size() < count)
+        {
+            _bands.resize(count);
+            _band_out.resize(count);
+        }
+
+        // Every band starts from an unknown terminal state, so its first change is written with
+        // an absolute position and a full SGR and the bands can be concatenated in order
+        // Extended glyphs have to be resolved through the code page of the calling thread
+        const auto* page = _page();
+        for (std::size_t i = 0; i < count; i++)
+        {
+            auto& band = _bands[i];
+            band.set_options(_options);
+            band._code_page = page;
+            band._cursor_known = false;
+            band._attr_known = false;
+            _band_out[i].clear();
+        }
+
+        _executor(
+            count,
+            [&](std::size_t i)
+            {
+                auto& band = _bands[i];
+                auto& bout = _band_out[i];
+                const auto beg = _dirty_rows.size() * i / count;
+                const auto end = _dirty_rows.size() * (i + 1) / count;
+                for (std::size_t k = beg; k < end; k++)
+                {
+                    const auto y = _dirty_rows[k];
+                    const auto row = frame.subspan(y * width, width);
+                    const auto prev =
+                        clean || _exposed[y]
+                            ? std::span<const pixel>()
+                            : std::span<const pixel>(_previous).subspan(y * width, width);
+                    band._encode_row(bout, row, prev, y);
+                }
+            }
+        );
+
+        for (std::size_t i = 0; i < count; i++)
+            out.insert(out.end(), _band_out[i].begin(), _band_out[i].end());
+
+        // The terminal ends up in the state left by the last band that wrote anything
+        for (std::size_t i = count; i-- > 0;)
+        {
+            if (_band_out[i].empty())
+                continue;
+            const auto& band = _bands[i];
+            _cx = band._cx;
+            _cy = band._cy;
+            _attr_fg = band._attr_fg;
+            _attr_bg = band._attr_bg;
+            _attr_style = band._attr_style;
+            _cursor_known = band._cursor_known;
+            _attr_known = band._attr_known;
+            break;
+        }
+    }
+
+    //
+    // Interface
+    //
+
+    void TerminalEncoder::set_options(Options opts)
+    {
+        // Switching encoders leaves the terminal in a state the other one does not know about
+        // and a different palette means that every cell has to be repainted
+        if (opts.mode != _options.mode || opts.colors != _options.colors)
+            invalidate();
+        // Cached sequences refer to colors by key
+        if (opts.colors != _options.colors)
+            _sgr_cache.clear();
+        _options = opts;
+        _palette = opts.colors == Colors::TrueColor ? nullptr : &Palette::get(opts.colors);
+    }
+    TerminalEncoder::Options TerminalEncoder::options() const
+    {
+        return _options;
+    }
+
+    void TerminalEncoder::set_code_page(const ExtendedCodePage* page)
+    {
+        _code_page = page;
+    }
+    void TerminalEncoder::set_executor(executor exec)
+    {
+        _executor = std::move(exec);
+    }
+
+    bool TerminalEncoder::encode(
+        buffer& out, std::span<const pixel> frame, std::size_t width, std::size_t height
+    )
+    {
+        const auto clean = !_valid || width != _width || height != _height;
+        const auto base = out.size();
+
+        out.reserve(
+            out.size() + frame.size() * sizeof(value_type) + (height + 1) + _max_color_len * 2
+        );
+
+        _pending.assign(frame.begin(), frame.end());
+        _width = width;
+        _height = height;
+
+        _cur_hash.resize(height);
+        for (std::size_t y = 0; y < height; y++)
+            _cur_hash[y] = row_hash(frame.subspan(y * width, width));
+
+        if (_options.mode == Mode::Legacy)
+        {
+            _reference_size = 0;
+            if (!_encode_legacy(out, frame, width, clean))
+            {
+                out.resize(base);
+                return false;
+            }
+            return true;
+        }
+
+        if (_options.compare)
+        {
+            _reference.clear();
+            _encode_legacy(_reference, frame, width, clean);
+            _reference_size = _reference.size();
+        }
+        else
+        {
+            _reference_size = 0;
+        }
+
+        _encode_optimal(out, frame, width, height, clean);
+        return out.size() != base;
+    }
+    void TerminalEncoder::commit()
+    {
+        std::swap(_previous, _pending);
+        std::swap(_prev_hash, _cur_hash);
+        _valid = true;
+    }
+    void TerminalEncoder::invalidate()
+    {
+        _valid = false;
+        _cursor_known = false;
+        _attr_known = false;
+    }
+
+    std::size_t TerminalEncoder::swapframe_size() const
+    {
+        return _previous.size();
+    }
+    std::size_t TerminalEncoder::reference_size() const
+    {
+        return _reference_size;
+    }
+} // namespace d2
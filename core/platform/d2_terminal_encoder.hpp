@@ -0,0 +1,214 @@
+#pragma once
+
+#include <core/types/d2_pixel.hpp>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace d2
+{
+    // Translates frames into VT escape sequences
+    // Keeps the last presented frame and only encodes the cells that changed
+    class TerminalEncoder
+    {
+    public:
+        using buffer = std::vector<unsigned char>;
+        // Runs callback(i) for every i < count, returns once all of them finished
+        using executor =
+            std::function<void(std::size_t count, const std::function<void(std::size_t)>&)>;
+
+        // Legacy - absolute positioning and a full SGR at the start of every changed run
+        // Optimal - tracks the terminal cursor and attributes and picks the cheapest sequence for
+        // every change (relative moves, newlines, overprinting short gaps, SGR deltas)
+        enum class Mode
+        {
+            Legacy,
+            Optimal,
+        };
+        // TrueColor - 24 bit SGR colors
+        // Palette256 - colors are quantized to the xterm 256 color cube and grayscale ramp
+        // Palette16 - colors are quantized to the 16 ANSI colors
+        enum class Colors
+        {
+            TrueColor,
+            Palette256,
+            Palette16,
+        };
+        struct Options
+        {
+            Mode mode{Mode::Optimal};
+            // Only used by the optimal encoder
+            Colors colors{Colors::TrueColor};
+            // ECH/EL for blank runs, requires background color erase on the terminal
+            bool erase{false};
+            // REP for repeated glyphs
+            bool repeat{false};
+            // DECSTBM + SU/SD for full width bands that moved vertically
+            bool scroll{true};
+            // Runs the legacy encoder alongside to measure its output (see reference_size())
+            bool compare{false};
+            // Reuses the SGR sequences built for earlier transitions (off only for comparisons)
+            bool sgr_cache{true};
+            // Diffs spanning at least this many cells are split into horizontal bands which are
+            // encoded concurrently on the executor (0 disables, only used by the optimal encoder)
+            std::size_t parallel_cells{32 * 1024};
+            std::size_t max_bands{8};
+        };
+    private:
+        static constexpr auto _max_pos_len = std::string_view("\x1b[XXXX;XXXXH").size();
+        static constexpr auto _max_color_len =
+            std::string_view("\033[RX;RX;RX;RX;RX;RX;RX;m").size() +
+            (std::string_view("38;2;255;255;255").size() * 2);
+        static constexpr auto _max_move_len = 32;
+        static constexpr auto _max_sgr_len = 96;
+        static constexpr auto _cls_code = std::string_view("\033[H");
+        static constexpr auto _max_scroll_bands = 4;
+        static constexpr auto _min_scroll_gain = 32;
+
+        // Open addressed, power of two size, with a short linear probe
+        static constexpr auto _sgr_cache_size = 256;
+        static constexpr auto _sgr_cache_probe = 4;
+
+        using position_type = std::pair<std::array<char, _max_pos_len>, int>;
+        using color_type = std::pair<std::array<char, _max_color_len>, int>;
+        using sequence = std::pair<std::array<char, _max_move_len>, std::size_t>;
+
+        struct Palette;
+
+        // Attribute transition, colors are stored as keys (see _foreground/_background)
+        // The previous state only matters through which colors change and its styles
+        struct Transition
+        {
+            std::uint32_t fg{0};
+            std::uint32_t bg{0};
+            px::style style{px::style::None};
+            px::style from_style{px::style::None};
+            std::uint8_t from_class{0};
+
+            bool operator==(const Transition&) const = default;
+        };
+        // Ready made SGR sequence for a transition (empty if the slot is free)
+        struct SgrEntry
+        {
+            Transition key{};
+            std::uint8_t size{0};
+            std::array<char, _max_sgr_len> data{};
+        };
+    private:
+        Options _options{};
+        const Palette* _palette{nullptr};
+        const ExtendedCodePage* _code_page{nullptr};
+
+        // Last presented frame and the one being encoded, with a hash per row
+        std::vector<pixel> _previous{};
+        std::vector<pixel> _pending{};
+        std::vector<std::uint64_t> _prev_hash{};
+        std::vector<std::uint64_t> _cur_hash{};
+        // Rows exposed by a scrolled band, the terminal holds nothing there
+        std::vector<bool> _exposed{};
+        std::size_t _width{0};
+        std::size_t _height{0};
+        bool _valid{false};
+
+        buffer _reference{};
+        std::size_t _reference_size{0};
+
+        std::vector<SgrEntry> _sgr_cache{};
+        SgrEntry _sgr_scratch{};
+
+        // Band encoders only use their terminal state, everything else is shared with this one
+        executor _executor{};
+        std::vector<TerminalEncoder> _bands{};
+        std::vector<buffer> _band_out{};
+        std::vector<std::size_t> _dirty_rows{};
+
+        // Terminal state as seen by the optimal encoder
+        // A column equal to the width means that a wrap is pending
+        std::size_t _cx{0};
+        std::size_t _cy{0};
+        // Colors are stored as keys, either packed RGB or a palette index
+        std::uint32_t _attr_fg{0};
+        std::uint32_t _attr_bg{0};
+        px::style _attr_style{px::style::None};
+        bool _cursor_known{false};
+        bool _attr_known{false};
+
+        // Legacy state
+        px::style _track_style{px::style::None};
+        px::foreground _track_foreground{};
+        px::background _track_background{};
+
+        position_type _generate_position(int x, int y, bool skip);
+        color_type _generate_color(const pixel& px, bool force = false);
+        void _kitty_id(buffer& out, std::uint32_t id);
+        const ExtendedCodePage* _page() const;
+        void _push(buffer& out, const pixel& px);
+
+        bool _encode_legacy(
+            buffer& out, std::span<const pixel> frame, std::size_t width, bool clean
+        );
+        void _encode_optimal(
+            buffer& out,
+            std::span<const pixel> frame,
+            std::size_t width,
+            std::size_t height,
+            bool clean
+        );
+        void _encode_scroll(
+            buffer& out, std::span<const pixel> frame, std::size_t width, std::size_t height
+        );
+        void _encode_bands(
+            buffer& out, std::span<const pixel> frame, std::size_t width, bool clean
+        );
+        void _encode_row(
+            buffer& out, std::span<const pixel> row, std::span<const pixel> prev, std::size_t y
+        );
+        void _encode_image(buffer& out, std::span<const pixel> unit, std::size_t x, std::size_t y);
+
+        void _move(buffer& out, std::span<const pixel> row, std::size_t x, std::size_t y);
+        void _sgr(buffer& out, const pixel& px);
+        const SgrEntry& _sgr_cached(const Transition& tr);
+        const SgrEntry& _sgr_uncached(const Transition& tr);
+        void _sgr_build(SgrEntry& entry) const;
+        bool _overprintable(const pixel& px) const;
+        bool _changed(const pixel& a, const pixel& b) const;
+        std::size_t
+        _next_change(std::span<const pixel> row, std::span<const pixel> prev, std::size_t x) const;
+        std::uint32_t _foreground(const pixel& px) const;
+        std::uint32_t _background(const pixel& px) const;
+    public:
+        TerminalEncoder() = default;
+        TerminalEncoder(const TerminalEncoder&) = delete;
+        TerminalEncoder(TerminalEncoder&&) = default;
+
+        void set_options(Options opts);
+        Options options() const;
+
+        // Code page used to resolve extended glyphs, the one of the calling thread if null
+        // Has to be set when encoding on a different thread than the one that composes frames
+        void set_code_page(const ExtendedCodePage* page);
+        // Used for encoding large diffs in parallel (see Options::parallel_cells)
+        void set_executor(executor exec);
+
+        // Encodes the changes between the last committed frame and the given one
+        // Returns false if nothing changed
+        bool
+        encode(buffer& out, std::span<const pixel> frame, std::size_t width, std::size_t height);
+        // The last encoded frame reached the terminal and becomes the base for the next diff
+        void commit();
+        // The terminal state is unknown (e.g. a partial write), the next frame is a clean redraw
+        void invalidate();
+
+        std::size_t swapframe_size() const;
+        // Bytes the legacy encoder produced for the last frame (0 if not comparing)
+        std::size_t reference_size() const;
+
+        TerminalEncoder& operator=(const TerminalEncoder&) = delete;
+        TerminalEncoder& operator=(TerminalEncoder&&) = default;
+    };
+} // namespace d2
@@ -0,0 +1,488 @@
+#include "core/platform/d2_terminal_parser.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace d2
+{
+    namespace
+    {
+        using State = TerminalParser::State;
+
+        enum class Action : std::uint8_t
+        {
+            None,
+            Print,
+            Execute,
+            Collect,
+            Prefix,
+            Param,
+            EscDispatch,
+            CsiDispatch,
+            Ss3Dispatch,
+            // ESC P/]/_/X/^, a string unless strings are disabled
+            StringEnter,
+            // DCS final byte, the rest is the payload
+            Hook,
+            Put,
+            StringEnd,
+        };
+
+        struct Transition
+        {
+            Action action{Action::None};
+            State next{State::Ground};
+        };
+
+        constexpr auto state_count = static_cast<std::size_t>(State::Count);
+        using Row = std::array<Transition, 256>;
+        using Table = std::array<Row, state_count>;
+
+        constexpr void fill(Row& row, unsigned from, unsigned to, Action action, State next)
+        {
+            for (auto ch = from; ch <= to; ch++)
+                row[ch] = {action, next};
+        }
+
+        constexpr Table make_table()
+        {
+            Table table{};
+            const auto row = [&](State state) -> Row&
+            { return table[static_cast<std::size_t>(state)]; };
+            // C0 controls are executed in place within sequences
+            const auto controls = [&](State state, Action action)
+            {
+                fill(row(state), 0x00, 0x17, action, state);
+                fill(row(state), 0x19, 0x19, action, state);
+                fill(row(state), 0x1c, 0x1f, action, state);
+            };
+
+            for (std::size_t i = 0; i < state_count; i++)
+            {
+                const auto state = static_cast<State>(i);
+                fill(row(state), 0x00, 0xff, Action::None, state);
+            }
+
+            // Ground
+            // DEL is executed rather than ignored, it is what the backspace key sends
+            controls(State::Ground, Action::Execute);
+            fill(row(State::Ground), 0x20, 0x7e, Action::Print, State::Ground);
+            fill(row(State::Ground), 0x7f, 0x7f, Action::Execute, State::Ground);
+            fill(row(State::Ground), 0x80, 0xff, Action::Print, State::Ground);
+
+            // Escape
+            // Anything printable after ESC is a sequence, which is also how Alt+key is reported
+            controls(State::Escape, Action::Execute);
+            fill(row(State::Escape), 0x20, 0x2f, Action::Collect, State::EscapeIntermediate);
+            fill(row(State::Escape), 0x30, 0xff, Action::EscDispatch, State::Ground);
+            fill(row(State::Escape), '[', '[', Action::None, State::CsiEntry);
+            fill(row(State::Escape), 'O', 'O', Action::None, State::Ss3);
+            fill(row(State::Escape), 'P', 'P', Action::StringEnter, State::DcsEntry);
+            fill(row(State::Escape), ']', ']', Action::StringEnter, State::OscString);
+            fill(row(State::Escape), '_', '_', Action::StringEnter, State::ApcString);
+            fill(row(State::Escape), 'X', 'X', Action::StringEnter, State::StringIgnore);
+            fill(row(State::Escape), '^', '^', Action::StringEnter, State::StringIgnore);
+
+            auto& esc_intermediate = row(State::EscapeIntermediate);
+            controls(State::EscapeIntermediate, Action::Execute);
+            fill(esc_intermediate, 0x20, 0x2f, Action::Collect, State::EscapeIntermediate);
+            fill(esc_intermediate, 0x30, 0x7e, Action::EscDispatch, State::Ground);
+
+            // CSI
+            controls(State::CsiEntry, Action::Execute);
+            fill(row(State::CsiEntry), 0x20, 0x2f, Action::Collect, State::CsiIntermediate);
+            fill(row(State::CsiEntry), 0x30, 0x3b, Action::Param, State::CsiParam);
+            fill(row(State::CsiEntry), 0x3c, 0x3f, Action::Prefix, State::CsiParam);
+            fill(row(State::CsiEntry), 0x40, 0x7e, Action::CsiDispatch, State::Ground);
+
+            controls(State::CsiParam, Action::Execute);
+            fill(row(State::CsiParam), 0x20, 0x2f, Action::Collect, State::CsiIntermediate);
+            fill(row(State::CsiParam), 0x30, 0x3b, Action::Param, State::CsiParam);
+            fill(row(State::CsiParam), 0x3c, 0x3f, Action::None, State::CsiIgnore);
+            fill(row(State::CsiParam), 0x40, 0x7e, Action::CsiDispatch, State::Ground);
+
+            auto& csi_intermediate = row(State::CsiIntermediate);
+            controls(State::CsiIntermediate, Action::Execute);
+            fill(csi_intermediate, 0x20, 0x2f, Action::Collect, State::CsiIntermediate);
+            fill(csi_intermediate, 0x30, 0x3f, Action::None, State::CsiIgnore);
+            fill(csi_intermediate, 0x40, 0x7e, Action::CsiDispatch, State::Ground);
+
+            controls(State::CsiIgnore, Action::Execute);
+            fill(row(State::CsiIgnore), 0x40, 0x7e, Action::None, State::Ground);
+
+            // SS3, some terminals put modifiers in front of the final byte
+            controls(State::Ss3, Action::Execute);
+            fill(row(State::Ss3), 0x20, 0x2f, Action::None, State::Ground);
+            fill(row(State::Ss3), 0x30, 0x3b, Action::Param, State::Ss3);
+            fill(row(State::Ss3), 0x3c, 0x3f, Action::None, State::Ground);
+            fill(row(State::Ss3), 0x40, 0x7e, Action::Ss3Dispatch, State::Ground);
+
+            // DCS
+            fill(row(State::DcsEntry), 0x20, 0x2f, Action::Collect, State::DcsIntermediate);
+            fill(row(State::DcsEntry), 0x30, 0x3b, Action::Param, State::DcsParam);
+            fill(row(State::DcsEntry), 0x3c, 0x3f, Action::Prefix, State::DcsParam);
+            fill(row(State::DcsEntry), 0x40, 0x7e, Action::Hook, State::DcsPassthrough);
+
+            fill(row(State::DcsParam), 0x20, 0x2f, Action::Collect, State::DcsIntermediate);
+            fill(row(State::DcsParam), 0x30, 0x3b, Action::Param, State::DcsParam);
+            fill(row(State::DcsParam), 0x3c, 0x3f, Action::None, State::StringIgnore);
+            fill(row(State::DcsParam), 0x40, 0x7e, Action::Hook, State::DcsPassthrough);
+
+            auto& dcs_intermediate = row(State::DcsIntermediate);
+            fill(dcs_intermediate, 0x20, 0x2f, Action::Collect, State::DcsIntermediate);
+            fill(dcs_intermediate, 0x30, 0x3f, Action::None, State::StringIgnore);
+            fill(dcs_intermediate, 0x40, 0x7e, Action::Hook, State::DcsPassthrough);
+
+            controls(State::DcsPassthrough, Action::Put);
+            fill(row(State::DcsPassthrough), 0x20, 0xff, Action::Put, State::DcsPassthrough);
+
+            // OSC/APC, BEL is accepted as a terminator along with ST
+            fill(row(State::OscString), 0x20, 0xff, Action::Put, State::OscString);
+            fill(row(State::ApcString), 0x20, 0xff, Action::Put, State::ApcString);
+            for (const auto state : {State::DcsPassthrough, State::OscString, State::ApcString})
+                fill(row(state), 0x07, 0x07, Action::StringEnd, State::Ground);
+            fill(row(State::StringIgnore), 0x07, 0x07, Action::None, State::Ground);
+
+            // Transitions from anywhere
+            for (std::size_t i = 0; i < state_count; i++)
+            {
+                const auto state = static_cast<State>(i);
+                fill(row(state), 0x18, 0x18, Action::Execute, State::Ground);
+                fill(row(state), 0x1a, 0x1a, Action::Execute, State::Ground);
+                fill(row(state), 0x1b, 0x1b, Action::None, State::Escape);
+            }
+            // A second ESC reports the first one
+            fill(row(State::Escape), 0x1b, 0x1b, Action::Execute, State::Escape);
+            // ESC ends a string, the ST itself is dropped
+            for (const auto state : {State::DcsPassthrough, State::OscString, State::ApcString})
+                fill(row(state), 0x1b, 0x1b, Action::StringEnd, State::StringEscape);
+            fill(row(State::StringIgnore), 0x1b, 0x1b, Action::None, State::StringEscape);
+            for (const auto state : {State::DcsEntry, State::DcsParam, State::DcsIntermediate})
+                fill(row(state), 0x1b, 0x1b, Action::None, State::StringEscape);
+
+            row(State::StringEscape) = row(State::Escape);
+            fill(row(State::StringEscape), '\\', '\\', Action::None, State::Ground);
+            return table;
+        }
+
+        constexpr auto table = make_table();
+
+        constexpr bool is_printable(unsigned char ch)
+        {
+            return ch >= 0x20 && ch != 0x7f;
+        }
+    } // namespace
+
+    void TerminalParser::_enter(State state)
+    {
+        switch (state)
+        {
+        case State::Escape:
+        case State::StringEscape:
+        case State::CsiEntry:
+        case State::Ss3:
+        case State::DcsEntry:
+            _param_count = 0;
+            _subparams = 0;
+            _intermediate_count = 0;
+            _prefix = 0;
+            _overflow = false;
+            break;
+        case State::OscString:
+        case State::ApcString:
+            _data_size = 0;
+            _truncated = false;
+            break;
+        default:
+            break;
+        }
+    }
+    void TerminalParser::_param(unsigned char ch)
+    {
+        if (_param_count == 0)
+            _params[_param_count++] = 0;
+
+        if (ch >= '0' && ch <= '9')
+        {
+            auto& value = _params[_param_count - 1];
+            value = std::min(value * 10 + (ch - '0'), _max_param_value);
+            return;
+        }
+
+        // ';' or ':'
+        if (_param_count == max_params)
+        {
+            _overflow = true;
+            return;
+        }
+        if (ch == ':')
+            _subparams |= std::uint32_t(1) << _param_count;
+        _params[_param_count++] = 0;
+    }
+    void TerminalParser::_collect(unsigned char ch)
+    {
+        if (_intermediate_count == max_intermediates)
+            _overflow = true;
+        else
+            _intermediates[_intermediate_count++] = static_cast<char>(ch);
+    }
+    void TerminalParser::_dispatch(Sequence::Kind kind, char final, Handler& handler)
+    {
+        if (_overflow)
+            return;
+
+        Sequence seq;
+        seq.kind = kind;
+        seq.prefix = _prefix;
+        seq.final = final;
+        seq.intermediates = {_intermediates.data(), _intermediate_count};
+        seq.params = {_params.data(), _param_count};
+        seq.subparams = _subparams;
+        if (kind == Sequence::Kind::Dcs || kind == Sequence::Kind::Osc ||
+            kind == Sequence::Kind::Apc)
+        {
+            seq.data = {_data.data(), _data_size};
+            seq.truncated = _truncated;
+        }
+        handler.on_sequence(seq);
+    }
+    void TerminalParser::_dispatch_string(Handler& handler)
+    {
+        switch (_state)
+        {
+        case State::DcsPassthrough:
+            _dispatch(Sequence::Kind::Dcs, _final, handler);
+            break;
+        case State::OscString:
+            _dispatch(Sequence::Kind::Osc, 0, handler);
+            break;
+        case State::ApcString:
+            _dispatch(Sequence::Kind::Apc, 0, handler);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void TerminalParser::_dispatch_paste_end(Handler& handler)
+    {
+        _enter(State::CsiEntry);
+        _params[_param_count++] = 201;
+        _dispatch(Sequence::Kind::Csi, '~', handler);
+    }
+    const unsigned char* TerminalParser::_feed_paste(
+        const unsigned char* ptr, const unsigned char* end, Handler& handler
+    )
+    {
+        while (ptr != end)
+        {
+            // Continue the terminator, a mismatch makes the matched part payload
+            if (_paste_match != 0)
+            {
+                if (*ptr == static_cast<unsigned char>(_paste_end[_paste_match]))
+                {
+                    ++ptr;
+                    if (++_paste_match == _paste_end.size())
+                    {
+                        _paste_match = 0;
+                        _state = State::Ground;
+                        _dispatch_paste_end(handler);
+                        return ptr;
+                    }
+                    continue;
+                }
+                handler.on_paste(_paste_end.substr(0, _paste_match));
+                _paste_match = 0;
+            }
+
+            // Everything up to the next ESC goes out as is
+            const auto* esc = static_cast<const unsigned char*>(
+                std::memchr(ptr, 0x1b, static_cast<std::size_t>(end - ptr))
+            );
+            const auto* stop = esc == nullptr ? end : esc;
+            if (stop != ptr)
+            {
+                handler.on_paste(
+                    {reinterpret_cast<const char*>(ptr), static_cast<std::size_t>(stop - ptr)}
+                );
+            }
+            if (esc == nullptr)
+                return end;
+            ptr = esc + 1;
+            _paste_match = 1;
+        }
+        return ptr;
+    }
+
+    void TerminalParser::set_strings(bool value)
+    {
+        _strings = value;
+    }
+    bool TerminalParser::strings() const
+    {
+        return _strings;
+    }
+
+    void TerminalParser::feed(std::string_view input, Handler& handler)
+    {
+        const auto* ptr = reinterpret_cast<const unsigned char*>(input.data());
+        const auto* end = ptr + input.size();
+        while (ptr != end)
+        {
+            if (_state == State::Paste)
+            {
+                ptr = _feed_paste(ptr, end, handler);
+                continue;
+            }
+            // Plain text is reported in runs
+            if (_state == State::Ground && is_printable(*ptr))
+            {
+                const auto* beg = ptr;
+                while (ptr != end && is_printable(*ptr))
+                    ++ptr;
+                handler.on_text(
+                    {reinterpret_cast<const char*>(beg), static_cast<std::size_t>(ptr - beg)}
+                );
+                continue;
+            }
+
+            const auto ch = *ptr++;
+            _introducer = 0;
+            const auto& tr = table[static_cast<std::size_t>(_state)][ch];
+            auto next = tr.next;
+            switch (tr.action)
+            {
+            case Action::None:
+                break;
+            case Action::Print:
+                handler.on_text({reinterpret_cast<const char*>(ptr - 1), 1});
+                break;
+            case Action::Execute:
+                handler.on_control(ch);
+                break;
+            case Action::Collect:
+                _collect(ch);
+                break;
+            case Action::Prefix:
+                _prefix = static_cast<char>(ch);
+                break;
+            case Action::Param:
+                _param(ch);
+                break;
+            case Action::EscDispatch:
+                _dispatch(Sequence::Kind::Esc, static_cast<char>(ch), handler);
+                break;
+            case Action::CsiDispatch:
+                _dispatch(Sequence::Kind::Csi, static_cast<char>(ch), handler);
+                // Bracketed paste start
+                if (ch == '~' && _param_count == 1 && _params[0] == 200 && _prefix == 0 &&
+                    _intermediate_count == 0)
+                {
+                    next = State::Paste;
+                    _paste_match = 0;
+                }
+                break;
+            case Action::Ss3Dispatch:
+                _dispatch(Sequence::Kind::Ss3, static_cast<char>(ch), handler);
+                break;
+            case Action::StringEnter:
+                if (!_strings)
+                {
+                    _dispatch(Sequence::Kind::Esc, static_cast<char>(ch), handler);
+                    next = State::Ground;
+                }
+                else
+                    _introducer = static_cast<char>(ch);
+                break;
+            case Action::Hook:
+                _final = static_cast<char>(ch);
+                _data_size = 0;
+                _truncated = false;
+                break;
+            case Action::Put:
+                if (_data_size < _data.size())
+                    _data[_data_size++] = static_cast<char>(ch);
+                else
+                    _truncated = true;
+                break;
+            case Action::StringEnd:
+                _dispatch_string(handler);
+                break;
+            }
+
+            if (next != _state || ch == 0x1b)
+            {
+                _state = next;
+                _enter(next);
+            }
+        }
+    }
+    bool TerminalParser::flush(Handler& handler)
+    {
+        if (_state == State::Ground)
+            return false;
+        if (_state == State::Paste)
+        {
+            if (_paste_match != 0)
+                handler.on_paste(_paste_end.substr(0, _paste_match));
+            _dispatch_paste_end(handler);
+        }
+        else if (_introducer != 0)
+        {
+            // Nothing followed ESC P/]/_/X/^, this is Alt+key rather than a string
+            _dispatch(Sequence::Kind::Esc, _introducer, handler);
+        }
+        else if (_state == State::EscapeIntermediate && _intermediate_count == 1 && !_overflow)
+        {
+            // ESC followed by 0x20-0x2f and nothing else is Alt+key (e.g. Alt+Space, Alt+-)
+            const auto final = _intermediates[0];
+            _intermediate_count = 0;
+            _dispatch(Sequence::Kind::Esc, final, handler);
+        }
+        else if (!in_string())
+        {
+            handler.on_control(0x1b);
+        }
+        reset();
+        return true;
+    }
+    void TerminalParser::reset()
+    {
+        _state = State::Ground;
+        _enter(State::Escape);
+        _data_size = 0;
+        _truncated = false;
+        _paste_match = 0;
+        _introducer = 0;
+    }
+
+    TerminalParser::State TerminalParser::state() const
+    {
+        return _state;
+    }
+    bool TerminalParser::idle() const
+    {
+        return _state == State::Ground;
+    }
+    bool TerminalParser::in_string() const
+    {
+        switch (_state)
+        {
+        case State::DcsEntry:
+        case State::DcsParam:
+        case State::DcsIntermediate:
+        case State::DcsPassthrough:
+        case State::OscString:
+        case State::ApcString:
+        case State::StringIgnore:
+        case State::StringEscape:
+            return true;
+        default:
+            return false;
+        }
+    }
+    bool TerminalParser::in_paste() const
+    {
+        return _state == State::Paste;
+    }
+} // namespace d2
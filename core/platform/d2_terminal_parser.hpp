@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace d2
+{
+    // Incremental VT input parser, follows the DEC ANSI parser model (vt100.net/emu)
+    // Input can be fed in chunks of any size, sequences split between them are resumed
+    // Nothing is allocated, parameters and string payloads are kept in fixed buffers
+    class TerminalParser
+    {
+    public:
+        static constexpr std::size_t max_params = 16;
+        static constexpr std::size_t max_intermediates = 2;
+        static constexpr std::size_t max_string = 4096;
+
+        enum class State : std::uint8_t
+        {
+            Ground,
+            Escape,
+            EscapeIntermediate,
+            CsiEntry,
+            CsiParam,
+            CsiIntermediate,
+            CsiIgnore,
+            Ss3,
+            DcsEntry,
+            DcsParam,
+            DcsIntermediate,
+            DcsPassthrough,
+            OscString,
+            ApcString,
+            // SOS/PM, or a DCS that cannot be parsed
+            StringIgnore,
+            // ESC within a string, either ST or the start of a new sequence
+            StringEscape,
+            // Bracketed paste payload, only the terminator is looked for
+            Paste,
+            Count,
+        };
+
+        // Complete escape sequence, views are only valid during the callback
+        struct Sequence
+        {
+            enum class Kind : std::uint8_t
+            {
+                Esc,
+                Csi,
+                Ss3,
+                Dcs,
+                Osc,
+                Apc,
+            };
+
+            Kind kind{Kind::Esc};
+            // Private marker ('<', '=', '>', '?') or 0
+            char prefix{0};
+            char final{0};
+            std::string_view intermediates{};
+            std::span<const int> params{};
+            // Bit i is set if params[i] was separated from the previous one by ':'
+            std::uint32_t subparams{0};
+            // String payload of DCS/OSC/APC
+            std::string_view data{};
+            // The payload did not fit and was cut
+            bool truncated{false};
+
+            int param(std::size_t idx, int fallback = 0) const
+            {
+                return idx < params.size() ? params[idx] : fallback;
+            }
+        };
+
+        class Handler
+        {
+        public:
+            virtual ~Handler() = default;
+
+            // Printable run (UTF-8 is passed through)
+            virtual void on_text(std::string_view text) = 0;
+            // C0 controls, DEL, and ESC if it was not followed by a sequence (see flush())
+            virtual void on_control(unsigned char ch) = 0;
+            virtual void on_sequence(const Sequence& seq) = 0;
+            // Bracketed paste payload, reported in chunks between CSI 200 ~ and CSI 201 ~
+            virtual void on_paste(std::string_view data) = 0;
+        };
+    private:
+        static constexpr auto _max_param_value = 0xFFFFFF;
+        static constexpr auto _paste_end = std::string_view("\033[201~");
+
+        State _state{State::Ground};
+        bool _strings{true};
+
+        std::array<int, max_params> _params{};
+        std::size_t _param_count{0};
+        std::uint32_t _subparams{0};
+        std::array<char, max_intermediates> _intermediates{};
+        std::size_t _intermediate_count{0};
+        char _prefix{0};
+        char _final{0};
+        // Too many parameters or intermediates, the sequence is dropped
+        bool _overflow{false};
+
+        std::array<char, max_string> _data{};
+        std::size_t _data_size{0};
+        bool _truncated{false};
+
+        // Length of the paste terminator prefix seen at the end of the last input
+        std::size_t _paste_match{0};
+        // String introducer (P, ], _, X, ^) while nothing has followed it yet
+        char _introducer{0};
+
+        void _enter(State state);
+        void _param(unsigned char ch);
+        void _collect(unsigned char ch);
+        void _dispatch(Sequence::Kind kind, char final, Handler& handler);
+        void _dispatch_string(Handler& handler);
+        void _dispatch_paste_end(Handler& handler);
+        const unsigned char*
+        _feed_paste(const unsigned char* ptr, const unsigned char* end, Handler& handler);
+    public:
+        TerminalParser() = default;
+        TerminalParser(const TerminalParser&) = default;
+        TerminalParser(TerminalParser&&) = default;
+
+        // Parses DCS, OSC, APC (and ignores SOS/PM) instead of reporting ESC P/]/_/X/^ as ESC
+        // sequences (which Alt+key also produces), on by default
+        void set_strings(bool value);
+        bool strings() const;
+
+        void feed(std::string_view input, Handler& handler);
+        // Gives up on an incomplete sequence (e.g. after no more input came for a while)
+        // A pending ESC is reported as a control, strings are dropped, a paste is ended
+        // ESC with a single intermediate is reported as an ESC sequence with it as the final,
+        // as is a string introducer nothing followed (so that Alt+P etc. still work)
+        // Returns false if there was nothing to flush
+        bool flush(Handler& handler);
+        void reset();
+
+        State state() const;
+        // Nothing is pending
+        bool idle() const;
+        // Within a DCS/OSC/APC/SOS/PM string
+        bool in_string() const;
+        // Within a bracketed paste
+        bool in_paste() const;
+
+        TerminalParser& operator=(const TerminalParser&) = default;
+        TerminalParser& operator=(TerminalParser&&) = default;
+    };
+} // namespace d2
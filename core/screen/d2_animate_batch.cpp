@@ -0,0 +1,399 @@
+#include "core/screen/d2_animate_batch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <utility>
+#include <core/tree/d2_tree_element.hpp>
+
+namespace d2
+{
+    namespace
+    {
+        template<Easing Curve> void ease(float* progress, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; i++)
+            {
+                const auto t = progress[i];
+                if constexpr (Curve == Easing::InQuad)
+                    progress[i] = t * t;
+                else if constexpr (Curve == Easing::OutQuad)
+                    progress[i] = t * (2.f - t);
+                else if constexpr (Curve == Easing::InOutQuad)
+                    progress[i] = t < 0.5f ? 2.f * t * t : -1.f + (4.f - 2.f * t) * t;
+            }
+        }
+        template<std::size_t Channels, bool Integral>
+        void lerp(
+            const float* from,
+            const float* delta,
+            const float* progress,
+            float* value,
+            std::size_t count
+        )
+        {
+            for (std::size_t i = 0; i < count; i++)
+            {
+                for (std::size_t c = 0; c < Channels; c++)
+                {
+                    const auto k = i * Channels + c;
+                    if constexpr (Integral)
+                        value[k] = std::nearbyint(from[k] + delta[k] * progress[i]);
+                    else
+                        value[k] = from[k] + delta[k] * progress[i];
+                }
+            }
+        }
+        template<std::size_t Channels>
+        void lerp(
+            bool integral,
+            const float* from,
+            const float* delta,
+            const float* progress,
+            float* value,
+            std::size_t count
+        )
+        {
+            if (integral)
+                lerp<Channels, true>(from, delta, progress, value, count);
+            else
+                lerp<Channels, false>(from, delta, progress, value, count);
+        }
+    } // namespace
+
+    std::size_t AnimationBatch::Group::size() const
+    {
+        return keys.size();
+    }
+    void AnimationBatch::Group::evaluate(double now)
+    {
+        const auto count = size();
+        for (std::size_t i = 0; i < count; i++)
+            progress[i] = std::clamp(float(now - start[i]) * inv_duration[i], 0.f, 1.f);
+
+        switch (easing)
+        {
+        case Easing::InQuad:
+            ease<Easing::InQuad>(progress.data(), count);
+            break;
+        case Easing::OutQuad:
+            ease<Easing::OutQuad>(progress.data(), count);
+            break;
+        case Easing::InOutQuad:
+            ease<Easing::InOutQuad>(progress.data(), count);
+            break;
+        default:
+            break;
+        }
+
+        switch (channels)
+        {
+        case 1:
+            lerp<1>(integral, from.data(), delta.data(), progress.data(), value.data(), count);
+            break;
+        case 4:
+            lerp<4>(integral, from.data(), delta.data(), progress.data(), value.data(), count);
+            break;
+        default:
+            for (std::size_t i = 0; i < count; i++)
+            {
+                for (std::size_t c = 0; c < channels; c++)
+                {
+                    const auto k = i * channels + c;
+                    value[k] = from[k] + delta[k] * progress[i];
+                    if (integral)
+                        value[k] = std::nearbyint(value[k]);
+                }
+            }
+        }
+    }
+    void AnimationBatch::Group::remove(std::size_t idx)
+    {
+        const auto back = size() - 1;
+        if (idx != back)
+        {
+            start[idx] = start[back];
+            inv_duration[idx] = inv_duration[back];
+            progress[idx] = progress[back];
+            targets[idx] = std::move(targets[back]);
+            keys[idx] = keys[back];
+            writers[idx] = writers[back];
+            callbacks[idx] = std::move(callbacks[back]);
+            std::copy_n(from.begin() + back * channels, channels, from.begin() + idx * channels);
+            std::copy_n(delta.begin() + back * channels, channels, delta.begin() + idx * channels);
+            std::copy_n(value.begin() + back * channels, channels, value.begin() + idx * channels);
+            std::copy_n(last.begin() + back * channels, channels, last.begin() + idx * channels);
+        }
+
+        start.pop_back();
+        inv_duration.pop_back();
+        progress.pop_back();
+        targets.pop_back();
+        keys.pop_back();
+        writers.pop_back();
+        callbacks.pop_back();
+        from.resize(back * channels);
+        delta.resize(back * channels);
+        value.resize(back * channels);
+        last.resize(back * channels);
+    }
+
+    double AnimationBatch::_seconds(clock::time_point time) const
+    {
+        return std::chrono::duration<double>(time - _epoch).count();
+    }
+    AnimationBatch::Group&
+    AnimationBatch::_group(Easing easing, std::size_t channels, bool integral)
+    {
+        for (decltype(auto) it : _groups)
+            if (it.easing == easing && it.channels == channels && it.integral == integral)
+                return it;
+
+        auto& group = _groups.emplace_back();
+        group.easing = easing;
+        group.channels = std::uint8_t(channels);
+        group.integral = integral;
+        return group;
+    }
+    AnimationBatch::Finished AnimationBatch::_erase(key target)
+    {
+        if (_updating)
+            return _detach(target);
+
+        const auto f = _lookup.find(target);
+        if (f == _lookup.end())
+            return {};
+        return _remove_at(f->second.group, f->second.index);
+    }
+    AnimationBatch::Finished AnimationBatch::_detach(key target)
+    {
+        Finished result{};
+        if (const auto f = _lookup.find(target); f != _lookup.end())
+        {
+            auto& data = _groups[f->second.group];
+            const auto index = f->second.index;
+            result.target = std::exchange(data.targets[index], {});
+            result.finish = std::exchange(data.callbacks[index], nullptr);
+        }
+        // A queued track replaces the running one, so the last one queued is reported
+        for (auto it = _deferred.begin(); it != _deferred.end();)
+        {
+            if (it->target.get() == target.first && it->prop == target.second)
+            {
+                result.target = it->target;
+                result.finish = std::move(it->finish);
+                it = _deferred.erase(it);
+            }
+            else
+                ++it;
+        }
+        return result;
+    }
+    AnimationBatch::Finished AnimationBatch::_remove_at(std::uint32_t group, std::uint32_t index)
+    {
+        auto& data = _groups[group];
+        Finished result{
+            .target = std::move(data.targets[index]),
+            .finish = std::move(data.callbacks[index]),
+        };
+
+        _lookup.erase(data.keys[index]);
+        if (const auto back = std::uint32_t(data.size() - 1); index != back)
+            _lookup[data.keys[back]].index = index;
+        data.remove(index);
+        return result;
+    }
+    void AnimationBatch::_insert(
+        std::shared_ptr<Element> target,
+        style::uai_property prop,
+        std::chrono::milliseconds duration,
+        Easing easing,
+        std::size_t channels,
+        bool integral,
+        const float* from,
+        const float* to,
+        writer write,
+        callback finish
+    )
+    {
+        if (_updating)
+        {
+            auto& ins = _deferred.emplace_back(Insert{
+                .target = std::move(target),
+                .prop = prop,
+                .duration = duration,
+                .easing = easing,
+                .channels = channels,
+                .integral = integral,
+                .write = write,
+                .finish = std::move(finish),
+            });
+            std::copy_n(from, channels, ins.from.begin());
+            std::copy_n(to, channels, ins.to.begin());
+            return;
+        }
+
+        const auto target_key = key{target.get(), prop};
+        _erase(target_key);
+        // Nothing is running, the epoch can be moved closer to keep the precision
+        if (_lookup.empty())
+            _epoch = clock::now();
+
+        auto& group = _group(easing, channels, integral);
+        const auto now = _seconds(clock::now());
+        if (duration.count() > 0)
+        {
+            group.start.push_back(now);
+            group.inv_duration.push_back(1000.f / float(duration.count()));
+        }
+        else
+        {
+            // Finishes on the next update
+            group.start.push_back(now - 1.0);
+            group.inv_duration.push_back(1.f);
+        }
+        group.progress.push_back(0.f);
+        group.targets.push_back(target);
+        group.keys.push_back(target_key);
+        group.writers.push_back(write);
+        group.callbacks.push_back(std::move(finish));
+        for (std::size_t c = 0; c < channels; c++)
+        {
+            group.from.push_back(from[c]);
+            group.delta.push_back(to[c] - from[c]);
+            group.value.push_back(from[c]);
+            group.last.push_back(from[c]);
+        }
+
+        _lookup[target_key] = Location{
+            .group = std::uint32_t(&group - _groups.data()),
+            .index = std::uint32_t(group.size() - 1),
+        };
+    }
+
+    AnimationBatch::Finished AnimationBatch::remove(const Element* target, style::uai_property prop)
+    {
+        return _erase({target, prop});
+    }
+    std::vector<AnimationBatch::Finished> AnimationBatch::remove(const Element* target)
+    {
+        std::vector<key> keys;
+        for (const auto& [k, _] : _lookup)
+            if (k.first == target)
+                keys.push_back(k);
+        for (const auto& it : _deferred)
+            if (it.target.get() == target && !_lookup.contains(key{target, it.prop}))
+                keys.emplace_back(target, it.prop);
+
+        std::vector<Finished> result;
+        result.reserve(keys.size());
+        for (const auto& k : keys)
+            result.push_back(_erase(k));
+        return result;
+    }
+    bool AnimationBatch::contains(const Element* target, style::uai_property prop) const
+    {
+        const auto f = _lookup.find(key{target, prop});
+        if (f != _lookup.end() && !_groups[f->second.group].targets[f->second.index].expired())
+            return true;
+        return std::any_of(
+            _deferred.begin(),
+            _deferred.end(),
+            [&](const Insert& it) { return it.target.get() == target && it.prop == prop; }
+        );
+    }
+
+    std::vector<AnimationBatch::Finished> AnimationBatch::update(clock::time_point now)
+    {
+        std::vector<Finished> finished;
+        if (_lookup.empty())
+            return finished;
+
+        const auto time = _seconds(now);
+        _writes.clear();
+        for (std::size_t g = 0; g < _groups.size(); g++)
+        {
+            auto& group = _groups[g];
+            group.evaluate(time);
+
+            const auto channels = group.channels;
+            for (std::size_t i = 0; i < group.size(); i++)
+            {
+                const auto off = i * channels;
+                if (!std::equal(
+                        group.value.begin() + off,
+                        group.value.begin() + off + channels,
+                        group.last.begin() + off
+                    ))
+                    _writes.push_back({
+                        .key = group.keys[i].first,
+                        .group = std::uint32_t(g),
+                        .index = std::uint32_t(i),
+                    });
+            }
+        }
+
+        // Writes to the same element go out back to back
+        std::sort(
+            _writes.begin(),
+            _writes.end(),
+            [](const Write& a, const Write& b)
+            {
+                return std::tie(a.key, a.group, a.index) < std::tie(b.key, b.group, b.index);
+            }
+        );
+        std::shared_ptr<Element> held = nullptr;
+        _updating = true;
+        for (const auto& it : _writes)
+        {
+            auto& group = _groups[it.group];
+            // Removed by an earlier writer
+            if (group.targets[it.index].expired())
+                continue;
+            if (held.get() != it.key)
+                held = group.targets[it.index].lock();
+            if (held == nullptr)
+                continue;
+            // Hidden elements only receive the final value
+            if (group.progress[it.index] < 1.f && !held->getstate(Element::State::Display))
+                continue;
+
+            const auto off = it.index * group.channels;
+            group.writers[it.index](*held, group.value.data() + off);
+            std::copy_n(group.value.begin() + off, group.channels, group.last.begin() + off);
+        }
+        held = nullptr;
+        _updating = false;
+
+        for (std::uint32_t g = 0; g < _groups.size(); g++)
+        {
+            auto& group = _groups[g];
+            for (auto i = std::uint32_t(group.size()); i-- > 0;)
+                if (group.progress[i] >= 1.f || group.targets[i].expired())
+                    finished.push_back(_remove_at(g, i));
+        }
+        for (auto& it : std::exchange(_deferred, {}))
+            _insert(
+                std::move(it.target),
+                it.prop,
+                it.duration,
+                it.easing,
+                it.channels,
+                it.integral,
+                it.from.data(),
+                it.to.data(),
+                it.write,
+                std::move(it.finish)
+            );
+        return finished;
+    }
+
+    std::size_t AnimationBatch::size() const
+    {
+        return _lookup.size();
+    }
+    bool AnimationBatch::empty() const
+    {
+        return _lookup.empty();
+    }
+} // namespace d2
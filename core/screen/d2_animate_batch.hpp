@@ -0,0 +1,254 @@
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <core/screen/d2_animate.hpp>
+#include <core/tree/d2_tree_element_frwd.hpp>
+#include <core/types/d2_element_units.hpp>
+#include <core/types/d2_pixel.hpp>
+
+namespace d2
+{
+    enum class Easing : std::uint8_t
+    {
+        Linear,
+        InQuad,
+        OutQuad,
+        InOutQuad,
+        Count,
+    };
+
+    namespace impl
+    {
+        // Numeric channels of an animatable value
+        // Only the channels are interpolated, the rest of the value is left as is
+        template<typename Type> struct BatchChannels;
+        template<typename Type>
+            requires std::is_arithmetic_v<Type>
+        struct BatchChannels<Type>
+        {
+            static constexpr std::size_t count = 1;
+            static constexpr bool integral = std::is_integral_v<Type>;
+
+            static void pack(const Type& value, float* out)
+            {
+                out[0] = float(value);
+            }
+            static void unpack(const float* in, Type& value)
+            {
+                value = Type(in[0]);
+            }
+        };
+        template<typename Type>
+            requires std::is_base_of_v<Unit, Type>
+        struct BatchChannels<Type>
+        {
+            static constexpr std::size_t count = 1;
+            static constexpr bool integral = false;
+
+            static void pack(const Type& value, float* out)
+            {
+                out[0] = value.raw();
+            }
+            static void unpack(const float* in, Type& value)
+            {
+                value = Type(in[0], value.getunits(), value.getmods());
+            }
+        };
+        template<typename Type>
+            requires std::is_same_v<Type, px::background> || std::is_same_v<Type, px::foreground>
+        struct BatchChannels<Type>
+        {
+            static constexpr std::size_t count = 4;
+            static constexpr bool integral = true;
+
+            static void pack(const Type& value, float* out)
+            {
+                out[0] = value.r;
+                out[1] = value.g;
+                out[2] = value.b;
+                out[3] = value.a;
+            }
+            static void unpack(const float* in, Type& value)
+            {
+                value.r = px::impl::clamp_byte(int(in[0]));
+                value.g = px::impl::clamp_byte(int(in[1]));
+                value.b = px::impl::clamp_byte(int(in[2]));
+                value.a = px::impl::clamp_byte(int(in[3]));
+            }
+        };
+
+        template<typename Type>
+        concept batch_animatable = requires { BatchChannels<Type>::count; };
+    } // namespace impl
+
+    // Numeric interpolations (colors, units, offsets) kept in contiguous arrays
+    // Tracks are grouped by easing and channel layout, every group is evaluated in a single pass
+    // and the values that changed are written back in one batch (ordered by element)
+    // Unlike Animation there is no per track allocation or virtual dispatch
+    class AnimationBatch
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+        using callback = std::function<void(TreeIter<>)>;
+        // Writes the channels into the property (as a temporary write)
+        using writer = void (*)(Element&, const float*);
+        static constexpr std::size_t max_channels = 4;
+
+        struct Finished
+        {
+            std::weak_ptr<Element> target{};
+            callback finish{nullptr};
+        };
+    private:
+        using key = std::pair<const Element*, style::uai_property>;
+
+        struct Group
+        {
+            Easing easing{Easing::Linear};
+            std::uint8_t channels{1};
+            bool integral{false};
+
+            // Per track
+            // Seconds since the epoch of the batch
+            std::vector<double> start{};
+            std::vector<float> inv_duration{};
+            std::vector<float> progress{};
+            std::vector<std::weak_ptr<Element>> targets{};
+            std::vector<key> keys{};
+            std::vector<writer> writers{};
+            std::vector<callback> callbacks{};
+            // Per track and channel (track major)
+            std::vector<float> from{};
+            std::vector<float> delta{};
+            std::vector<float> value{};
+            std::vector<float> last{};
+
+            std::size_t size() const;
+            // Evaluates the easing and the channels of every track
+            void evaluate(double now);
+            void remove(std::size_t idx);
+        };
+        struct Location
+        {
+            std::uint32_t group{0};
+            std::uint32_t index{0};
+        };
+        struct Write
+        {
+            const Element* key{nullptr};
+            std::uint32_t group{0};
+            std::uint32_t index{0};
+        };
+        // Track added by a writer, inserted once the update is done
+        struct Insert
+        {
+            std::shared_ptr<Element> target{};
+            style::uai_property prop{};
+            std::chrono::milliseconds duration{};
+            Easing easing{Easing::Linear};
+            std::size_t channels{1};
+            bool integral{false};
+            std::array<float, max_channels> from{};
+            std::array<float, max_channels> to{};
+            writer write{nullptr};
+            callback finish{nullptr};
+        };
+
+        clock::time_point _epoch{clock::now()};
+        std::vector<Group> _groups{};
+        absl::flat_hash_map<key, Location> _lookup{};
+        // Scratch buffer reused between updates
+        std::vector<Write> _writes{};
+        // Writers may add or remove tracks, which would move the groups under the update
+        // Removed tracks lose their target (and are dropped after the writes), adds are queued
+        bool _updating{false};
+        std::vector<Insert> _deferred{};
+
+        double _seconds(clock::time_point time) const;
+        Group& _group(Easing easing, std::size_t channels, bool integral);
+        Finished _erase(key target);
+        // Takes the callback and target of the track but leaves it in place (see _updating)
+        Finished _detach(key target);
+        // Swap removes the track, keeps the lookup of the moved one in sync
+        Finished _remove_at(std::uint32_t group, std::uint32_t index);
+        void _insert(
+            std::shared_ptr<Element> target,
+            style::uai_property prop,
+            std::chrono::milliseconds duration,
+            Easing easing,
+            std::size_t channels,
+            bool integral,
+            const float* from,
+            const float* to,
+            writer write,
+            callback finish
+        );
+    public:
+        AnimationBatch() = default;
+        AnimationBatch(const AnimationBatch&) = delete;
+        AnimationBatch(AnimationBatch&&) = default;
+
+        // Starts interpolating the property from its current value to dest
+        // Replaces the track already running for the same property (without finishing it)
+        template<typename Type, style::uai_property Property>
+            requires impl::batch_animatable<impl::style_type<Type, Property>>
+        void add(
+            std::chrono::milliseconds duration,
+            std::shared_ptr<Type> target,
+            impl::style_type<Type, Property> dest,
+            Easing easing = Easing::Linear,
+            callback finish = nullptr
+        )
+        {
+            using value_type = impl::style_type<Type, Property>;
+            using channels = impl::BatchChannels<value_type>;
+
+            float from[max_channels]{};
+            float to[max_channels]{};
+            channels::pack(target->template get<Property>(), from);
+            channels::pack(dest, to);
+            _insert(
+                target,
+                Property,
+                duration,
+                easing,
+                channels::count,
+                channels::integral,
+                from,
+                to,
+                [](Element& elem, const float* in)
+                {
+                    auto& ref = static_cast<Type&>(elem);
+                    auto value = ref.template get<Property>();
+                    channels::unpack(in, value);
+                    ref.template set<Property, true>(value);
+                },
+                std::move(finish)
+            );
+        }
+
+        // Removes the track of the property, returns its callback (empty if there was none)
+        Finished remove(const Element* target, style::uai_property prop);
+        // Removes every track of the element
+        std::vector<Finished> remove(const Element* target);
+        bool contains(const Element* target, style::uai_property prop) const;
+
+        // Evaluates and writes all tracks, returns the tracks which finished (or lost the target)
+        // The callbacks are left to the caller, they may start new animations
+        std::vector<Finished> update(clock::time_point now = clock::now());
+
+        std::size_t size() const;
+        bool empty() const;
+
+        AnimationBatch& operator=(const AnimationBatch&) = delete;
+        AnimationBatch& operator=(AnimationBatch&&) = default;
+    };
+} // namespace d2
@@ -0,0 +1,261 @@
+#include "core/screen/d2_focus_index.hpp"
+
+#include <algorithm>
+#include <core/tree/d2_tree_parent.hpp>
+
+namespace d2
+{
+    FocusIndex::id FocusIndex::_make(std::shared_ptr<Element> ptr, id parent)
+    {
+        id result;
+        if (!_free.empty())
+        {
+            result = _free.back();
+            _free.pop_back();
+        }
+        else
+        {
+            result = id(_nodes.size());
+            _nodes.emplace_back();
+        }
+
+        auto& node = _nodes[result];
+        node.ref = ptr;
+        node.key = ptr.get();
+        node.parent = parent;
+        node.generation = 0;
+        node.focusable = false;
+        node.first = 0;
+        node.children.clear();
+
+        _lookup[ptr.get()] = result;
+        return result;
+    }
+    void FocusIndex::_remove(id node)
+    {
+        if (const auto parent = _nodes[node].parent; parent != _none)
+        {
+            auto& children = _nodes[parent].children;
+            if (const auto f = std::find(children.begin(), children.end(), node);
+                f != children.end())
+                children.erase(f);
+        }
+        _drop(node);
+    }
+    void FocusIndex::_drop(id node)
+    {
+        for (const auto child : _nodes[node].children)
+            _drop(child);
+
+        auto& data = _nodes[node];
+        if (const auto f = _lookup.find(data.key); f != _lookup.end() && f->second == node)
+            _lookup.erase(f);
+        data.ref.reset();
+        data.key = nullptr;
+        data.parent = _none;
+        data.children.clear();
+        _free.push_back(node);
+        _order_dirty = true;
+    }
+
+    void FocusIndex::_sync(id node, const std::shared_ptr<Element>& elem, bool rebuild)
+    {
+        const auto dirty = rebuild || elem->getistate(Element::FocusDirty);
+        if (!dirty && !elem->getistate(Element::FocusChildDirty))
+            return;
+        internal::ElementView::from(elem).signal_update(
+            Element::FocusDirty | Element::FocusChildDirty
+        );
+
+        if (const auto focusable = elem->provides_input(); focusable != _nodes[node].focusable)
+        {
+            _nodes[node].focusable = focusable;
+            _order_dirty = true;
+        }
+
+        const auto parent = std::dynamic_pointer_cast<ParentElement>(elem);
+        if (parent == nullptr)
+            return;
+
+        // Nothing was inserted or removed here, only the marked paths below are followed
+        if (!dirty)
+        {
+            const auto children = _nodes[node].children;
+            for (const auto child : children)
+                if (const auto ptr = _nodes[child].ref.lock(); ptr != nullptr)
+                    _sync(child, ptr, false);
+            return;
+        }
+
+        const auto generation = ++_generation;
+        std::vector<id> children;
+        parent->foreach(
+            [&](TreeIter<> it) -> bool
+            {
+                const auto child = it.shared();
+                // Hidden subtrees are left out, showing or hiding a child marks the parent
+                if (child == nullptr || !child->getstate(Element::State::Display))
+                    return true;
+
+                id cid = _none;
+                // Pointers of destroyed elements can be reused, and elements can be moved
+                if (const auto f = _lookup.find(child.get()); f != _lookup.end())
+                {
+                    if (_nodes[f->second].parent == node && _nodes[f->second].ref.lock() == child)
+                        cid = f->second;
+                    else
+                        _remove(f->second);
+                }
+
+                const auto created = cid == _none;
+                if (created)
+                    cid = _make(child, node);
+                _nodes[cid].generation = generation;
+                children.push_back(cid);
+                _sync(cid, child, created);
+                return true;
+            }
+        );
+
+        // Removed or hidden since
+        for (const auto child : _nodes[node].children)
+            if (_nodes[child].generation != generation)
+                _drop(child);
+        if (children != _nodes[node].children)
+            _order_dirty = true;
+        _nodes[node].children = std::move(children);
+    }
+    void FocusIndex::_rebuild_order()
+    {
+        _order_dirty = false;
+        _order.clear();
+
+        // The root itself is never navigated to
+        std::vector<id> stack(
+            _nodes[_root_id].children.rbegin(), _nodes[_root_id].children.rend()
+        );
+        while (!stack.empty())
+        {
+            const auto node = stack.back();
+            stack.pop_back();
+
+            auto& data = _nodes[node];
+            data.first = std::uint32_t(_order.size());
+            if (data.focusable)
+                _order.push_back(node);
+            stack.insert(stack.end(), data.children.rbegin(), data.children.rend());
+        }
+
+        const auto count = std::uint32_t(_order.size());
+        _run_begin.resize(count);
+        _run_end.resize(count);
+        for (std::uint32_t beg = 0; beg < count;)
+        {
+            auto end = beg + 1;
+            while (end < count && _nodes[_order[end]].parent == _nodes[_order[beg]].parent)
+                end++;
+            std::fill(_run_begin.begin() + beg, _run_begin.begin() + end, beg);
+            std::fill(_run_end.begin() + beg, _run_end.begin() + end, end);
+            beg = end;
+        }
+    }
+
+    FocusIndex::id FocusIndex::_find(const Element* elem) const
+    {
+        if (elem == nullptr)
+            return _none;
+        if (const auto f = _lookup.find(elem); f != _lookup.end() && f->second != _root_id)
+            return f->second;
+        return _none;
+    }
+    std::shared_ptr<Element> FocusIndex::_at(std::uint32_t pos) const
+    {
+        return _nodes[_order[pos]].ref.lock();
+    }
+
+    void FocusIndex::update(std::shared_ptr<ParentElement> root)
+    {
+        if (root == nullptr)
+        {
+            clear();
+            return;
+        }
+
+        if (_root.lock() != root)
+        {
+            clear();
+            _root = root;
+            _root_id = _make(root, _none);
+            _sync(_root_id, root, true);
+        }
+        else
+            _sync(_root_id, root, false);
+
+        if (_order_dirty)
+            _rebuild_order();
+    }
+    void FocusIndex::clear()
+    {
+        _root.reset();
+        _root_id = _none;
+        _order_dirty = false;
+        _nodes.clear();
+        _free.clear();
+        _lookup.clear();
+        _order.clear();
+        _run_begin.clear();
+        _run_end.clear();
+    }
+
+    std::shared_ptr<Element> FocusIndex::next(const Element* from, bool reverse) const
+    {
+        const auto count = std::uint32_t(_order.size());
+        if (count == 0)
+            return nullptr;
+
+        const auto node = _find(from);
+        if (node == _none)
+            return _at(reverse ? count - 1 : 0);
+
+        const auto& data = _nodes[node];
+        if (reverse)
+            return _at((data.first + count - 1) % count);
+        return _at((data.first + data.focusable) % count);
+    }
+    std::shared_ptr<Element> FocusIndex::next_major(const Element* from, bool reverse) const
+    {
+        const auto count = std::uint32_t(_order.size());
+        if (count == 0)
+            return nullptr;
+
+        const auto node = _find(from);
+        if (node == _none)
+            return _at(reverse ? count - 1 : 0);
+
+        const auto& data = _nodes[node];
+        const auto parent = data.parent;
+        auto pos =
+            reverse ? (data.first + count - 1) % count : (data.first + data.focusable) % count;
+        // Neighbouring runs have different parents, the first and the last one might not
+        for (std::size_t i = 0; i < 3; i++)
+        {
+            if (_nodes[_order[pos]].parent != parent)
+                return _at(pos);
+            pos = reverse ? (_run_begin[pos] + count - 1) % count : _run_end[pos] % count;
+        }
+
+        // Everything shares the parent
+        if (data.focusable)
+            return data.ref.lock();
+        return next(from, reverse);
+    }
+
+    bool FocusIndex::empty() const
+    {
+        return _order.empty();
+    }
+    std::size_t FocusIndex::size() const
+    {
+        return _order.size();
+    }
+} // namespace d2
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <core/tree/d2_tree_element_frwd.hpp>
+
+namespace d2
+{
+    // Keyboard navigation order of the displayed elements that provide input (tree pre-order)
+    // Mirrors the tree and follows the FocusDirty/FocusChildDirty marks left by structural and
+    // layout writes, so only the written paths are revisited
+    // The flat order is rebuilt from the mirror only when membership or order changed
+    class FocusIndex
+    {
+    private:
+        using id = std::uint32_t;
+
+        static constexpr id _none = ~id(0);
+
+        struct Node
+        {
+            std::weak_ptr<Element> ref{};
+            // Lookup key, the element might be gone already when the node is dropped
+            const Element* key{nullptr};
+            id parent{_none};
+            std::uint32_t generation{0};
+            bool focusable{false};
+            // Number of focusable elements before this one in the order
+            std::uint32_t first{0};
+            std::vector<id> children{};
+        };
+
+        std::weak_ptr<Element> _root{};
+        id _root_id{_none};
+        std::uint32_t _generation{0};
+        bool _order_dirty{false};
+
+        std::vector<Node> _nodes{};
+        std::vector<id> _free{};
+        absl::flat_hash_map<const Element*, id> _lookup{};
+
+        std::vector<id> _order{};
+        // Bounds of the run of entries sharing the parent (groups for major navigation)
+        std::vector<std::uint32_t> _run_begin{};
+        std::vector<std::uint32_t> _run_end{};
+
+        id _make(std::shared_ptr<Element> ptr, id parent);
+        // Removes the node (and its subtree) from the parent
+        void _remove(id node);
+        void _drop(id node);
+
+        void _sync(id node, const std::shared_ptr<Element>& elem, bool rebuild);
+        void _rebuild_order();
+
+        id _find(const Element* elem) const;
+        std::shared_ptr<Element> _at(std::uint32_t pos) const;
+    public:
+        FocusIndex() = default;
+        FocusIndex(const FocusIndex&) = delete;
+        FocusIndex(FocusIndex&&) = default;
+
+        // Applies the pending changes of the tree, rebuilds it if the root changed
+        void update(std::shared_ptr<ParentElement> root);
+        void clear();
+
+        // Element following (or preceding) the one passed (which does not have to provide input)
+        // Wraps around, nullptr starts from the beginning (or the end)
+        std::shared_ptr<Element> next(const Element* from, bool reverse = false) const;
+        // Same as next but skips the elements sharing the parent with the one passed
+        std::shared_ptr<Element> next_major(const Element* from, bool reverse = false) const;
+
+        bool empty() const;
+        std::size_t size() const;
+
+        FocusIndex& operator=(const FocusIndex&) = delete;
+        FocusIndex& operator=(FocusIndex&&) = default;
+    };
+} // namespace d2
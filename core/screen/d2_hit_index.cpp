@@ -0,0 +1,271 @@
+#include "core/screen/d2_hit_index.hpp"
+
+#include <algorithm>
+#include <core/tree/d2_tree_parent.hpp>
+
+namespace d2
+{
+    bool HitIndex::Rect::empty() const
+    {
+        return x0 >= x1 || y0 >= y1;
+    }
+    bool HitIndex::Rect::contains(Position pos) const
+    {
+        return pos.x >= x0 && pos.y >= y0 && pos.x < x1 && pos.y < y1;
+    }
+    HitIndex::Rect HitIndex::Rect::intersect(const Rect& other) const
+    {
+        return {
+            .x0 = std::max(x0, other.x0),
+            .y0 = std::max(y0, other.y0),
+            .x1 = std::min(x1, other.x1),
+            .y1 = std::min(y1, other.y1),
+        };
+    }
+
+    HitIndex::id HitIndex::_make(std::shared_ptr<Element> ptr, id parent)
+    {
+        id result;
+        if (!_free.empty())
+        {
+            result = _free.back();
+            _free.pop_back();
+        }
+        else
+        {
+            result = id(_nodes.size());
+            _nodes.emplace_back();
+        }
+
+        auto& node = _nodes[result];
+        node.ref = ptr;
+        node.key = ptr.get();
+        node.parent = parent;
+        node.order = 0;
+        node.generation = 0;
+        node.origin = {};
+        node.clip = {};
+        node.children.clear();
+
+        _lookup[ptr.get()] = result;
+        if (parent != _none)
+            _nodes[parent].children.push_back(result);
+        return result;
+    }
+    void HitIndex::_remove(id node)
+    {
+        if (const auto parent = _nodes[node].parent; parent != _none)
+        {
+            auto& children = _nodes[parent].children;
+            if (const auto f = std::find(children.begin(), children.end(), node);
+                f != children.end())
+            {
+                *f = children.back();
+                children.pop_back();
+            }
+        }
+        _drop(node);
+    }
+    void HitIndex::_drop(id node)
+    {
+        for (const auto child : _nodes[node].children)
+            _drop(child);
+
+        _remove_cells(node);
+        auto& data = _nodes[node];
+        if (const auto f = _lookup.find(data.key); f != _lookup.end() && f->second == node)
+            _lookup.erase(f);
+        data.ref.reset();
+        data.key = nullptr;
+        data.parent = _none;
+        data.children.clear();
+        _free.push_back(node);
+    }
+
+    void HitIndex::_insert_cells(id node)
+    {
+        const auto& clip = _nodes[node].clip;
+        if (clip.empty())
+            return;
+        for (auto y = clip.y0 / _cell_height; y <= (clip.y1 - 1) / _cell_height; y++)
+            for (auto x = clip.x0 / _cell_width; x <= (clip.x1 - 1) / _cell_width; x++)
+                _cells[y * _columns + x].push_back(node);
+    }
+    void HitIndex::_remove_cells(id node)
+    {
+        const auto& clip = _nodes[node].clip;
+        if (clip.empty())
+            return;
+        for (auto y = clip.y0 / _cell_height; y <= (clip.y1 - 1) / _cell_height; y++)
+        {
+            for (auto x = clip.x0 / _cell_width; x <= (clip.x1 - 1) / _cell_width; x++)
+            {
+                auto& cell = _cells[y * _columns + x];
+                if (const auto f = std::find(cell.begin(), cell.end(), node); f != cell.end())
+                {
+                    *f = cell.back();
+                    cell.pop_back();
+                }
+            }
+        }
+    }
+    bool HitIndex::_place(id node, const Element& elem)
+    {
+        const auto [x, y] = elem.position();
+        const auto [width, height] = elem.box();
+        const auto& parent = _nodes[_nodes[node].parent];
+        const auto origin = parent.origin + Position{x, y};
+        const auto clip = parent.clip.intersect(
+            {.x0 = origin.x, .y0 = origin.y, .x1 = origin.x + width, .y1 = origin.y + height}
+        );
+
+        auto& data = _nodes[node];
+        if (data.origin == origin && data.clip == clip)
+            return false;
+
+        _remove_cells(node);
+        data.origin = origin;
+        data.clip = clip;
+        _insert_cells(node);
+        return true;
+    }
+    void HitIndex::_sync(id node, const std::shared_ptr<Element>& elem, bool moved)
+    {
+        const auto dirty = moved || elem->getistate(Element::IndexDirty);
+        if (!dirty && !elem->getistate(Element::IndexChildDirty))
+            return;
+        internal::ElementView::from(elem).signal_update(
+            Element::IndexDirty | Element::IndexChildDirty
+        );
+
+        const auto parent = std::dynamic_pointer_cast<ParentElement>(elem);
+        if (parent == nullptr)
+            return;
+
+        const auto generation = ++_generation;
+        std::uint32_t order = 0;
+        parent->foreach_internal(
+            [&](Element::ptr child) -> bool
+            {
+                if (!child->getstate(Element::State::Display))
+                    return true;
+
+                id cid = _none;
+                bool changed = true;
+                // Pointers of destroyed elements can be reused, and elements can be moved
+                if (const auto f = _lookup.find(child.get()); f != _lookup.end())
+                {
+                    if (_nodes[f->second].parent == node && _nodes[f->second].ref.lock() == child)
+                    {
+                        cid = f->second;
+                        changed = dirty && _place(cid, *child);
+                    }
+                    else
+                        _remove(f->second);
+                }
+                if (cid == _none)
+                {
+                    cid = _make(child, node);
+                    _place(cid, *child);
+                }
+
+                _nodes[cid].order = order++;
+                _nodes[cid].generation = generation;
+                _sync(cid, child, changed);
+                return true;
+            }
+        );
+
+        // Removed or hidden since
+        const auto children = _nodes[node].children;
+        for (const auto child : children)
+            if (_nodes[child].generation != generation)
+                _remove(child);
+    }
+
+    std::shared_ptr<Element>
+    HitIndex::_resolve(id parent, const std::vector<id>& candidates) const
+    {
+        std::shared_ptr<Element> target = nullptr;
+        for (const auto it : candidates)
+        {
+            if (_nodes[it].parent != parent)
+                continue;
+
+            const auto elem = _nodes[it].ref.lock();
+            if (elem == nullptr || !elem->getstate(Element::State::Display))
+                continue;
+            if (target == nullptr || elem->getzindex() > target->getzindex())
+            {
+                target = elem;
+                if (auto res = _resolve(it, candidates);
+                    res != nullptr && res->getzindex() > ParentElement::underlap)
+                    target = std::move(res);
+            }
+        }
+        return target;
+    }
+
+    void HitIndex::update(std::shared_ptr<ParentElement> root)
+    {
+        if (root == nullptr)
+        {
+            clear();
+            return;
+        }
+
+        const auto [width, height] = root->box();
+        if (_root.lock() != root || width != _width || height != _height)
+        {
+            clear();
+            _root = root;
+            _width = width;
+            _height = height;
+            _columns = std::max(1, (width + _cell_width - 1) / _cell_width);
+            _rows = std::max(1, (height + _cell_height - 1) / _cell_height);
+            _cells.resize(std::size_t(_columns) * _rows);
+            _root_id = _make(root, _none);
+            _nodes[_root_id].clip = {.x0 = 0, .y0 = 0, .x1 = width, .y1 = height};
+            _sync(_root_id, root, true);
+        }
+        else
+            _sync(_root_id, root, false);
+    }
+    void HitIndex::clear()
+    {
+        _root.reset();
+        _root_id = _none;
+        _width = 0;
+        _height = 0;
+        _columns = 0;
+        _rows = 0;
+        _nodes.clear();
+        _free.clear();
+        _lookup.clear();
+        _cells.clear();
+    }
+
+    std::optional<std::shared_ptr<Element>> HitIndex::query(Position pos) const
+    {
+        if (_root_id == _none || _root.expired() || pos.x < 0 || pos.y < 0 || pos.x >= _width ||
+            pos.y >= _height)
+            return std::nullopt;
+
+        std::vector<id> candidates;
+        for (const auto it : _cells[(pos.y / _cell_height) * _columns + pos.x / _cell_width])
+            if (_nodes[it].clip.contains(pos))
+                candidates.push_back(it);
+        // A candidate's ancestors are candidates as well (the clip is nested), so the walk
+        // sees exactly the elements the tree walk would descend into, in the same order
+        std::sort(
+            candidates.begin(),
+            candidates.end(),
+            [&](id a, id b) { return _nodes[a].order < _nodes[b].order; }
+        );
+        return _resolve(_root_id, candidates);
+    }
+    std::size_t HitIndex::size() const
+    {
+        return _lookup.size();
+    }
+} // namespace d2
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <core/tree/d2_tree_element_frwd.hpp>
+#include <core/types/d2_vtypes.hpp>
+
+namespace d2
+{
+    // Screen space index of the displayed elements used to resolve what is under the cursor
+    // Elements are bucketed into a uniform grid by their box clipped to the ancestors
+    // Updates follow the IndexDirty/IndexChildDirty marks left by layout writes, so only the
+    // written paths (and the subtrees which moved because of them) are revisited
+    class HitIndex
+    {
+    private:
+        using id = std::uint32_t;
+
+        static constexpr id _none = ~id(0);
+        static constexpr int _cell_width = 8;
+        static constexpr int _cell_height = 4;
+
+        struct Rect
+        {
+            int x0{0};
+            int y0{0};
+            int x1{0};
+            int y1{0};
+
+            bool empty() const;
+            bool contains(Position pos) const;
+            Rect intersect(const Rect& other) const;
+
+            bool operator==(const Rect&) const = default;
+        };
+        struct Node
+        {
+            std::weak_ptr<Element> ref{};
+            // Lookup key, the element might be gone already when the node is dropped
+            const Element* key{nullptr};
+            id parent{_none};
+            // Position within the parent's children
+            std::uint32_t order{0};
+            std::uint32_t generation{0};
+            Position origin{};
+            // Box in screen space clipped by the ancestors
+            Rect clip{};
+            std::vector<id> children{};
+        };
+
+        std::weak_ptr<Element> _root{};
+        id _root_id{_none};
+        int _width{0};
+        int _height{0};
+        int _columns{0};
+        int _rows{0};
+        std::uint32_t _generation{0};
+
+        std::vector<Node> _nodes{};
+        std::vector<id> _free{};
+        absl::flat_hash_map<const Element*, id> _lookup{};
+        std::vector<std::vector<id>> _cells{};
+
+        id _make(std::shared_ptr<Element> ptr, id parent);
+        // Removes the node (and its subtree) from the parent and the grid
+        void _remove(id node);
+        void _drop(id node);
+
+        void _insert_cells(id node);
+        void _remove_cells(id node);
+        // Recomputes the position and clip, returns true if either changed
+        bool _place(id node, const Element& elem);
+        void _sync(id node, const std::shared_ptr<Element>& elem, bool moved);
+
+        std::shared_ptr<Element> _resolve(id parent, const std::vector<id>& candidates) const;
+    public:
+        HitIndex() = default;
+        HitIndex(const HitIndex&) = delete;
+        HitIndex(HitIndex&&) = default;
+
+        // Applies the pending changes of the tree, rebuilds it if the root or its size changed
+        void update(std::shared_ptr<ParentElement> root);
+        void clear();
+
+        // Topmost element under the position (same rules as walking the tree)
+        // std::nullopt if the position lies outside of the indexed area
+        std::optional<std::shared_ptr<Element>> query(Position pos) const;
+        std::size_t size() const;
+
+        HitIndex& operator=(const HitIndex&) = delete;
+        HitIndex& operator=(HitIndex&&) = default;
+    };
+} // namespace d2
@@ -1,7 +1,9 @@
 #include "core/screen/d2_screen.hpp"
 
 #include <absl/strings/internal/str_format/extension.h>
+#include <algorithm>
 #include <chrono>
+#include <exception>
 #include <filesystem>
 
 namespace d2::sys
@@ -63,213 +65,42 @@ namespace d2::sys
     }
     SystemScreen::Status SystemScreen::_unload_impl()
     {
+        for (decltype(auto) it : _trees)
+            _finish_prepare(*it.second);
         _sig.disconnect();
+        _hit_index.clear();
+        _focus_index.clear();
         return Status::Ok;
     }
 
-    void SystemScreen::_keynav_cycle_up(eptr ptr)
-    {
-        const auto cparent = ptr->parent();
-        const auto parent = cparent->parent();
-
-        if (parent == nullptr)
-        {
-            _ts.keynav_iterator = root().asp()->begin();
-        }
-        else
-        {
-            _ts.keynav_iterator = parent->traverse().asp()->begin();
-            while (_ts.keynav_iterator->traverse() != cparent)
-                _ts.keynav_iterator.increment();
-
-            if (_ts.keynav_iterator.is_end())
-            {
-                _keynav_cycle_up(cparent);
-            }
-            else
-            {
-                _ts.keynav_iterator.increment();
-            }
-            if (_ts.keynav_iterator.is_end())
-            {
-                _keynav_cycle_up(cparent);
-            }
-        }
-    }
-    void SystemScreen::_keynav_cycle()
-    {
-        if (_ts.keynav_iterator == nullptr)
-        {
-            _ts.keynav_iterator = root().asp()->begin();
-            if (_ts.keynav_iterator->provides_input())
-                return;
-        }
-
-        do
-        {
-            if (_ts.keynav_iterator->traverse().is_type<ParentElement>() &&
-                !_ts.keynav_iterator->traverse().asp()->empty())
-            {
-                _ts.keynav_iterator = _ts.keynav_iterator->traverse().asp()->begin();
-            }
-            else
-            {
-                eptr ptr = _ts.keynav_iterator->traverse();
-                _ts.keynav_iterator.increment();
-                if (_ts.keynav_iterator.is_end())
-                {
-                    _keynav_cycle_up(ptr);
-                }
-            }
-        } while (!_ts.keynav_iterator->provides_input());
-    }
-    void SystemScreen::_keynav_cycle_up_reverse()
-    {
-        const auto cparent = _ts.keynav_iterator->parent();
-        const auto parent = cparent->parent();
-
-        if (parent == nullptr)
-        {
-            _ts.keynav_iterator = root().asp()->end();
-            _ts.keynav_iterator.decrement();
-        }
-        else
-        {
-            _ts.keynav_iterator = parent->traverse().asp()->begin();
-            while (_ts.keynav_iterator->traverse() != cparent)
-                _ts.keynav_iterator.increment();
-
-            if (_ts.keynav_iterator.is_begin())
-            {
-                _keynav_cycle_up_reverse();
-            }
-            else
-            {
-                _ts.keynav_iterator.decrement();
-            }
-        }
-    }
-    void SystemScreen::_keynav_cycle_reverse()
-    {
-        if (_ts.keynav_iterator == nullptr)
-        {
-            _ts.keynav_iterator = root().asp()->end();
-            _ts.keynav_iterator.decrement();
-            if (_ts.keynav_iterator->provides_input())
-                return;
-        }
-
-        do
-        {
-            if (_ts.keynav_iterator->traverse().is_type<ParentElement>() &&
-                !_ts.keynav_iterator->traverse().asp()->empty())
-            {
-                _ts.keynav_iterator = _ts.keynav_iterator->traverse().asp()->end();
-                _ts.keynav_iterator.decrement();
-            }
-            else
-            {
-                if (_ts.keynav_iterator.is_begin())
-                {
-                    _keynav_cycle_up_reverse();
-                }
-                else
-                {
-                    _ts.keynav_iterator.decrement();
-                }
-            }
-        } while (!_ts.keynav_iterator->provides_input());
-    }
-
-    void SystemScreen::_keynav_cycle_macro()
-    {
-        if (_ts.keynav_iterator == nullptr)
-        {
-            _ts.keynav_iterator = root().asp()->begin();
-            if (_ts.keynav_iterator->provides_input())
-                return;
-        }
-
-        const auto parent = _ts.keynav_iterator->parent();
-        const auto start = _ts.keynav_iterator->traverse();
-        do
-        {
-            _keynav_cycle();
-            if (_ts.keynav_iterator->traverse() == start)
-                break;
-        } while (_ts.keynav_iterator->parent() == parent);
-    }
-    void SystemScreen::_keynav_cycle_macro_reverse()
-    {
-        if (_ts.keynav_iterator == nullptr)
-        {
-            _ts.keynav_iterator = root().asp()->end();
-            _ts.keynav_iterator.decrement();
-            if (_ts.keynav_iterator->provides_input())
-                return;
-        }
-
-        const auto parent = _ts.keynav_iterator->parent();
-        const auto start = _ts.keynav_iterator->traverse();
-        do
-        {
-            _keynav_cycle_reverse();
-            if (_ts.keynav_iterator->traverse() == start)
-                break;
-        } while (_ts.keynav_iterator->parent() == parent);
-    }
-
-    bool SystemScreen::_keynav_has_input() const
+    bool SystemScreen::_keynav_prepare()
     {
         if (_ts.current == nullptr || root() == nullptr)
             return false;
 
-        bool found = false;
-        _apply_impl(
-            [&](eptr it)
-            {
-                if (it->provides_input())
-                    found = true;
-                return true;
-            },
-            root()
-        );
-        return found;
-    }
-
-    bool SystemScreen::_keynav_prepare()
-    {
-        if (!_keynav_has_input())
+        _focus_index.update(root().shared());
+        if (_focus_index.empty())
             return false;
 
-        if (_ts.keynav_iterator != nullptr)
-        {
-            _ts.keynav_iterator->setstate(Element::State::Keynavi, false);
-            return true;
-        }
-
-        if (focused() != nullptr && focused()->parent() != nullptr)
-        {
-            _ts.keynav_iterator = focused()->parent()->traverse().asp()->begin();
-            while (!_ts.keynav_iterator.is_end() && _ts.keynav_iterator->traverse() != focused())
-                _ts.keynav_iterator.increment();
-
-            if (!_ts.keynav_iterator.is_end())
-                return true;
-
-            _ts.keynav_iterator = nullptr;
-        }
-
+        if (_ts.keynav != nullptr)
+            _ts.keynav->setstate(Element::State::Keynavi, false);
         return true;
     }
-
+    SystemScreen::eptr SystemScreen::_keynav_origin() const
+    {
+        if (_ts.keynav != nullptr)
+            return _ts.keynav;
+        if (focused() != nullptr && focused()->parent() != nullptr)
+            return focused();
+        return nullptr;
+    }
     void SystemScreen::_keynav_apply()
     {
-        if (_ts.keynav_iterator == nullptr)
+        if (_ts.keynav == nullptr)
             return;
 
-        _ts.keynav_iterator->setstate(Element::State::Keynavi, true);
-        focus(_ts.keynav_iterator->traverse());
+        _ts.keynav->setstate(Element::State::Keynavi, true);
+        focus(_ts.keynav);
     }
 
     void SystemScreen::focus_next_minor(bool reverse)
@@ -277,10 +108,7 @@ namespace d2::sys
         if (!_keynav_prepare())
             return;
 
-        if (reverse)
-            _keynav_cycle_reverse();
-        else
-            _keynav_cycle();
+        _ts.keynav = _focus_index.next(_keynav_origin().shared().get(), reverse);
 
         _keynav_apply();
     }
@@ -290,23 +118,62 @@ namespace d2::sys
         if (!_keynav_prepare())
             return;
 
-        if (reverse)
-            _keynav_cycle_macro_reverse();
-        else
-            _keynav_cycle_macro();
+        _ts.keynav = _focus_index.next_major(_keynav_origin().shared().get(), reverse);
 
         _keynav_apply();
     }
 
     void SystemScreen::clear_keynav()
     {
-        if (_ts.keynav_iterator != nullptr)
-            _ts.keynav_iterator->setstate(Element::State::Keynavi, false);
+        if (_ts.keynav != nullptr)
+            _ts.keynav->setstate(Element::State::Keynavi, false);
 
-        _ts.keynav_iterator = nullptr;
+        _ts.keynav = nullptr;
         focus(nullptr);
     }
 
+    SystemScreen::TreeData* SystemScreen::_tree() const
+    {
+        if (auto* data = _preparing_tree(); data != nullptr)
+            return data;
+        return _ts.current.get();
+    }
+    SystemScreen::TreeData* SystemScreen::_preparing_tree() const
+    {
+        if (_preparing_count.load(std::memory_order::acquire) == 0)
+            return nullptr;
+        std::shared_lock lock(_preparing_mtx);
+        const auto f = _preparing.find(std::this_thread::get_id());
+        return f == _preparing.end() ? nullptr : f->second;
+    }
+    bool SystemScreen::_finish_prepare(TreeData& data)
+    {
+        if (data.preparing == nullptr)
+            return false;
+        const auto task = std::exchange(data.preparing, nullptr);
+        // The construction might be waiting on the main thread (dependencies, themes)
+        // A task the pool dropped (while stopping) never finishes, it is treated as failed
+        context()->wait_until(
+            [&]() { return task.has_value() || task.has_exception() || task.is_discarded(); }
+        );
+#       if D2_LOCALE_MODE == UNICODE
+            global_extended_code_page.unshare();
+#       endif
+        if (task.has_value())
+            return true;
+
+        if (!task.is_discarded())
+        {
+            D2_SAFE_BLOCK_BEGIN
+            task.value();
+            D2_SAFE_BLOCK_END
+        }
+        D2_TLOG(Warning, "Failed to prepare tree, it will be built on the main thread")
+        data.state->root()->clear();
+        data.unbuilt = true;
+        return false;
+    }
+
     SystemScreen::eptr SystemScreen::_lca(eptr a, eptr b)
     {
         if (a == nullptr || b == nullptr)
@@ -354,6 +221,22 @@ namespace d2::sys
                 }
             }
         }
+
+        auto& batch = _ts.current->batch;
+        if (!batch.empty())
+        {
+            for (decltype(auto) it : batch.update())
+            {
+                if (it.finish == nullptr)
+                    continue;
+                auto target = d2::TreeIter{it.target.lock()};
+                D2_SAFE_BLOCK_BEGIN
+                it.finish(target);
+                D2_SAFE_BLOCK_END
+            }
+            if (!batch.empty())
+                deadline = std::min(deadline, Animation::Wake::refresh);
+        }
         return deadline;
     }
     void SystemScreen::_trigger_events()
@@ -403,8 +286,9 @@ namespace d2::sys
     }
     void SystemScreen::_trigger_focused_events(in::InputFrame& frame)
     {
-        const auto is_keyboard_input =
-            frame.had_event(in::Event::KeyInput) || frame.had_event(in::Event::KeySequenceInput);
+        const auto is_keyboard_input = frame.had_event(in::Event::KeyInput) ||
+                                       frame.had_event(in::Event::KeySequenceInput) ||
+                                       frame.had_event(in::Event::Paste);
         if (is_keyboard_input)
         {
             static constexpr auto mouse_first = std::size_t(in::Mouse::Left);
@@ -518,6 +402,13 @@ namespace d2::sys
         );
         return mouse_target;
     }
+    SystemScreen::eptr SystemScreen::_hit_test(Position mouse)
+    {
+        _hit_index.update(root().shared());
+        if (const auto res = _hit_index.query(mouse); res.has_value())
+            return *res;
+        return _update_states(root(), mouse);
+    }
     SystemScreen::eptr SystemScreen::_update_states_reverse(eptr ptr)
     {
         if (ptr->provides_cursor_sink())
@@ -527,6 +418,141 @@ namespace d2::sys
         return nullptr;
     }
 
+    bool SystemScreen::_concurrent_subtree(const Element::ptr& ptr)
+    {
+        auto view = internal::ElementView::from(ptr);
+        // Everything that could write outside of the subtree happens here, on this thread
+        view.update_layout();
+        ptr->position();
+        ptr->box();
+        if (!view.concurrent_frame())
+            return false;
+
+        bool result = true;
+        if (const auto parent = std::dynamic_pointer_cast<ParentElement>(ptr); parent != nullptr)
+            parent->foreach_internal(
+                [&](Element::ptr child) -> bool
+                {
+                    if (child->getstate(Element::State::Display) && !_concurrent_subtree(child))
+                        result = false;
+                    return result;
+                }
+            );
+        return result;
+    }
+    void SystemScreen::_gather_concurrent(const Element::ptr& ptr, std::vector<Element::ptr>& out)
+    {
+        // Below this the threads would not have enough to do
+        static constexpr int min_area = 512;
+
+        auto view = internal::ElementView::from(ptr);
+        // Same order as frame(), the layout of the parent is updated before the children render
+        view.update_layout();
+        const auto parent = std::dynamic_pointer_cast<ParentElement>(ptr);
+        if (parent == nullptr || !view.concurrent_frame())
+            return;
+
+        std::vector<Element::ptr> dirty;
+        parent->foreach_internal(
+            [&](Element::ptr child) -> bool
+            {
+                if (child->getstate(Element::State::Display) && child->needs_update())
+                    dirty.push_back(std::move(child));
+                return true;
+            }
+        );
+        for (const auto& child : dirty)
+        {
+            const auto [width, height] = child->box();
+            if (width * height < min_area)
+                continue;
+            if (dirty.size() > 1 && internal::ElementView::from(child).owns_frame_buffer() &&
+                _concurrent_subtree(child))
+                out.push_back(child);
+            else
+                _gather_concurrent(child, out);
+        }
+    }
+    void SystemScreen::_frame_concurrent()
+    {
+        std::vector<Element::ptr> jobs;
+        _gather_concurrent(root().shared(), jobs);
+        if (jobs.size() < 2)
+            return;
+
+        std::sort(
+            jobs.begin(),
+            jobs.end(),
+            [](const auto& a, const auto& b)
+            {
+                const auto [aw, ah] = a->box();
+                const auto [bw, bh] = b->box();
+                return aw * ah > bw * bh;
+            }
+        );
+
+#       if D2_LOCALE_MODE == UNICODE
+            auto* page = &global_extended_code_page;
+            page->share();
+#       endif
+        const auto scheduler = context()->scheduler();
+        std::vector<mt::future<void>> tasks;
+        tasks.reserve(jobs.size() - 1);
+        for (std::size_t i = 1; i < jobs.size(); i++)
+            tasks.push_back(scheduler->launch(
+                [&, i]()
+                {
+#                   if D2_LOCALE_MODE == UNICODE
+                        ExtendedCodePage::bind_thread(page);
+#                   endif
+                    try
+                    {
+                        jobs[i]->frame();
+                    }
+                    catch (...)
+                    {
+#                       if D2_LOCALE_MODE == UNICODE
+                            ExtendedCodePage::bind_thread(nullptr);
+#                       endif
+                        throw;
+                    }
+#                   if D2_LOCALE_MODE == UNICODE
+                        ExtendedCodePage::bind_thread(nullptr);
+#                   endif
+                }
+            ));
+
+        std::exception_ptr error = nullptr;
+        try
+        {
+            jobs.front()->frame();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        // Every subtree has to finish before anything is rethrown, they all use the jobs
+        // Waited for through the context, a subtree might sync with the main thread
+        context()->wait_until(
+            [&]()
+            {
+                return std::all_of(
+                    tasks.begin(),
+                    tasks.end(),
+                    [](const auto& task)
+                    { return task.has_value() || task.has_exception() || task.is_discarded(); }
+                );
+            }
+        );
+#       if D2_LOCALE_MODE == UNICODE
+            page->unshare();
+#       endif
+        if (error != nullptr)
+            std::rethrow_exception(error);
+        for (decltype(auto) it : tasks)
+            it.value();
+    }
+
     void SystemScreen::_apply_impl(const Element::foreach_callback& func, eptr container) const
     {
         container.foreach (
@@ -599,11 +625,17 @@ namespace d2::sys
         _models.erase(name);
     }
 
+    bool SystemScreen::accessible() const
+    {
+        return _preparing_tree() != nullptr || SystemModule::accessible();
+    }
+
     TreeIter<ParentElement> SystemScreen::root() const
     {
-        if (_ts.current == nullptr)
+        const auto* tree = _tree();
+        if (tree == nullptr)
             return nullptr;
-        return _ts.current->state->root();
+        return tree->state->root();
     }
 
     void SystemScreen::set(std::string_view name)
@@ -614,6 +646,7 @@ namespace d2::sys
 
         const auto prev = _ts.current_name;
         auto root = _trees[name];
+        const auto prepared = _finish_prepare(*root);
         if (_ts.current != nullptr)
         {
             if (_ts.current->tags.tag<bool>("SwapOut"))
@@ -668,19 +701,107 @@ namespace d2::sys
         context()->input().ptr()->endcycle();
         _update_viewport();
 
-        D2_TLOG(Verbose, "Initializing tree")
-        root->state->root()->initialize(true);
+        if (prepared)
+        {
+            // Initialized while preparing, doing it again would invalidate the cached frame
+            D2_TLOG(Verbose, "Presenting prepared tree")
+            _present = true;
+            context()->deadline(std::chrono::milliseconds(0));
+        }
+        else
+        {
+            D2_TLOG(Verbose, "Initializing tree")
+            root->state->root()->initialize(true);
+        }
 
         _signal<Event::TreeSwap>(std::string(prev), std::string(name));
     }
+    void SystemScreen::prepare(std::string_view name, bool render)
+    {
+        auto f = _trees.find(name);
+        if (f == _trees.end())
+            D2_THRW("Invalid tree name");
+        const auto data = f->second;
+        // Already built (or being built)
+        if (data == _ts.current || !data->unbuilt || data->preparing != nullptr)
+            return;
+
+        D2_TLOG(Verbose, "Preparing tree: '", name, "'")
+        const auto ctx = context();
+        const auto [width, height] = ctx->input().ptr()->screen_size();
+        ExtendedCodePage* page = nullptr;
+#       if D2_LOCALE_MODE == UNICODE
+            page = &global_extended_code_page;
+            page->share();
+#       endif
+        data->unbuilt = false;
+        data->preparing = ctx->scheduler()->launch(
+            [this, data, page, width, height, render]()
+            {
+                // Nothing else can reach the tree until set() waits for this task
+                IOContext::DetachedScope scope(data->state.get());
+                // The thread might already be preparing another tree (a task run while waiting)
+                TreeData* outer = nullptr;
+                {
+                    std::unique_lock lock(_preparing_mtx);
+                    outer = std::exchange(_preparing[std::this_thread::get_id()], data.get());
+                    _preparing_count.fetch_add(1, std::memory_order::release);
+                }
+                ExtendedCodePage::bind_thread(page);
+                const auto reset = [&]()
+                {
+                    {
+                        std::unique_lock lock(_preparing_mtx);
+                        if (outer != nullptr)
+                            _preparing[std::this_thread::get_id()] = outer;
+                        else
+                            _preparing.erase(std::this_thread::get_id());
+                        _preparing_count.fetch_sub(1, std::memory_order::release);
+                    }
+                    ExtendedCodePage::bind_thread(outer != nullptr ? page : nullptr);
+                };
+                try
+                {
+                    const auto root = data->state->root();
+                    data->rebuild(root, data->state);
+                    root->initialize(true);
+
+                    root->accept_layout();
+                    root->override_dimensions(width, height);
+                    auto view = internal::ElementView::from(root);
+                    view.signal_write(Element::WriteType::Style);
+                    view.signal_context_change(
+                        Element::WriteType::LayoutWidth | Element::WriteType::LayoutHeight
+                    );
+                    // Otherwise only the layout is resolved ahead
+                    if (_concurrent_subtree(root) && render)
+                    {
+                        root->setcache(Element::CachePolicy::Static);
+                        root->frame();
+                    }
+                }
+                catch (...)
+                {
+                    reset();
+                    throw;
+                }
+                reset();
+            }
+        );
+    }
+    bool SystemScreen::is_prepared(std::string_view name) const
+    {
+        const auto f = _trees.find(name);
+        return f != _trees.end() && f->second->preparing.has_value();
+    }
 
     TreeTags& SystemScreen::tags()
     {
-        return _ts.current->tags;
+        return _tree()->tags;
     }
     DynamicDependencyManager& SystemScreen::deps()
     {
-        return _ts.current->deps;
+        return _tree()->deps;
     }
     DynamicDependencyManager& SystemScreen::deps(std::string_view name)
     {
@@ -731,16 +852,32 @@ namespace d2::sys
     {
         if (_ts.current == nullptr)
             return 0;
-        return _ts.current->animations.size();
+        return _ts.current->animations.size() + _ts.current->batch.size();
     }
     std::chrono::microseconds SystemScreen::delta() const
     {
         return _prev_delta;
     }
+    std::chrono::microseconds SystemScreen::budget() const
+    {
+        return _budget;
+    }
+    TickProfile& SystemScreen::profile()
+    {
+        return _profile;
+    }
+    void SystemScreen::set_concurrent_frames(bool value)
+    {
+        _concurrent_frames = value;
+    }
+    bool SystemScreen::concurrent_frames() const
+    {
+        return _concurrent_frames;
+    }
 
     bool SystemScreen::is_keynav() const
     {
-        return _ts.keynav_iterator != nullptr && _ts.focused == _ts.keynav_iterator.value();
+        return _ts.keynav != nullptr && _ts.focused == _ts.keynav;
     }
 
     void SystemScreen::apply(const Element::foreach_callback& func) const
@@ -755,7 +892,7 @@ namespace d2::sys
 
     void SystemScreen::clear_animations(TreeIter<> ptr)
     {
-        auto& interps = _ts.current->animations;
+        auto& interps = _tree()->animations;
         for (auto it = interps.begin(); it != interps.end();)
         {
             auto& [anim, callback] = it->second;
@@ -772,10 +909,18 @@ namespace d2::sys
             else
                 ++it;
         }
+        for (decltype(auto) it : _tree()->batch.remove(ptr.shared().get()))
+        {
+            if (it.finish == nullptr)
+                continue;
+            D2_SAFE_BLOCK_BEGIN
+            it.finish(ptr);
+            D2_SAFE_BLOCK_END
+        }
     }
     void SystemScreen::clear_animations(TreeIter<> ptr, style::uai_property prop)
     {
-        auto& interps = _ts.current->animations;
+        auto& interps = _tree()->animations;
         auto f = interps.find(std::make_pair(ptr.shared().get(), prop));
         if (f != interps.end())
         {
@@ -785,6 +930,13 @@ namespace d2::sys
             cb(ptr);
             D2_SAFE_BLOCK_END
         }
+        if (auto res = _tree()->batch.remove(ptr.shared().get(), prop);
+            res.finish != nullptr)
+        {
+            D2_SAFE_BLOCK_BEGIN
+            res.finish(ptr);
+            D2_SAFE_BLOCK_END
+        }
     }
 
     std::string SystemScreen::name()
@@ -795,6 +947,8 @@ namespace d2::sys
     void SystemScreen::erase_tree(std::string_view name)
     {
         auto root = _trees[name];
+        if (root != nullptr)
+            _finish_prepare(*root);
         if (root == _ts.current)
         {
             _ts.focused = nullptr;
@@ -809,6 +963,8 @@ namespace d2::sys
     }
     void SystemScreen::clear_tree()
     {
+        for (decltype(auto) it : _trees)
+            _finish_prepare(*it.second);
         _trees.clear();
         _ts.current = nullptr;
         _ts.focused = nullptr;
@@ -826,6 +982,17 @@ namespace d2::sys
     {
         _refresh_rate = refresh;
     }
+    void SystemScreen::set_render_mode(RenderMode mode)
+    {
+        _render_mode = mode;
+        _refresh_at = {};
+        // The periodic refresh might have to be armed again
+        context()->deadline(std::chrono::milliseconds(0));
+    }
+    SystemScreen::RenderMode SystemScreen::render_mode() const
+    {
+        return _render_mode;
+    }
     void SystemScreen::tick()
     {
         const auto beg = std::chrono::steady_clock::now();
@@ -834,6 +1001,21 @@ namespace d2::sys
         std::chrono::steady_clock::time_point interp_deadline{
             std::chrono::steady_clock::time_point::max()
         };
+        _profile.begin(beg);
+        {
+            if (input->input_time() != std::chrono::steady_clock::time_point{} ||
+                input->had_event(in::Event::ScreenResize))
+                _profile.wake(TickProfile::Wakeup::Input);
+            if (root()->needs_update() || _present)
+                _profile.wake(TickProfile::Wakeup::Write);
+            if (animations() != 0)
+                _profile.wake(TickProfile::Wakeup::Animation);
+            if (_refresh_at != std::chrono::steady_clock::time_point{} && beg >= _refresh_at)
+            {
+                _profile.wake(TickProfile::Wakeup::Refresh);
+                _refresh_at = {};
+            }
+        }
         // Update
         {
             root()->setcache(d2::Element::CachePolicy::Static);
@@ -844,7 +1026,7 @@ namespace d2::sys
             if (input->had_event(in::Event::MouseMovement) ||
                 input->had_event(in::Event::KeyMouseInput))
             {
-                const auto target = _update_states(root(), ctx->input().ptr()->mouse_position());
+                const auto target = _hit_test(ctx->input().ptr()->mouse_position());
                 const auto is_released = input->active(in::mouse::Left, in::mode::Release);
                 const auto is_pressed = input->active(in::mouse::Left, in::mode::Press);
                 const auto cpy_targetted = _ts.targetted;
@@ -898,35 +1080,70 @@ namespace d2::sys
                 }
                 if (_ts.focused != uptarget && is_pressed)
                 {
-                    if (_ts.keynav_iterator != nullptr)
-                        _ts.keynav_iterator->setstate(Element::State::Keynavi, false);
+                    if (_ts.keynav != nullptr)
+                        _ts.keynav->setstate(Element::State::Keynavi, false);
                     focus(uptarget);
                 }
             }
+            _profile.mark(TickProfile::Phase::Input);
 
             _ts.current->state->update();
+            _profile.mark(TickProfile::Phase::State);
 
             _trigger_events();
+            _profile.mark(TickProfile::Phase::Events);
 
             const auto interp_ms = _run_animations();
+            _profile.mark(TickProfile::Phase::Animations);
             ctx->deadline(interp_ms == Animation::Wake::refresh ? _refresh_rate : interp_ms);
 
             if (input->had_pulse())
                 ctx->deadline(std::chrono::milliseconds{0});
+
+            const auto input_time = input->input_time();
+            if (input_time != std::chrono::steady_clock::time_point{} &&
+                (_input_pending == std::chrono::steady_clock::time_point{} ||
+                 input_time < _input_pending))
+                _input_pending = input_time;
         }
         // Render
-        if (!ctx->is_suspended() && root()->needs_update())
+        if (!ctx->is_suspended() && (root()->needs_update() || _present))
         {
-            _signal<Event::PreRedraw>();
-
-            auto& root = *this->root().as();
-            auto frame = root.frame();
-
-            const auto [bwidth, bheight] = root.box();
-            auto output = ctx->output().ptr();
-            output->write(frame.data(), bwidth, bheight);
-
-            _signal<Event::PostRedraw>();
+            // The terminal is behind, changes until the budget elapses go out as a single frame
+            if (beg < _next_frame)
+            {
+                ctx->deadline(_next_frame);
+            }
+            else
+            {
+                _signal<Event::PreRedraw>();
+                _profile.skip();
+
+                // Large independent subtrees are rasterized on the pool first, the frame below
+                // only composites their buffers (in z-order)
+                if (_concurrent_frames)
+                    _frame_concurrent();
+                auto& root = *this->root().as();
+                auto frame = root.frame();
+                _profile.mark(TickProfile::Phase::Compose);
+
+                const auto [bwidth, bheight] = root.box();
+                auto output = ctx->output().ptr();
+                output->mark_input(std::exchange(_input_pending, {}));
+                output->write(frame.data(), bwidth, bheight);
+                _profile.mark(TickProfile::Phase::Output);
+
+                _present = false;
+                _budget = output->frame_budget();
+                _next_frame = std::chrono::steady_clock::now() + _budget;
+
+                _signal<Event::PostRedraw>();
+            }
+        }
+        else
+        {
+            // Nothing changed on screen so there is nothing to measure
+            _input_pending = {};
         }
         {
             _fps_ctr++;
@@ -940,11 +1157,19 @@ namespace d2::sys
             const auto end = std::chrono::steady_clock::now();
             const auto delta = end - beg;
             _prev_delta = std::chrono::duration_cast<std::chrono::microseconds>(delta);
+            _profile.end(end);
 
-            if (_refresh_rate != std::chrono::milliseconds::max())
-                ctx->deadline(
-                    _refresh_rate - std::chrono::duration_cast<std::chrono::milliseconds>(delta)
-                );
+            if (_render_mode == RenderMode::Periodic &&
+                _refresh_rate != std::chrono::milliseconds::max())
+            {
+                const auto wait =
+                    _refresh_rate - std::chrono::duration_cast<std::chrono::milliseconds>(delta);
+                _refresh_at = end + wait;
+                ctx->deadline(wait);
+            }
+            // Written after the frame went out (or by the signals around it)
+            else if (!ctx->is_suspended() && root()->needs_update())
+                ctx->deadline(_next_frame);
         }
     }
 
@@ -2,7 +2,10 @@
 
 #include <absl/container/flat_hash_map.h>
 #include <absl/container/node_hash_map.h>
+#include <atomic>
 #include <chrono>
+#include <shared_mutex>
+#include <thread>
 #include <utility>
 
 #include <core/io/d2_context.hpp>
@@ -10,6 +13,9 @@
 #include <core/io/d2_module.hpp>
 #include <core/mods/d2_core.hpp>
 #include <core/screen/d2_animate.hpp>
+#include <core/screen/d2_animate_batch.hpp>
+#include <core/screen/d2_focus_index.hpp>
+#include <core/screen/d2_hit_index.hpp>
 #include <core/screen/d2_screen_comps.hpp>
 #include <core/tree/d2_styles_base.hpp>
 #include <core/tree/d2_theme.hpp>
@@ -17,6 +23,7 @@
 #include <core/tree/d2_tree_state.hpp>
 #include <core/utils/d2_exceptions.hpp>
 #include <core/utils/d2_model.hpp>
+#include <core/utils/d2_tick_profile.hpp>
 
 namespace d2::sys
 {
@@ -57,6 +64,14 @@ namespace d2::sys
             EvCase<Event::TreeSwap, std::string, std::string>
         >;
         using ModelType = MatrixModel::ModelType;
+        enum class RenderMode
+        {
+            // Ticks every refresh period (see set_refresh_rate)
+            Periodic,
+            // Sleeps until something marks work (input, tasks posted to the main thread,
+            // element writes or animations), the refresh rate only paces animations
+            Demand,
+        };
     private:
         struct AnimationState
         {
@@ -68,9 +83,12 @@ namespace d2::sys
             std::function<void(TreeIter<ParentElement>, TreeState::ptr)> rebuild{nullptr};
             absl::node_hash_map<std::pair<Element*, style::uai_property>, AnimationState>
                 animations{};
+            AnimationBatch batch{};
             TreeState::ptr state{nullptr};
             TreeTags tags{};
             DynamicDependencyManager deps{};
+            // Construction running on the pool (see prepare), owned by it until finished
+            mt::future<void> preparing{nullptr};
             bool unbuilt{true};
             bool swapped_out{true};
         };
@@ -78,7 +96,8 @@ namespace d2::sys
         using eptr = TreeIter<>;
         struct TempTreeState
         {
-            internal::DynamicIterator keynav_iterator{nullptr};
+            // Element reached through keyboard navigation
+            eptr keynav{nullptr};
             std::string current_name{""};
             eptr focused{nullptr};
             eptr targetted{nullptr};
@@ -87,6 +106,12 @@ namespace d2::sys
             bool recursive{false};
         };
     private:
+        // Trees being prepared and the threads preparing them, the tree relative accessors
+        // called from those threads resolve to the tree they prepare
+        mutable std::shared_mutex _preparing_mtx{};
+        absl::flat_hash_map<std::thread::id, TreeData*> _preparing{};
+        std::atomic<std::size_t> _preparing_count{0};
+
         Signals::Signal _sig{};
 
         absl::flat_hash_map<std::string, tree> _trees{};
@@ -95,30 +120,44 @@ namespace d2::sys
 
         in::InputFrame* _frame{nullptr};
         TempTreeState _ts{};
+        HitIndex _hit_index{};
+        FocusIndex _focus_index{};
 
         std::size_t _fps_ctr{0};
         std::size_t _fps_avg{0};
         std::chrono::steady_clock::time_point _last_mes{};
         std::chrono::microseconds _prev_delta{};
+        TickProfile _profile{};
+        std::chrono::microseconds _budget{};
+        std::chrono::steady_clock::time_point _next_frame{};
+        // Earliest input not reflected by a written frame yet
+        std::chrono::steady_clock::time_point _input_pending{};
         std::chrono::milliseconds _restore_refresh{};
         std::chrono::milliseconds _refresh_rate{std::chrono::milliseconds::max()};
+        // When the periodic refresh is due (to tell it apart from other wakeups)
+        std::chrono::steady_clock::time_point _refresh_at{};
+        RenderMode _render_mode{RenderMode::Periodic};
         bool _is_stop{false};
         bool _is_running{false};
+        bool _concurrent_frames{true};
+        // The tree was switched to a prepared one, its cached frame has to be written out
+        bool _present{false};
 
         virtual Status _load_impl() override;
         virtual Status _unload_impl() override;
 
         eptr _lca(eptr a, eptr b);
 
-        void _keynav_cycle_up(eptr ptr);
-        void _keynav_cycle();
-        void _keynav_cycle_up_reverse();
-        void _keynav_cycle_reverse();
-        void _keynav_cycle_macro();
-        void _keynav_cycle_macro_reverse();
+        TreeData* _tree() const;
+        // Tree the calling thread prepares, nullptr if it is not preparing one
+        TreeData* _preparing_tree() const;
+        // Waits for the preparation of the tree, false if there was none (or it failed)
+        bool _finish_prepare(TreeData& data);
 
-        bool _keynav_has_input() const;
+        // Brings the focus index up to date, false if nothing can be navigated to
         bool _keynav_prepare();
+        // Element the navigation continues from
+        eptr _keynav_origin() const;
         void _keynav_apply();
 
         void _trigger_events();
@@ -132,8 +171,16 @@ namespace d2::sys
 
         void _update_viewport();
         eptr _update_states(eptr container, Position mouse);
+        // Element under the cursor, resolved through the hit index
+        eptr _hit_test(Position mouse);
         eptr _update_states_reverse(eptr ptr);
 
+        // Resolves the layout of the subtree, false if it cannot be rendered on another thread
+        bool _concurrent_subtree(const Element::ptr& ptr);
+        void _gather_concurrent(const Element::ptr& ptr, std::vector<Element::ptr>& out);
+        // Renders independent dirty subtrees on the pool ahead of the frame
+        void _frame_concurrent();
+
         std::chrono::milliseconds _run_animations();
 
         void _apply_impl(const TreeIter<>::foreach_callback& func, eptr container) const;
@@ -149,6 +196,9 @@ namespace d2::sys
 
         using Module::Module;
 
+        // Also accessible from threads preparing a tree
+        virtual bool accessible() const override;
+
         TreeIter<ParentElement> root() const;
 
         // Model Management
@@ -177,6 +227,14 @@ namespace d2::sys
         std::size_t fps() const;
         std::size_t animations() const;
         std::chrono::microseconds delta() const;
+        // Minimum interval between redraws imposed by the output (0 if not throttled)
+        std::chrono::microseconds budget() const;
+        // Per phase timings of the last ticks
+        TickProfile& profile();
+        // Render large independent subtrees on the pool (enabled by default), only subtrees of
+        // elements that opt in (Element::_concurrent_frame_impl) are split off
+        void set_concurrent_frames(bool value);
+        bool concurrent_frames() const;
 
         bool is_keynav() const;
 
@@ -217,16 +275,24 @@ namespace d2::sys
             set(First::name);
         }
         void set(std::string_view name);
+        // Builds the tree on the pool ahead of set(), lays it out at the current screen size and
+        // (if render is set and every element allows it) rasterizes the first frame
+        // set() then only swaps the tree in and writes out the cached frame
+        // While it runs, construction code resolves root(), state(), tags(), deps() and the
+        // animations to the tree being prepared, themes and dependencies are synced with the
+        // main thread, the rest of the screen must not be used
+        void prepare(std::string_view name, bool render = true);
+        bool is_prepared(std::string_view name) const;
 
         template<typename Type = void> auto state() const
         {
             if constexpr (std::is_same_v<Type, void>)
             {
-                return TreeState::ptr(_ts.current->state);
+                return TreeState::ptr(_tree()->state);
             }
             else
             {
-                return std::static_pointer_cast<Type>(_ts.current->state);
+                return std::static_pointer_cast<Type>(_tree()->state);
             }
         }
         template<typename Type = void> auto state(std::string_view name) const
@@ -272,7 +338,7 @@ namespace d2::sys
             Argv&&... args
         )
         {
-            auto& interps = _ts.current->animations;
+            auto& interps = _tree()->animations;
             const auto ptr =
                 std::make_shared<Type>(time, elem.shared(), std::forward<Argv>(args)...);
             const auto target = ptr->target();
@@ -280,12 +346,14 @@ namespace d2::sys
             auto f = interps.find(target);
             if (f != interps.end())
                 interps.erase(f);
+            _tree()->batch.remove(elem.shared().get(), target.second);
 
             auto& slot = interps[target];
             slot = ptr;
             slot->start();
 
-            context()->deadline(std::chrono::steady_clock::now());
+            if (_preparing_tree() == nullptr)
+                context()->deadline(std::chrono::steady_clock::now());
 
             return ptr;
         }
@@ -297,6 +365,32 @@ namespace d2::sys
             return animate<Type>(time, [](d2::TreeIter<>) {}, target, std::forward<Argv>(args)...);
         }
 
+        // Interpolates a numeric property (colors, units, offsets) through the animation batch
+        // Much cheaper than animate() when many animations run at once, but limited to easings
+        template<typename Type, style::uai_property Property>
+            requires d2::impl::batch_animatable<d2::impl::style_type<Type, Property>>
+        void animate_batched(
+            std::chrono::milliseconds time,
+            d2::TreeIter<Type> elem,
+            d2::impl::style_type<Type, Property> dest,
+            Easing easing = Easing::Linear,
+            std::function<void(d2::TreeIter<>)> finish = nullptr
+        )
+        {
+            auto& interps = _tree()->animations;
+            const auto ptr = elem.shared();
+
+            auto f = interps.find(std::make_pair(static_cast<Element*>(ptr.get()), Property));
+            if (f != interps.end())
+                interps.erase(f);
+            _tree()->batch.template add<Type, Property>(
+                time, ptr, std::move(dest), easing, std::move(finish)
+            );
+
+            if (_preparing_tree() == nullptr)
+                context()->deadline(std::chrono::steady_clock::now());
+        }
+
         void clear_animations(TreeIter<> ptr);
         void clear_animations(TreeIter<> ptr, style::uai_property prop);
 
@@ -304,6 +398,9 @@ namespace d2::sys
 
         template<typename Type> Type& theme()
         {
+            // Themes are resolved (and cached) on the main thread
+            if (const auto ctx = context(); !ctx->is_synced())
+                return *ctx->sync([this]() { return &theme<Type>(); });
             auto f = _themes.find(Type::tc);
             if (f == _themes.end())
             {
@@ -325,6 +422,8 @@ namespace d2::sys
         }
         template<typename Type> Type& theme(const std::string& id)
         {
+            if (const auto ctx = context(); !ctx->is_synced())
+                return *ctx->sync([this, &id]() { return &theme<Type>(id); });
             const auto code = style::Theme::id_to_code(id);
             auto f = _themes.find(code);
             if (f == _themes.end())
@@ -357,10 +456,14 @@ namespace d2::sys
 
         template<typename Type> bool has_theme()
         {
+            if (const auto ctx = context(); !ctx->is_synced())
+                return ctx->sync([this]() { return has_theme<Type>(); });
             return _themes.contains(typeid(Type).hash_code());
         }
         bool has_theme(const std::string& id)
         {
+            if (const auto ctx = context(); !ctx->is_synced())
+                return ctx->sync([this, &id]() { return has_theme(id); });
             return _themes.contains(std::hash<std::string>()(id));
         }
 
@@ -378,6 +481,8 @@ namespace d2::sys
         // Rendering
 
         void set_refresh_rate(std::chrono::milliseconds refresh);
+        void set_render_mode(RenderMode mode);
+        RenderMode render_mode() const;
         void tick();
 
         eptr traverse();
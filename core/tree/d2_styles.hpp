@@ -329,7 +329,7 @@ namespace d2::style
         void _int_set_synced(Type&& value, bool temporary)
         {
             const auto ctx = _context();
-            if (ctx->is_synced())
+            if (ctx->is_element_synced(_state_impl()))
             {
                 _int_set<Property>(std::forward<Type>(value), temporary);
             }
@@ -352,7 +352,7 @@ namespace d2::style
         template<property Property> auto _int_get_synced()
         {
             const auto ctx = _context();
-            if (ctx->is_synced())
+            if (ctx->is_element_synced(_state_impl()))
             {
                 return _int_get<Property>();
             }
@@ -456,6 +456,10 @@ namespace d2::style
         {
             return _context();
         }
+        virtual const TreeState* _state_impl() const override
+        {
+            return _base()->state().get();
+        }
         virtual std::weak_ptr<void> _handle_impl() override
         {
             return _base()->shared_from_this();
@@ -549,7 +553,7 @@ namespace d2::style
         {
             const auto _ = _base()->shared_from_this();
             const auto ctx = _context();
-            if (ctx->is_synced())
+            if (ctx->is_element_synced(_state_impl()))
                 return func(*getref<Property>());
             return ctx->sync([this, func = std::forward<Func>(func)]
                              { return func(*getref<Property>()); });
@@ -558,7 +562,7 @@ namespace d2::style
         {
             const auto _ = _base()->shared_from_this();
             const auto ctx = _context();
-            if (ctx->is_synced())
+            if (ctx->is_element_synced(_state_impl()))
             {
                 _set_dynamic_impl(Property, false);
                 auto [var, type] = _int_get_vals_chained<Property>();
@@ -157,6 +157,8 @@ namespace d2::style
         virtual void _register_dep_bind(property prop, DependencyHandle handle) = 0;
         virtual void _deregister_dep_bind(property prop) = 0;
         virtual std::shared_ptr<IOContext> _context_impl() const = 0;
+        // State of the tree the element belongs to (decides whether it can be accessed in place)
+        virtual const TreeState* _state_impl() const = 0;
         virtual std::weak_ptr<void> _handle_impl() = 0;
     public:
         template<D2_UAI_INTERFACE_TEMPL Interface> bool has_interface()
@@ -173,7 +175,7 @@ namespace d2::style
         auto& set_for(Type&& value)
         {
             auto ctx = _context_impl();
-            if (ctx->is_synced())
+            if (ctx->is_element_synced(_state_impl()))
             {
                 _int_set_for<Interface, Property>(std::forward<Type>(value), Temporary);
             }
@@ -192,7 +194,7 @@ namespace d2::style
             using type = std::remove_cvref_t<decltype(*getref_for<Interface, Property>())>;
             type result;
             auto ctx = _context_impl();
-            if (ctx->is_synced())
+            if (ctx->is_element_synced(_state_impl()))
             {
                 result = _int_get_for<Interface, Property>();
             }
@@ -217,7 +219,7 @@ namespace d2::style
         auto apply_get_for(Func&& func)
         {
             auto ctx = _context_impl();
-            if (ctx->is_synced())
+            if (ctx->is_element_synced(_state_impl()))
             {
                 return func(*getref_for<Interface, Property>());
             }
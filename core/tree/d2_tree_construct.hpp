@@ -328,6 +328,19 @@ namespace d2
             );
         }
 
+        template<Element::property Prop, typename Value>
+        void animate_batched(
+            std::chrono::milliseconds time,
+            Value&& dest,
+            Easing easing = Easing::Linear,
+            std::function<void(TreeIter<>)> finish = nullptr
+        )
+        {
+            screen()->template animate_batched<Parent, Prop>(
+                time, _ptr.as<Parent>(), std::forward<Value>(dest), easing, std::move(finish)
+            );
+        }
+
         template<
             template<typename, Element::property> typename Interpolator,
             Element::property Prop,
@@ -100,7 +100,10 @@ namespace d2
         if (event == State::Clicked || event == State::Focused)
             _cursor_sink_listener_cnt++;
         if (event == State::Event || event == State::RcEvent)
+        {
             _dynamic_input_listener_cnt++;
+            _mark_index();
+        }
         return EventListener(l);
     }
     void Element::_unmute_listener(EventListenerState::ptr listener)
@@ -109,7 +112,10 @@ namespace d2
         if (listener->event() == State::Clicked || listener->event() == State::Focused)
             _cursor_sink_listener_cnt++;
         if (listener->event() == State::Event || listener->event() == State::RcEvent)
+        {
             _dynamic_input_listener_cnt++;
+            _mark_index();
+        }
         _subscribers[listener->index()]->setstate(EventListenerState::Mode::Active);
     }
     void Element::_mute_listener(EventListenerState::ptr listener)
@@ -118,7 +124,10 @@ namespace d2
         if (listener->event() == State::Clicked || listener->event() == State::Focused)
             _cursor_sink_listener_cnt--;
         if (listener->event() == State::Event || listener->event() == State::RcEvent)
+        {
             _dynamic_input_listener_cnt--;
+            _mark_index();
+        }
         _subscribers[listener->index()]->setstate(EventListenerState::Mode::Muted);
     }
     void Element::_destroy_listener(EventListenerState::ptr listener)
@@ -127,7 +136,10 @@ namespace d2
         if (listener->event() == State::Clicked || listener->event() == State::Focused)
             _cursor_sink_listener_cnt--;
         if (listener->event() == State::Event || listener->event() == State::RcEvent)
+        {
             _dynamic_input_listener_cnt--;
+            _mark_index();
+        }
         _subscribers[listener->index()] = nullptr;
         for (auto it = _subscribers.begin(); it != _subscribers.end();)
         {
@@ -201,10 +213,24 @@ namespace d2
     }
     void Element::_signal_write_child(write_flag type, unsigned int prop, ptr element)
     {
+        if (type & WasWrittenLayout)
+            _mark_index();
         _signal_write_child_impl(type, prop, element);
     }
+    void Element::_mark_index() const
+    {
+        constexpr internal_flag child = IndexChildDirty | FocusChildDirty;
+        _internal_state |= IndexDirty | FocusDirty;
+        for (auto it = parent(); it != nullptr; it = it->parent())
+        {
+            if ((it->_internal_state.fetch_or(child) & child) == child)
+                break;
+        }
+    }
     void Element::_signal_write(write_flag type, unsigned int prop, ptr element)
     {
+        if (type & WasWrittenLayout)
+            _mark_index();
         _signal_write_local(type, prop, element);
         if (parent())
         {
@@ -243,6 +269,7 @@ namespace d2
     {
         if (const auto flags = _contextual_change(type))
         {
+            _mark_index();
             _invalidate_state(flags);
             _signal_context_change_impl(type, prop, element);
             _signal_write_impl(flags, prop, element);
@@ -787,5 +814,28 @@ namespace d2
         {
             _ptr->_clone_state_if(parent);
         }
+        void ElementView::update_layout()
+        {
+            if (_ptr->_internal_state & Element::WasWrittenLayout)
+            {
+                _ptr->_update_layout_impl();
+                _ptr->_signal_update(Element::WasWrittenLayout);
+            }
+        }
+        bool ElementView::concurrent_frame() const
+        {
+            return _ptr->_concurrent_frame_impl();
+        }
+        bool ElementView::owns_frame_buffer() const
+        {
+            const auto state = _ptr->_internal_state.load();
+            if (_ptr->_provides_buffer_impl())
+                return false;
+            if (!(state & Element::CachePolicyBypass) && !(state & Element::CachePolicyStatic) &&
+                !((state & Element::CachePolicyDynamic) && _ptr->_frames_redrawn == 1))
+                return false;
+            const auto [width, height] = _ptr->_reserve_buffer_impl();
+            return width > 0 && height > 0;
+        }
     } // namespace internal
 } // namespace d2
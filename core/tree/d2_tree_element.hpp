@@ -116,6 +116,13 @@ namespace d2
             CachePolicyStatic = 1 << 10,
             // Bypasses any caching techniques
             CachePolicyBypass = 1 << 11,
+            // Set when the geometry of the children might have changed since the hit index saw it
+            IndexDirty = 1 << 12,
+            // Set when some descendant is marked as IndexDirty
+            IndexChildDirty = 1 << 13,
+            // Same as the two above but for the focus order index
+            FocusDirty = 1 << 14,
+            FocusChildDirty = 1 << 15,
         };
         enum WriteType : write_flag
         {
@@ -393,6 +400,8 @@ namespace d2
         virtual void _signal_context_change_impl(write_flag type, unsigned int prop, ptr element) {}
 
         void _signal_write_child(write_flag type, unsigned int prop, ptr element);
+        // Marks the element and its ancestors for the hit index
+        void _mark_index() const;
         void _signal_write(write_flag type, unsigned int prop, ptr element);
 
         void _clone_state_if(ptr parent);
@@ -441,6 +450,12 @@ namespace d2
         {
             return false;
         }
+        // Whether frame() only touches the subtree once the layout is resolved (i.e. the element
+        // can be rasterized on another thread), elements opt in
+        virtual bool _concurrent_frame_impl() const
+        {
+            return false;
+        }
 
         // Core
 
@@ -572,6 +587,12 @@ namespace d2
             void trigger_event(in::InputFrame& frame, bool recursive);
             void setparent(Element::pptr ptr);
             void clone_state_if(Element::ptr parent);
+
+            // Applies pending layout updates the way frame() does before rasterizing
+            void update_layout();
+            bool concurrent_frame() const;
+            // The next frame() renders into a buffer of the element (not a view of the parent's)
+            bool owns_frame_buffer() const;
         };
     } // namespace internal
 } // namespace d2
@@ -0,0 +1,87 @@
+#include "core/utils/d2_histogram.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace d2
+{
+    std::size_t LatencyHistogram::_index(std::uint64_t value)
+    {
+        value = std::min<std::uint64_t>(value, (std::uint64_t(1) << _max_bits) - 1);
+        if (value < _linear)
+            return value;
+
+        // Shifted so that the value lands in [_sub_count, _sub_count * 2)
+        const auto shift = std::size_t(std::bit_width(value)) - _sub_bits - 1;
+        return _linear + (shift - 1) * _sub_count + ((value >> shift) - _sub_count);
+    }
+    std::uint64_t LatencyHistogram::_upper(std::size_t index)
+    {
+        if (index < _linear)
+            return index;
+
+        const auto shift = (index - _linear) / _sub_count + 1;
+        const auto sub = (index - _linear) % _sub_count + _sub_count;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::record(duration value)
+    {
+        const auto us = std::uint64_t(std::max<duration::rep>(value.count(), 0));
+        _buckets[_index(us)]++;
+        _min = _count == 0 ? us : std::min(_min, us);
+        _max = std::max(_max, us);
+        _sum += us;
+        _count++;
+    }
+    void LatencyHistogram::merge(const LatencyHistogram& other)
+    {
+        if (other._count == 0)
+            return;
+        for (std::size_t i = 0; i < _bucket_count; i++)
+            _buckets[i] += other._buckets[i];
+        _min = _count == 0 ? other._min : std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+        _sum += other._sum;
+        _count += other._count;
+    }
+    void LatencyHistogram::reset()
+    {
+        *this = LatencyHistogram();
+    }
+
+    std::size_t LatencyHistogram::count() const
+    {
+        return _count;
+    }
+    LatencyHistogram::duration LatencyHistogram::min() const
+    {
+        return duration(_min);
+    }
+    LatencyHistogram::duration LatencyHistogram::max() const
+    {
+        return duration(_max);
+    }
+    LatencyHistogram::duration LatencyHistogram::mean() const
+    {
+        return _count == 0 ? duration(0) : duration(_sum / _count);
+    }
+    LatencyHistogram::duration LatencyHistogram::percentile(double fraction) const
+    {
+        if (_count == 0)
+            return duration(0);
+
+        const auto target = std::max<std::uint64_t>(
+            1, std::uint64_t(std::ceil(std::clamp(fraction, 0.0, 1.0) * double(_count)))
+        );
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < _bucket_count; i++)
+        {
+            seen += _buckets[i];
+            if (seen >= target)
+                return duration(std::clamp(_upper(i), _min, _max));
+        }
+        return duration(_max);
+    }
+} // namespace d2
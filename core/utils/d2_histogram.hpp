@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace d2
+{
+    // Log-linear (HDR style) histogram of durations in microseconds
+    // Every power of two range is split into 32 buckets, so values are kept within ~3% and
+    // recording is a couple of bit operations regardless of the range (up to ~70 minutes)
+    class LatencyHistogram
+    {
+    public:
+        using duration = std::chrono::microseconds;
+    private:
+        static constexpr std::size_t _sub_bits = 5;
+        static constexpr std::size_t _sub_count = std::size_t(1) << _sub_bits;
+        static constexpr std::size_t _linear = _sub_count * 2;
+        static constexpr std::size_t _max_bits = 32;
+        static constexpr std::size_t _bucket_count =
+            _linear + (_max_bits - _sub_bits - 1) * _sub_count;
+
+        std::array<std::uint64_t, _bucket_count> _buckets{};
+        std::uint64_t _count{0};
+        std::uint64_t _sum{0};
+        std::uint64_t _min{0};
+        std::uint64_t _max{0};
+
+        static std::size_t _index(std::uint64_t value);
+        // Highest value which falls into the bucket
+        static std::uint64_t _upper(std::size_t index);
+    public:
+        void record(duration value);
+        void merge(const LatencyHistogram& other);
+        void reset();
+
+        std::size_t count() const;
+        duration min() const;
+        duration max() const;
+        duration mean() const;
+        // Value under which the given fraction (0-1) of the samples are
+        duration percentile(double fraction) const;
+    };
+} // namespace d2
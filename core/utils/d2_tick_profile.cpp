@@ -0,0 +1,163 @@
+#include "core/utils/d2_tick_profile.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#ifdef __unix__
+#include <time.h>
+#endif
+
+namespace d2
+{
+    TickProfile::duration TickProfile::_thread_cpu_time()
+    {
+#if defined(__unix__) && defined(CLOCK_THREAD_CPUTIME_ID)
+        timespec ts{};
+        if (::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+            return duration(std::int64_t(ts.tv_sec) * 1'000'000 + ts.tv_nsec / 1'000);
+#endif
+        return duration(0);
+    }
+
+    void TickProfile::begin(clock::time_point now)
+    {
+        _current = {};
+        _current_wakeups = 0;
+        _begin = now;
+        _mark = now;
+        _measure_cpu = _cpu_time.load(std::memory_order::relaxed);
+        if (_measure_cpu)
+            _cpu_begin = _thread_cpu_time();
+    }
+    void TickProfile::mark(Phase phase)
+    {
+        const auto now = clock::now();
+        _current[std::size_t(phase)] += std::chrono::duration_cast<duration>(now - _mark);
+        _mark = now;
+    }
+    void TickProfile::skip()
+    {
+        _mark = clock::now();
+    }
+    void TickProfile::wake(Wakeup reason)
+    {
+        _current_wakeups |= std::uint8_t(1 << std::size_t(reason));
+    }
+    void TickProfile::end(clock::time_point now)
+    {
+        static constexpr auto narrow = [](duration value) -> std::uint32_t
+        {
+            return std::uint32_t(std::clamp<duration::rep>(
+                value.count(), 0, std::numeric_limits<std::uint32_t>::max()
+            ));
+        };
+
+        if (_current_wakeups == 0)
+            wake(Wakeup::Other);
+        for (std::size_t i = 0; i < wakeup_count; i++)
+            if (_current_wakeups & (1 << i))
+                _wakeups[i].fetch_add(1, std::memory_order::relaxed);
+
+        const auto tick = _head.load(std::memory_order::relaxed);
+        auto& slot = _slots[tick % capacity];
+
+        slot.seq.store(tick * 2 + 1, std::memory_order::relaxed);
+        std::atomic_thread_fence(std::memory_order::release);
+        for (std::size_t i = 0; i < phase_count; i++)
+            slot.phases[i].store(narrow(_current[i]), std::memory_order::relaxed);
+        slot.total.store(
+            narrow(std::chrono::duration_cast<duration>(now - _begin)), std::memory_order::relaxed
+        );
+        slot.cpu.store(
+            _measure_cpu ? narrow(_thread_cpu_time() - _cpu_begin) : 0, std::memory_order::relaxed
+        );
+        slot.wakeups.store(_current_wakeups, std::memory_order::relaxed);
+        slot.seq.store((tick + 1) * 2, std::memory_order::release);
+        _head.store(tick + 1, std::memory_order::release);
+    }
+
+    void TickProfile::set_cpu_time(bool value)
+    {
+        _cpu_time = value;
+    }
+    bool TickProfile::cpu_time() const
+    {
+        return _cpu_time;
+    }
+
+    std::uint64_t TickProfile::ticks() const
+    {
+        return _head.load(std::memory_order::acquire);
+    }
+    std::uint64_t TickProfile::wakeups(Wakeup reason) const
+    {
+        return _wakeups[std::size_t(reason)].load(std::memory_order::relaxed);
+    }
+    std::vector<TickProfile::Sample> TickProfile::history(std::size_t count) const
+    {
+        const auto head = _head.load(std::memory_order::acquire);
+        const auto n = std::min<std::uint64_t>({count, capacity, head});
+
+        std::vector<Sample> out;
+        out.reserve(n);
+        for (auto tick = head - n; tick < head; tick++)
+        {
+            const auto& slot = _slots[tick % capacity];
+            const auto expected = (tick + 1) * 2;
+
+            Sample sample{.tick = tick};
+            if (slot.seq.load(std::memory_order::acquire) != expected)
+                continue;
+            for (std::size_t i = 0; i < phase_count; i++)
+                sample.phases[i] = duration(slot.phases[i].load(std::memory_order::relaxed));
+            sample.total = duration(slot.total.load(std::memory_order::relaxed));
+            sample.cpu = duration(slot.cpu.load(std::memory_order::relaxed));
+            sample.wakeups = slot.wakeups.load(std::memory_order::relaxed);
+            std::atomic_thread_fence(std::memory_order::acquire);
+            // Overwritten while reading
+            if (slot.seq.load(std::memory_order::relaxed) != expected)
+                continue;
+            out.push_back(sample);
+        }
+        return out;
+    }
+
+    std::string_view TickProfile::name(Phase phase)
+    {
+        switch (phase)
+        {
+        case Phase::Input:
+            return "Input";
+        case Phase::State:
+            return "State";
+        case Phase::Events:
+            return "Events";
+        case Phase::Animations:
+            return "Animations";
+        case Phase::Compose:
+            return "Compose";
+        case Phase::Output:
+            return "Output";
+        default:
+            return "";
+        }
+    }
+    std::string_view TickProfile::name(Wakeup reason)
+    {
+        switch (reason)
+        {
+        case Wakeup::Input:
+            return "Input";
+        case Wakeup::Write:
+            return "Write";
+        case Wakeup::Animation:
+            return "Animation";
+        case Wakeup::Refresh:
+            return "Refresh";
+        case Wakeup::Other:
+            return "Other";
+        default:
+            return "";
+        }
+    }
+} // namespace d2
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace d2
+{
+    // Per phase timings of the last ticks of the screen
+    // Written by the thread running the tick, readable from any thread without locking
+    // Every slot of the ring is sequence locked, a reader skips a slot that is being overwritten
+    class TickProfile
+    {
+    public:
+        using duration = std::chrono::microseconds;
+        using clock = std::chrono::steady_clock;
+
+        enum class Phase : std::uint8_t
+        {
+            // Viewport updates, hover/click resolution and focus changes
+            Input,
+            // TreeState::update
+            State,
+            // Event dispatch to the focused/hovered elements
+            Events,
+            Animations,
+            // Layout (resolved lazily while composing) and rasterization of the tree
+            Compose,
+            // Encoding and submission of the frame
+            Output,
+            Count,
+        };
+        static constexpr std::size_t phase_count = std::size_t(Phase::Count);
+        // What the tick was run for, several can apply to one tick
+        enum class Wakeup : std::uint8_t
+        {
+            // Input was read (keys, mouse, resize)
+            Input,
+            // Elements were written since the last frame (tasks, signals, other threads)
+            Write,
+            Animation,
+            // The periodic refresh (see SystemScreen::set_refresh_rate)
+            Refresh,
+            // None of the above (tasks and timers without a visible effect)
+            Other,
+            Count,
+        };
+        static constexpr std::size_t wakeup_count = std::size_t(Wakeup::Count);
+        static constexpr std::size_t capacity = 256;
+
+        struct Sample
+        {
+            std::uint64_t tick{0};
+            std::array<duration, phase_count> phases{};
+            // Wall time of the whole tick, includes the time not attributed to a phase
+            duration total{0};
+            // Thread CPU time of the whole tick (0 if not measured)
+            duration cpu{0};
+            // Mask of the wakeup reasons
+            std::uint8_t wakeups{0};
+
+            duration phase(Phase value) const
+            {
+                return phases[std::size_t(value)];
+            }
+            bool woken_by(Wakeup value) const
+            {
+                return wakeups & (1 << std::size_t(value));
+            }
+        };
+    private:
+        struct Slot
+        {
+            // Odd while being written, 2 * (tick + 1) once complete
+            std::atomic<std::uint64_t> seq{0};
+            std::array<std::atomic<std::uint32_t>, phase_count> phases{};
+            std::atomic<std::uint32_t> total{0};
+            std::atomic<std::uint32_t> cpu{0};
+            std::atomic<std::uint8_t> wakeups{0};
+        };
+
+        std::array<Slot, capacity> _slots{};
+        std::atomic<std::uint64_t> _head{0};
+        std::atomic<bool> _cpu_time{false};
+        // Ticks per reason since the start
+        std::array<std::atomic<std::uint64_t>, wakeup_count> _wakeups{};
+
+        // Writer state
+        std::array<duration, phase_count> _current{};
+        clock::time_point _begin{};
+        clock::time_point _mark{};
+        duration _cpu_begin{0};
+        std::uint8_t _current_wakeups{0};
+        bool _measure_cpu{false};
+
+        static duration _thread_cpu_time();
+    public:
+        TickProfile() = default;
+        TickProfile(const TickProfile&) = delete;
+        TickProfile(TickProfile&&) = delete;
+
+        // Writer side, called around and within a tick
+        void begin(clock::time_point now = clock::now());
+        // Attributes the time since the previous mark (or begin) to the phase
+        void mark(Phase phase);
+        // Drops the time since the previous mark, it only counts towards the total
+        void skip();
+        // Records a reason the tick was run for
+        void wake(Wakeup reason);
+        void end(clock::time_point now = clock::now());
+
+        // Also sample the CPU time of the ticking thread (costs a syscall on some platforms)
+        void set_cpu_time(bool value);
+        bool cpu_time() const;
+
+        // Ticks recorded so far
+        std::uint64_t ticks() const;
+        // Ticks run for the reason so far (a tick can count towards several)
+        std::uint64_t wakeups(Wakeup reason) const;
+        // Up to count of the most recent samples, oldest first
+        std::vector<Sample> history(std::size_t count = capacity) const;
+
+        static std::string_view name(Phase phase);
+        static std::string_view name(Wakeup reason);
+
+        TickProfile& operator=(const TickProfile&) = delete;
+        TickProfile& operator=(TickProfile&&) = delete;
+    };
+} // namespace d2
@@ -95,6 +95,11 @@ namespace d2::dx
         }
     }
 
+    bool Box::_concurrent_frame_impl() const
+    {
+        // Only composes the frames of the children
+        return true;
+    }
     void Box::_frame_impl(PixelBuffer::View buffer)
     {
         // Fill in the gaps
@@ -26,6 +26,7 @@ namespace d2::dx
         virtual Unit _layout_impl(Element::Layout type) const override;
 
         virtual void _frame_impl(PixelBuffer::View buffer) override;
+        virtual bool _concurrent_frame_impl() const override;
 
         virtual void _render_start() {}
         virtual void _object_render(PixelBuffer::View buffer, ptr obj);
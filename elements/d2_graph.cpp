@@ -1,5 +1,7 @@
 #include "elements/d2_graph.hpp"
 
+#include <numeric>
+
 namespace d2::dx::graph
 {
     void CyclicVerticalBar::_frame_impl(PixelBuffer::View buffer)
@@ -252,6 +254,103 @@ namespace d2::dx::graph
         );
     }
 
+    void StackedVerticalBar::_frame_impl(PixelBuffer::View buffer)
+    {
+        buffer.fill(pixel::combine(data::foreground_color, data::background_color));
+        ContainerHelper::_render_border(buffer);
+
+        const auto series = _series.size();
+        if (series == 0 || _data.empty())
+            return;
+
+        const auto [width, height] = box();
+        const auto [basex, basey] = ContainerHelper::_border_base();
+        const auto [ibasex, ibasey] = ContainerHelper::_border_base_inv();
+        const auto inner_w = std::max(0, width - basex - ibasex);
+        const auto inner_h = std::max(0, height - basey - ibasey);
+        if (inner_w == 0 || inner_h == 0)
+            return;
+
+        const auto columns = _data.size() / series;
+        const auto first = columns > std::size_t(inner_w) ? columns - inner_w : 0;
+
+        auto scale = _scale;
+        if (scale <= 0.f)
+        {
+            for (std::size_t c = first; c < columns; c++)
+            {
+                const auto beg = _data.begin() + c * series;
+                scale = std::max(scale, std::accumulate(beg, beg + series, 0.f));
+            }
+        }
+        if (!(scale > 0.f))
+            return;
+
+        const auto offset = inner_w - int(columns - first);
+        for (std::size_t c = first; c < columns; c++)
+        {
+            const auto* values = _data.data() + c * series;
+            const auto x = basex + offset + int(c - first);
+
+            std::size_t s = 0;
+            float sum = values[0];
+            for (int j = 0; j < inner_h; j++)
+            {
+                // The series covering the middle of the cell colors it
+                const auto mid = (float(j) + 0.5f) * scale / float(inner_h);
+                while (s + 1 < series && sum <= mid)
+                    sum += values[++s];
+                if (sum <= mid)
+                    break;
+
+                auto px = pixel::combine(data::foreground_color, _series[s]);
+                px.v = ' ';
+                buffer.at(x, basey + inner_h - j - 1).blend(px);
+            }
+        }
+    }
+    std::size_t StackedVerticalBar::_capacity() const
+    {
+        const auto [basex, basey] = ContainerHelper::_border_base();
+        const auto [ibasex, ibasey] = ContainerHelper::_border_base_inv();
+        return std::max(0, box().width - basex - ibasex);
+    }
+    void StackedVerticalBar::set_series(std::vector<px::background> colors)
+    {
+        _series = std::move(colors);
+        _data.clear();
+        _signal_write(Style);
+    }
+    void StackedVerticalBar::set_scale(float value)
+    {
+        _scale = value;
+        _signal_write(Style);
+    }
+    void StackedVerticalBar::clear()
+    {
+        _data.clear();
+        _data.shrink_to_fit();
+        _signal_write(Style);
+    }
+    void StackedVerticalBar::push(std::span<const float> values)
+    {
+        const auto series = _series.size();
+        if (series == 0)
+            return;
+
+        const auto offset = _data.size();
+        _data.resize(offset + series, 0.f);
+        std::copy_n(values.begin(), std::min(values.size(), series), _data.begin() + offset);
+        for (auto it = _data.begin() + offset; it != _data.end(); ++it)
+            if (!std::isfinite(*it) || *it < 0.f)
+                *it = 0.f;
+
+        const auto columns = _data.size() / series;
+        if (const auto cap = std::max<std::size_t>(1, _capacity()); columns > cap)
+            _data.erase(_data.begin(), _data.begin() + (columns - cap) * series);
+        _signal_write(Style);
+    }
+
     float NodeWaveGraph::_lerp(float t, float a, float b)
     {
         return a + t * (b - a);
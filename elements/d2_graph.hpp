@@ -4,6 +4,7 @@
 #include <core/tree/d2_styles.hpp>
 #include <core/tree/d2_tree_element.hpp>
 #include <elements/d2_element_utils.hpp>
+#include <span>
 
 namespace d2
 {
@@ -84,6 +85,38 @@ namespace d2
             void rescale(float scale, float trans);
         };
 
+        // Columns of values stacked on top of each other, one color per series
+        // New columns are pushed on the right, the oldest ones scroll out on the left
+        class StackedVerticalBar : public style::
+                                       UAI<StackedVerticalBar,
+                                           style::ILayout,
+                                           style::IContainer,
+                                           style::IColors>,
+                                   public impl::ContainerHelper<StackedVerticalBar>
+        {
+        public:
+            friend class ContainerHelper<StackedVerticalBar>;
+            using data = style::
+                UAI<StackedVerticalBar, style::ILayout, style::IContainer, style::IColors>;
+            using data::data;
+        protected:
+            std::vector<px::background> _series{};
+            // Columns of _series.size() values, oldest first
+            std::vector<float> _data{};
+            // Value spanning the full height, 0 to fit the largest column
+            float _scale{0.f};
+
+            virtual void _frame_impl(PixelBuffer::View buffer) override;
+
+            std::size_t _capacity() const;
+        public:
+            void set_series(std::vector<px::background> colors);
+            void set_scale(float value);
+            void clear();
+            // Values in the order of the series, missing ones are 0
+            void push(std::span<const float> values);
+        };
+
         class NodeWaveGraph : public d2::style::
                                   UAI<NodeWaveGraph,
                                       d2::style::ILayout,
@@ -387,6 +387,25 @@ namespace d2::dx
             flag |= WriteType::Offset;
             write = true;
         }
+        if (frame.had_event(in::Event::Paste) && !(data::input_options & ReadOnly))
+        {
+            const auto paste = frame.paste();
+            if (!paste.empty())
+            {
+                if (_is_highlighted())
+                    _remove_highlighted();
+                if (ptr_ > data::text.size())
+                    ptr_ = data::text.size();
+
+                // Single line, line breaks become spaces
+                const auto at =
+                    data::text.insert(data::text.begin() + ptr_, paste.begin(), paste.end());
+                std::replace(at, at + paste.size(), '\n', ' ');
+                _move_right(paste.size());
+                flag |= WriteType::Offset;
+                write = true;
+            }
+        }
 
         if (write)
         {
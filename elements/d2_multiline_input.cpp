@@ -1057,6 +1057,17 @@ namespace d2::dx
                 write = true;
             }
         }
+        // The whole paste is a single insert (and a single undo step)
+        if (frame.had_event(in::Event::Paste) && !(data::input_options & ReadOnly))
+        {
+            const auto paste = frame.paste();
+            if (!paste.empty())
+            {
+                _insert(paste);
+                flag |= WriteType::Offset;
+                write = true;
+            }
+        }
 
         if (write)
         {
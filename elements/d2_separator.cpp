@@ -2,6 +2,10 @@
 
 namespace d2::dx
 {
+    bool Separator::_concurrent_frame_impl() const
+    {
+        return true;
+    }
     void Separator::_frame_impl(PixelBuffer::View buffer)
     {
         auto color = pixel::combine(data::foreground_color, data::background_color);
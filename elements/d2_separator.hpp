@@ -50,6 +50,7 @@ namespace d2
             } _orientation;
 
             virtual void _frame_impl(PixelBuffer::View buffer) override;
+            virtual bool _concurrent_frame_impl() const override;
         public:
             Separator(
                 const std::string& name,
@@ -60,6 +60,10 @@ namespace d2::dx
             return data::height;
         }
     }
+    bool Text::_concurrent_frame_impl() const
+    {
+        return true;
+    }
     void Text::_frame_impl(PixelBuffer::View buffer)
     {
         buffer.fill(data::background_color);
@@ -18,6 +18,7 @@ namespace d2::dx
 
         virtual Unit _layout_impl(Element::Layout type) const override;
         virtual void _frame_impl(PixelBuffer::View buffer) override;
+        virtual bool _concurrent_frame_impl() const override;
         virtual void _signal_write_impl(write_flag type, unsigned int prop, ptr element) override;
     public:
         Text(const std::string& name, TreeState::ptr state);
@@ -314,6 +314,12 @@ namespace d2::ex
              Metric{
                  .callback = [](IOContext::ptr ctx) -> float { return ctx->screen()->fps(); },
              }},
+            {"Budget",
+             Metric{
+                 .unit = "us",
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->screen()->budget().count(); },
+             }},
             {"Elements",
              Metric{
                  .callback = [](IOContext::ptr ctx) -> float
@@ -357,6 +363,52 @@ namespace d2::ex
                  .callback = [](IOContext::ptr ctx) -> float
                  { return ctx->output()->swapframe_size(); },
              }},
+            {"Reference",
+             Metric{
+                 .unit = "B",
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->reference_size(); },
+             }},
+            {"Syscalls",
+             Metric{
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->syscall_count(); },
+             }},
+            {"Output",
+             Metric{
+                 .unit = "us",
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->frame_time().count(); },
+             }},
+            {"Latency",
+             Metric{
+                 .unit = "us",
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->encode_latency().count(); },
+             }},
+            {"Dropped",
+             Metric{
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->dropped_frames(); },
+             }},
+            {"Input P50",
+             Metric{
+                 .unit = "us",
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->input_latency().percentile(0.5).count(); },
+             }},
+            {"Input P99",
+             Metric{
+                 .unit = "us",
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->input_latency().percentile(0.99).count(); },
+             }},
+            {"Input Max",
+             Metric{
+                 .unit = "us",
+                 .callback = [](IOContext::ptr ctx) -> float
+                 { return ctx->output()->input_latency().max().count(); },
+             }},
             {"Threads",
              Metric{
                  .callback = [](IOContext::ptr) -> float { return impl::thread_count(); },
@@ -415,7 +467,10 @@ namespace d2::ex
                     [](TreeCtx<Switch> ctx)
                     {
                         dstyle(ZIndex, 0);
-                        dstyle(Options, Switch::opts{"Overview", "Modules", "Inspector", "Logs"});
+                        dstyle(
+                            Options,
+                            Switch::opts{"Overview", "Modules", "Profiler", "Inspector", "Logs"}
+                        );
                         dstyle(Width, 1.0_pc);
                         dstyle(
                             OnChangeValues,
@@ -518,8 +573,17 @@ namespace d2::ex
                                         "Heap",
                                         "Framebuffer",
                                         "Swapframe",
+                                        "Reference",
+                                        "Syscalls",
+                                        "Output",
+                                        "Latency",
+                                        "Dropped",
+                                        "Input P50",
+                                        "Input P99",
+                                        "Input Max",
                                         "Delta",
                                         "FPS",
+                                        "Budget",
                                         "Elements",
                                         "Animations",
                                         "Dynamic Variables",
@@ -1068,6 +1132,168 @@ namespace d2::ex
             }
         );
 
+        // Profiler
+        ctx.elem(
+            "Profiler",
+            [](TreeCtx<FlowBox> ctx)
+            {
+                dstyle(Y, 1.0_px);
+                dstyle(Width, 1.0_pc);
+                dstyle(Height, 1.0_pxi);
+
+                static constexpr std::array<colors::pf, TickProfile::phase_count> palette{
+                    colors::b::cyan,
+                    colors::b::royal_blue,
+                    colors::b::slate_blue,
+                    colors::r::magenta,
+                    colors::g::lime,
+                    colors::r::chrome_yellow,
+                };
+                struct ProfilerState
+                {
+                    std::array<TreeIter<Text>, TickProfile::phase_count> legend{};
+                    TreeIter<Text> summary{};
+                    TreeIter<Text> wakeups{};
+                    TreeIter<graph::StackedVerticalBar> graph{};
+                    std::uint64_t next{0};
+                };
+                auto& state = ctx.declare<ProfilerState>();
+
+                for (std::size_t i = 0; i < TickProfile::phase_count; i++)
+                {
+                    ctx.elem(
+                        [&state, i](TreeCtx<Text> ctx)
+                        {
+                            state.legend[i] = ctx.ptr();
+
+                            dstyle(Value, TickProfile::name(TickProfile::Phase(i)));
+                            dstyle(ForegroundColor, palette[i]);
+                            dstyle(X, 1.0_relative);
+                        }
+                    );
+                }
+                ctx.elem(
+                    [](TreeCtx<Checkbox> ctx)
+                    {
+                        dstyle(Value, false);
+                        dstyle(X, 1.0_relative);
+                        dstyle(Y, 0.0_relative);
+                        dstyle(BackgroundColor, colors::w::transparent);
+                        dstyle(
+                            OnSubmit,
+                            [](TreeIter<Checkbox> ptr, bool value)
+                            { ptr->screen()->profile().set_cpu_time(value); }
+                        );
+                    }
+                );
+                ctx.elem(
+                    [](TreeCtx<Text> ctx)
+                    {
+                        dstyle(Value, "cpu time");
+                        dstyle(X, 1.0_relative);
+                    }
+                );
+                ctx.elem(
+                    [&state](TreeCtx<Text> ctx)
+                    {
+                        state.summary = ctx.ptr();
+
+                        dstyle(Value, " ");
+                        dstyle(X, 2.0_relative);
+                    }
+                );
+                ctx.elem(
+                    [&state](TreeCtx<Text> ctx)
+                    {
+                        state.wakeups = ctx.ptr();
+
+                        dstyle(Value, " ");
+                        dstyle(X, 2.0_relative);
+                    }
+                );
+                ctx.elem(
+                    [&state](TreeCtx<graph::StackedVerticalBar> ctx)
+                    {
+                        state.graph = ctx.ptr();
+
+                        dstyle(Width, 1.0_pc);
+                        dstyle(Height, 2.0_pxi);
+                        dstyle(Y, 0.0_relative);
+                        dstyle(ContainerBorder, true);
+
+                        ctx->set_series({palette.begin(), palette.end()});
+                    }
+                );
+
+                auto handle = ctx->context()->scheduler()->launch_cyclic(
+                    std::chrono::milliseconds(250),
+                    [ptr = ctx.ptr(), &state](auto&&...)
+                    {
+                        if (!ptr->getstate(Element::Display))
+                            return;
+
+                        auto& profile = ptr->screen()->profile();
+                        const auto samples = profile.history();
+                        if (samples.empty())
+                            return;
+
+                        std::array<std::uint64_t, TickProfile::phase_count> sum{};
+                        std::uint64_t total = 0;
+                        std::uint64_t cpu = 0;
+                        TickProfile::duration peak{0};
+                        for (const auto& sample : samples)
+                        {
+                            std::array<float, TickProfile::phase_count> values{};
+                            for (std::size_t i = 0; i < TickProfile::phase_count; i++)
+                            {
+                                values[i] = float(sample.phases[i].count());
+                                sum[i] += sample.phases[i].count();
+                            }
+                            total += sample.total.count();
+                            cpu += sample.cpu.count();
+                            peak = std::max(peak, sample.total);
+
+                            if (sample.tick >= state.next)
+                                state.graph->push(values);
+                        }
+                        state.next = samples.back().tick + 1;
+
+                        // Averages over the recorded history
+                        const auto n = samples.size();
+                        for (std::size_t i = 0; i < TickProfile::phase_count; i++)
+                            state.legend[i]->set<Text::Value>(std::format(
+                                "{} {}us", TickProfile::name(TickProfile::Phase(i)), sum[i] / n
+                            ));
+                        state.summary->set<Text::Value>(
+                            profile.cpu_time()
+                                ? std::format(
+                                      "Total {}us Max {}us CPU {}us", total / n, peak.count(),
+                                      cpu / n
+                                  )
+                                : std::format("Total {}us Max {}us", total / n, peak.count())
+                        );
+
+                        // Ticks since the start by what woke the screen up
+                        auto wakeups = std::format("Ticks {}", profile.ticks());
+                        for (std::size_t i = 0; i < TickProfile::wakeup_count; i++)
+                        {
+                            const auto reason = TickProfile::Wakeup(i);
+                            wakeups += std::format(
+                                " {} {}", TickProfile::name(reason), profile.wakeups(reason)
+                            );
+                        }
+                        state.wakeups->set<Text::Value>(std::move(wakeups));
+                    }
+                );
+                ctx.onv(
+                    Element::State::Created,
+                    false,
+                    [handle](Element::EventListener, TreeIter<FlowBox>) mutable
+                    { handle.discard(); }
+                );
+                ctx->setstate(Element::Display, false);
+            }
+        );
         // Inspector
         ctx.elem(
             "Inspector",
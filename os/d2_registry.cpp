@@ -29,7 +29,7 @@ namespace d2::sys
                             const auto compat = Module::compatible();
                             const auto nc = std::size_t(compat);
                             const auto oc = std::size_t(candidate_compat);
-                            if (candidate == nullptr || nc > oc)
+                            if (candidate == nullptr || nc < oc)
                             {
                                 candidate = sys::ModuleStub::make<Module>();
                                 candidate_compat = compat;
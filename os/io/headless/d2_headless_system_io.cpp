@@ -0,0 +1,367 @@
+#include "os/io/headless/d2_headless_system_io.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace d2::sys
+{
+    //
+    // Worker
+    //
+
+    bool HeadlessWorker::_is_current_thread_impl() const noexcept
+    {
+        return std::this_thread::get_id() == _main_thread;
+    }
+    bool HeadlessWorker::_try_accept_impl(mt::Task& task) noexcept
+    {
+        if (!_tasks.try_enqueue(task))
+            return false;
+        _wake();
+        return true;
+    }
+    void HeadlessWorker::_accept_impl(mt::Task task) noexcept
+    {
+        _tasks.enqueue(std::move(task));
+        _wake();
+    }
+    void HeadlessWorker::_ping_impl()
+    {
+        _wake();
+    }
+    void HeadlessWorker::_start_impl()
+    {
+        _main_thread = std::this_thread::get_id();
+    }
+    void HeadlessWorker::_stop_impl() noexcept
+    {
+        _wake();
+    }
+    mt::Worker::ptr HeadlessWorker::_clone_impl() const
+    {
+        return Worker::make<HeadlessWorker>();
+    }
+    void HeadlessWorker::_wake() noexcept
+    {
+        {
+            std::unique_lock lock(_mtx);
+            _woken = true;
+        }
+        _cv.notify_one();
+    }
+    void HeadlessWorker::_process_tasks()
+    {
+        std::array<mt::Task, 6> tasks;
+        while (true)
+        {
+            std::size_t count = 0;
+            while (count < tasks.size())
+            {
+                if (!_tasks.try_dequeue(tasks[count]))
+                    break;
+                ++count;
+            }
+            if (count == 0)
+                return;
+            for (std::size_t i = 0; i < count; ++i)
+                _process(tasks[i]);
+        }
+    }
+    void HeadlessWorker::wait(std::chrono::steady_clock::time_point deadline) noexcept
+    {
+        _process_tasks();
+        {
+            std::unique_lock lock(_mtx);
+            const auto until = std::min(deadline, this->deadline());
+            const auto pred = [this]() { return _woken; };
+            if (until == std::chrono::steady_clock::time_point::max())
+                _cv.wait(lock, pred);
+            else
+                _cv.wait_until(lock, until, pred);
+            _woken = false;
+        }
+        _process_tasks();
+        _tick();
+    }
+
+    //
+    // Input
+    //
+
+    void HeadlessInput::_apply(in::internal::InputFrameView& frame, const Event& ev)
+    {
+        const auto visit = [&](auto&& callback)
+        { std::visit([&](auto code) { callback(code); }, ev.code); };
+        switch (ev.type)
+        {
+        case Event::Type::Press:
+            visit([&](auto code) { frame.set(code, true); });
+            break;
+        case Event::Type::Release:
+            visit([&](auto code) { frame.set(code, false); });
+            break;
+        case Event::Type::Pulse:
+            visit([&](auto code) { frame.pulse(code); });
+            break;
+        case Event::Type::Text:
+        {
+            // Same as typing it into the terminal, a pulse for every key along with the sequence
+            for (decltype(auto) ch : ev.text)
+            {
+                if (ch >= in::keymin() && ch <= in::keymax())
+                {
+                    if (ch >= 'A' && ch <= 'Z')
+                        frame.pulse(in::special::Shift);
+                    frame.pulse(in::key(ch));
+                }
+            }
+            frame.set_text(ev.text);
+            break;
+        }
+        case Event::Type::Mouse:
+            frame.set_mouse_position(ev.position);
+            break;
+        case Event::Type::Scroll:
+            frame.set_scroll_delta(ev.position);
+            break;
+        case Event::Type::Resize:
+            _size = ev.size;
+            break;
+        case Event::Type::Cycle:
+            break;
+        }
+    }
+
+    void HeadlessInput::_lock_frame_impl()
+    {
+        _mtx.lock_shared();
+    }
+    void HeadlessInput::_unlock_frame_impl()
+    {
+        _mtx.unlock_shared();
+    }
+
+    in::InputFrame::ptr HeadlessInput::_frame_impl()
+    {
+        return _in;
+    }
+
+    void HeadlessInput::_begincycle_impl()
+    {
+        std::unique_lock lock(_mtx);
+
+        auto frame = in::internal::InputFrameView::from(_in.get());
+        frame.swap();
+        {
+            std::unique_lock script(_script_mtx);
+            while (!_script.empty())
+            {
+                const auto ev = std::move(_script.front());
+                _script.pop_front();
+                if (ev.type == Event::Type::Cycle)
+                    break;
+                _apply(frame, ev);
+                frame.set_input_time(ev.time);
+            }
+        }
+        frame.set_screen_size(_size);
+        frame.set_screen_capacity(_in->screen_size());
+
+        ++_cycles;
+    }
+    void HeadlessInput::_endcycle_impl() {}
+
+    MainWorker::ptr HeadlessInput::_worker_impl()
+    {
+        auto worker = mt::Worker::make<HeadlessWorker>();
+        _worker = worker;
+        return worker;
+    }
+
+    void HeadlessInput::schedule(Event ev)
+    {
+        if (ev.time == std::chrono::steady_clock::time_point{})
+            ev.time = std::chrono::steady_clock::now();
+        {
+            std::unique_lock lock(_script_mtx);
+            _script.push_back(std::move(ev));
+        }
+        // Wake up the main loop so that the event is picked up
+        if (const auto worker = _worker.lock(); worker != nullptr)
+            worker->ping();
+    }
+
+    void HeadlessInput::press(key code)
+    {
+        schedule({.type = Event::Type::Press, .code = code});
+    }
+    void HeadlessInput::release(key code)
+    {
+        schedule({.type = Event::Type::Release, .code = code});
+    }
+    void HeadlessInput::pulse(key code)
+    {
+        schedule({.type = Event::Type::Pulse, .code = code});
+    }
+    void HeadlessInput::type(std::string text)
+    {
+        schedule({.type = Event::Type::Text, .text = std::move(text)});
+    }
+    void HeadlessInput::move_mouse(Position pos)
+    {
+        schedule({.type = Event::Type::Mouse, .position = pos});
+    }
+    void HeadlessInput::scroll(Position delta)
+    {
+        schedule({.type = Event::Type::Scroll, .position = delta});
+    }
+    void HeadlessInput::resize(BoundingBox size)
+    {
+        schedule({.type = Event::Type::Resize, .size = size});
+    }
+    void HeadlessInput::next_cycle()
+    {
+        schedule({.type = Event::Type::Cycle});
+    }
+
+    std::size_t HeadlessInput::pending()
+    {
+        std::unique_lock lock(_script_mtx);
+        return _script.size();
+    }
+    std::size_t HeadlessInput::cycles() const
+    {
+        return _cycles;
+    }
+
+    //
+    // Output
+    //
+
+    void HeadlessOutput::set_encoder_options(TerminalEncoder::Options opts)
+    {
+        std::unique_lock lock(_mtx);
+        _encoder.set_options(opts);
+    }
+    TerminalEncoder::Options HeadlessOutput::encoder_options()
+    {
+        std::unique_lock lock(_mtx);
+        return _encoder.options();
+    }
+
+    void HeadlessOutput::set_capture(bool frames, bool stream)
+    {
+        std::unique_lock lock(_mtx);
+        _capture_frames = frames;
+        _capture_stream = stream;
+    }
+
+    std::vector<HeadlessOutput::Frame> HeadlessOutput::take_frames()
+    {
+        std::unique_lock lock(_mtx);
+        return std::exchange(_frames, {});
+    }
+    std::vector<unsigned char> HeadlessOutput::take_stream()
+    {
+        std::unique_lock lock(_mtx);
+        return std::exchange(_stream, {});
+    }
+    std::size_t HeadlessOutput::frame_count()
+    {
+        std::unique_lock lock(_mtx);
+        return _frame_count;
+    }
+
+    void HeadlessOutput::load_image(const std::string& path, ImageInstance img)
+    {
+        std::unique_lock lock(_mtx);
+        _images.insert_or_assign(
+            path, ImageState{.id = _image_id++, .width = img.width(), .height = img.height()}
+        );
+    }
+    void HeadlessOutput::release_image(const std::string& path)
+    {
+        std::unique_lock lock(_mtx);
+        _images.erase(path);
+    }
+    HeadlessOutput::ImageInstance HeadlessOutput::image_info(const std::string& path)
+    {
+        std::unique_lock lock(_mtx);
+        const auto& state = _images.at(path);
+        return ImageInstance({}, state.width, state.height);
+    }
+    SystemOutput::image HeadlessOutput::image_id(const std::string& path)
+    {
+        std::unique_lock lock(_mtx);
+        return _images.at(path).id;
+    }
+
+    void HeadlessOutput::write(std::span<const pixel> buffer, std::size_t width, std::size_t height)
+    {
+        std::unique_lock lock(_mtx);
+
+        const auto beg = std::chrono::high_resolution_clock::now();
+        const auto input = _take_input();
+
+        // The virtual terminal never fails so every frame is committed
+        _buffer_size = 0;
+        if (_encoder.encode(_out, buffer, width, height))
+        {
+            _encoder.commit();
+            _buffer_size = _out.size();
+            _record_input(input);
+        }
+        _frame_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - beg
+        );
+
+        if (_capture_stream)
+            _stream.insert(_stream.end(), _out.begin(), _out.end());
+        if (_capture_frames)
+        {
+            _frames.push_back({
+                .buffer = {buffer.begin(), buffer.end()},
+                .width = width,
+                .height = height,
+                .bytes = _buffer_size,
+                .time = _frame_time,
+            });
+        }
+        _out.clear();
+        ++_frame_count;
+    }
+
+    std::size_t HeadlessOutput::delta_size()
+    {
+        return _buffer_size;
+    }
+    std::size_t HeadlessOutput::swapframe_size()
+    {
+        return _encoder.swapframe_size();
+    }
+    std::size_t HeadlessOutput::reference_size()
+    {
+        return _encoder.reference_size();
+    }
+    std::size_t HeadlessOutput::syscall_count()
+    {
+        return 0;
+    }
+    std::chrono::microseconds HeadlessOutput::frame_time()
+    {
+        return _frame_time;
+    }
+    std::size_t HeadlessOutput::dropped_frames()
+    {
+        return 0;
+    }
+    std::chrono::microseconds HeadlessOutput::encode_latency()
+    {
+        return _frame_time;
+    }
+    std::chrono::microseconds HeadlessOutput::frame_budget()
+    {
+        return std::chrono::microseconds(0);
+    }
+} // namespace d2::sys
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <variant>
+
+#include <core/io/d2_module.hpp>
+#include <core/mods/d2_core.hpp>
+#include <core/platform/d2_terminal_encoder.hpp>
+
+namespace d2::sys
+{
+    // In memory replacement for the terminal, for tests and benchmarks
+    // Nothing touches the tty, the screen size is virtual, input is scripted and the output
+    // (composed frames and the escape stream) is captured
+    // Never picked over a native backend, has to be requested explicitly
+
+    class HeadlessWorker : public MainWorker
+    {
+    protected:
+        virtual bool _is_current_thread_impl() const noexcept override;
+        virtual bool _try_accept_impl(mt::Task& task) noexcept override;
+        virtual void _accept_impl(mt::Task task) noexcept override;
+        virtual void _ping_impl() override;
+        virtual void _start_impl() override;
+        virtual void _stop_impl() noexcept override;
+        virtual Worker::ptr _clone_impl() const override;
+    private:
+        std::atomic<std::thread::id> _main_thread{};
+        mt::TaskRing<mt::Task, 16> _tasks{};
+        std::mutex _mtx{};
+        std::condition_variable _cv{};
+        bool _woken{false};
+    private:
+        void _wake() noexcept;
+        void _process_tasks();
+    public:
+        virtual void wait(std::chrono::steady_clock::time_point deadline) noexcept override;
+    };
+
+    class HeadlessInput : public SystemInput, public ModuleImpl<HeadlessInput, Load::Immediate>
+    {
+    public:
+        using key = std::variant<in::keytype, in::special, in::mouse>;
+
+        // Scripted events are applied at the beginning of a cycle
+        // Everything up to the next Cycle marker is applied within the same cycle
+        struct Event
+        {
+            enum class Type
+            {
+                Press,
+                Release,
+                Pulse,
+                Text,
+                Mouse,
+                Scroll,
+                Resize,
+                Cycle,
+            };
+
+            Type type{Type::Cycle};
+            key code{in::keytype(0)};
+            Position position{0, 0};
+            BoundingBox size{0, 0};
+            std::string text{};
+            // When the event happened (defaults to when it was scheduled)
+            std::chrono::steady_clock::time_point time{};
+        };
+    private:
+        std::shared_mutex _mtx{};
+        in::InputFrame::ptr _in{in::InputFrame::make()};
+
+        std::mutex _script_mtx{};
+        std::deque<Event> _script{};
+        std::weak_ptr<HeadlessWorker> _worker{};
+        BoundingBox _size{80, 24};
+        std::atomic<std::size_t> _cycles{0};
+
+        void _apply(in::internal::InputFrameView& frame, const Event& ev);
+    protected:
+        virtual void _lock_frame_impl() override;
+        virtual void _unlock_frame_impl() override;
+
+        virtual in::InputFrame::ptr _frame_impl() override;
+
+        virtual void _begincycle_impl() override;
+        virtual void _endcycle_impl() override;
+
+        virtual MainWorker::ptr _worker_impl() override;
+    public:
+        using SystemInput::SystemInput;
+
+        void schedule(Event ev);
+
+        void press(key code);
+        void release(key code);
+        void pulse(key code);
+        void type(std::string text);
+        void move_mouse(Position pos);
+        void scroll(Position delta);
+        void resize(BoundingBox size);
+        void next_cycle();
+
+        // Scripted events that were not applied yet
+        std::size_t pending();
+        // Cycles that went through the input
+        std::size_t cycles() const;
+    };
+    class HeadlessOutput : public SystemOutput, public ModuleImpl<HeadlessOutput, Load::Immediate>
+    {
+    public:
+        struct Frame
+        {
+            std::vector<pixel> buffer{};
+            std::size_t width{0};
+            std::size_t height{0};
+            // Escape sequences emitted for the frame
+            std::size_t bytes{0};
+            std::chrono::microseconds time{0};
+        };
+    private:
+        struct ImageState
+        {
+            image id{0};
+            std::size_t width{0};
+            std::size_t height{0};
+        };
+    private:
+        std::mutex _mtx{};
+        TerminalEncoder _encoder{};
+        TerminalEncoder::buffer _out{};
+
+        bool _capture_frames{true};
+        bool _capture_stream{true};
+        std::vector<Frame> _frames{};
+        std::vector<unsigned char> _stream{};
+        std::size_t _frame_count{0};
+
+        std::size_t _buffer_size{0};
+        std::chrono::microseconds _frame_time{0};
+
+        std::unordered_map<std::string, ImageState> _images{};
+        image _image_id{1};
+    public:
+        using SystemOutput::SystemOutput;
+
+        void set_encoder_options(TerminalEncoder::Options opts);
+        TerminalEncoder::Options encoder_options();
+
+        // Capturing is on by default, frames are kept until taken
+        void set_capture(bool frames, bool stream);
+
+        std::vector<Frame> take_frames();
+        std::vector<unsigned char> take_stream();
+        // Frames written since the module was loaded
+        std::size_t frame_count();
+
+        virtual void load_image(const std::string& path, ImageInstance img) override;
+        virtual void release_image(const std::string& path) override;
+        virtual ImageInstance image_info(const std::string& path) override;
+        virtual image image_id(const std::string& path) override;
+
+        virtual void
+        write(std::span<const pixel> buffer, std::size_t width, std::size_t height) override;
+
+        virtual std::size_t delta_size() override;
+        virtual std::size_t swapframe_size() override;
+        virtual std::size_t reference_size() override;
+        virtual std::size_t syscall_count() override;
+        virtual std::chrono::microseconds frame_time() override;
+        virtual std::size_t dropped_frames() override;
+        virtual std::chrono::microseconds encode_latency() override;
+        virtual std::chrono::microseconds frame_budget() override;
+    };
+} // namespace d2::sys
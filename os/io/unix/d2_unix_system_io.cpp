@@ -1,21 +1,30 @@
 #include "os/io/unix/d2_unix_system_io.hpp"
+#include <core/io/d2_context.hpp>
 
 #include <absl/strings/escaping.h>
+#include <algorithm>
 #include <any>
+#include <array>
 #include <atomic>
 #include <charconv>
 #include <chrono>
+#include <cstdlib>
 #include <fcntl.h>
 #include <mutex>
 #include <optional>
+#include <pthread.h>
 #include <span>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <thread>
 #include <unistd.h>
+#include <utility>
 
 namespace d2::sys
 {
@@ -136,22 +145,102 @@ namespace d2::sys
                 _process(tasks[i]);
         }
     }
-    void UnixWorker::wait(std::chrono::steady_clock::time_point deadline) noexcept
+    void UnixWorker::_rebuild_poll()
     {
-        _process_tasks();
+        std::unique_lock lock(_watch_mtx);
+        if (!_watches_changed && !_pollfds.empty())
+            return;
+        _watches_changed = false;
+
+        // The wake pipe always comes first
+        _pollfds.clear();
+        _polled.clear();
+        _pollfds.push_back({.fd = _wake_read, .events = POLLIN, .revents = 0});
+        for (decltype(auto) it : _watches)
+        {
+            _pollfds.push_back({.fd = it.fd, .events = it.events, .revents = 0});
+            _polled.push_back(it.id);
+        }
+    }
+    void UnixWorker::_dispatch_watches()
+    {
+        for (std::size_t i = 1; i < _pollfds.size(); i++)
+        {
+            const auto revents = _pollfds[i].revents;
+            if (revents == 0)
+                continue;
+
+            // The watch could have been removed (even by a previous callback) since the poll
+            watch_callback callback;
+            {
+                std::unique_lock lock(_watch_mtx);
+                const auto id = _polled[i - 1];
+                const auto it = std::find_if(
+                    _watches.begin(), _watches.end(), [&](const Watch& w) { return w.id == id; }
+                );
+                if (it == _watches.end())
+                    continue;
+                callback = it->callback;
+                // Closed without being unwatched, it would keep waking us up
+                if (revents & POLLNVAL)
+                {
+                    _watches.erase(it);
+                    _watches_changed = true;
+                }
+            }
+            // Logged and dropped, the worker waits in a noexcept context
+            if (callback)
+            {
+                const auto fd = _pollfds[i].fd;
+                D2_SAFE_BLOCK_BEGIN
+                callback(fd, revents);
+                D2_SAFE_BLOCK_END
+            }
+        }
+    }
 
-        pollfd fds[2]{};
+    void UnixWorker::watch(int fd, short events, watch_callback callback)
+    {
+        {
+            std::unique_lock lock(_watch_mtx);
+            const auto it = std::find_if(
+                _watches.begin(), _watches.end(), [&](const Watch& w) { return w.fd == fd; }
+            );
+            Watch watch{
+                .id = ++_watch_id, .fd = fd, .events = events, .callback = std::move(callback)
+            };
+            if (it == _watches.end())
+                _watches.push_back(std::move(watch));
+            else
+                *it = std::move(watch);
+            _watches_changed = true;
+        }
+        if (_wake_write >= 0)
+            _wake();
+    }
+    void UnixWorker::unwatch(int fd)
+    {
+        {
+            std::unique_lock lock(_watch_mtx);
+            std::erase_if(_watches, [&](const Watch& w) { return w.fd == fd; });
+            _watches_changed = true;
+        }
+        if (_wake_write >= 0)
+            _wake();
+    }
 
-        fds[0].fd = STDIN_FILENO;
-        fds[0].events = POLLIN;
-        fds[1].fd = _wake_read;
-        fds[1].events = POLLIN;
+    void UnixWorker::wait(std::chrono::steady_clock::time_point deadline) noexcept
+    {
+        _process_tasks();
+        _rebuild_poll();
+        for (decltype(auto) it : _pollfds)
+            it.revents = 0;
 
         const auto timeout_ms = _poll(std::min(deadline, this->deadline()));
         {
             while (true)
             {
-                const auto rc = ::poll(fds, 2, timeout_ms);
+                const auto rc = ::poll(_pollfds.data(), _pollfds.size(), timeout_ms);
                 if (rc < 0)
                 {
                     if (errno == EINTR)
@@ -161,548 +250,989 @@ namespace d2::sys
             }
         }
 
-        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+        if (_pollfds[0].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
         {
             _drain();
             _process_tasks();
         }
+        _dispatch_watches();
         _tick();
     }
 
     //
-    // Input
+    // Probe
     //
 
-    void UnixTerminalInput::_enable_raw_mode()
+    void TerminalProbe::_finish()
     {
-        termios io;
-        tcgetattr(STDIN_FILENO, &_restore_termios);
-        io = _restore_termios;
-        io.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
-        io.c_iflag &= ~(IXON | ICRNL | BRKINT | INPCK | ISTRIP);
-        io.c_cflag |= CS8;
-        io.c_cc[VMIN] = 0;
-        io.c_cc[VTIME] = 0;
-        tcsetattr(STDIN_FILENO, TCSANOW, &io);
-        fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
-
-        std::cout << "\033[?25l"
-                  << "\033[?1003h" // any-motion tracking
-                  << "\033[?1006h" // SGR extended coordinates
-                  << std::flush;
+        using Colors = TerminalEncoder::Colors;
+        if (_rgb || _colors >= (1 << 24))
+            _caps.colors = Colors::TrueColor;
+        else if (_colors >= _palette_colors)
+            _caps.colors = Colors::Palette256;
+        else if (_colors > 0)
+            _caps.colors = Colors::Palette16;
+        _caps.probed = true;
+        _pending = false;
+        ++_generation;
     }
-    void UnixTerminalInput::_disable_raw_mode()
+
+    void TerminalProbe::begin()
     {
-        tcsetattr(STDIN_FILENO, TCSANOW, &_restore_termios);
-        std::cout << "\033[?1006l"
-                  << "\033[?1003l"
-                  << "\033[?25h" << std::flush;
+        // XTGETTCAP takes hex encoded capability names (RGB, Tc, colors, rep, bce)
+        // DA1 goes last, every terminal answers it and replies come in order
+        static constexpr auto query = std::string_view(
+            "\033[>q"
+            "\033[?2026$p"
+            "\033[?2004$p"
+            "\033[?1016$p"
+            "\033P+q524742\033\\"
+            "\033P+q5463\033\\"
+            "\033P+q636f6c6f7273\033\\"
+            "\033P+q726570\033\\"
+            "\033P+q626365\033\\"
+            "\033_Gi=31,s=1,v=1,a=q,t=d,f=24;AAAA\033\\"
+            "\033[?u"
+            "\033[>c"
+            "\033[c"
+        );
+
+        std::unique_lock lock(_mtx);
+        if (_pending)
+            return;
+
+        _caps = {};
+        _colors = 0;
+        _rgb = false;
+        if (const auto* env = std::getenv("COLORTERM"); env != nullptr)
+        {
+            const auto value = std::string_view(env);
+            _rgb = value == "truecolor" || value == "24bit";
+        }
+
+        std::size_t off = 0;
+        while (off < query.size())
+        {
+            const auto n = ::write(STDOUT_FILENO, query.data() + off, query.size() - off);
+            if (n > 0)
+            {
+                off += std::size_t(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            // Gives up (without answers) if the terminal does not drain in time
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                pollfd fd{.fd = STDOUT_FILENO, .events = POLLOUT, .revents = 0};
+                const auto rc = ::poll(&fd, 1, int(_timeout.count()));
+                if (rc > 0 || (rc == -1 && errno == EINTR))
+                    continue;
+            }
+            break;
+        }
+        if (off != query.size())
+        {
+            _finish();
+            return;
+        }
+        _deadline = std::chrono::steady_clock::now() + _timeout;
+        _pending = true;
     }
+    void TerminalProbe::expire()
+    {
+        if (!_pending)
+            return;
 
-    void UnixTerminalInput::_lock_frame_impl()
+        std::unique_lock lock(_mtx);
+        if (_pending && std::chrono::steady_clock::now() >= _deadline)
+        {
+            D2_LOG(Info, io, "Terminal did not answer the capability probe");
+            _finish();
+        }
+    }
+    bool TerminalProbe::pending() const
     {
-        _mtx.lock_shared();
+        return _pending;
     }
-    void UnixTerminalInput::_unlock_frame_impl()
+    std::chrono::steady_clock::time_point TerminalProbe::deadline() const
     {
-        _mtx.unlock_shared();
+        std::unique_lock lock(_mtx);
+        return _deadline;
     }
 
-    in::InputFrame::ptr UnixTerminalInput::_frame_impl()
+    std::size_t TerminalProbe::generation() const
     {
-        return _in;
+        return _generation;
     }
-
-    void UnixTerminalInput::_begincycle_impl()
+    TerminalCapabilities TerminalProbe::capabilities() const
     {
         std::unique_lock lock(_mtx);
+        return _caps;
+    }
 
-        auto frame = in::internal::InputFrameView::from(_in.get());
-        frame.swap();
+    void TerminalProbe::on_primary(std::span<const int> attributes)
+    {
+        std::unique_lock lock(_mtx);
+        if (!_pending)
+            return;
+        _caps.attributes.assign(attributes.begin(), attributes.end());
+        _caps.responsive = true;
+        _finish();
+    }
+    void TerminalProbe::on_secondary(std::span<const int> params)
+    {
+        std::unique_lock lock(_mtx);
+        if (!_pending)
+            return;
+        if (params.size() >= 1)
+            _caps.type = params[0];
+        if (params.size() >= 2)
+            _caps.version = params[1];
+    }
+    void TerminalProbe::on_mode(int mode, int value)
+    {
+        std::unique_lock lock(_mtx);
+        if (!_pending)
+            return;
 
-        // Update screen size
+        // 0 - not recognized, 1/2 - set/reset, 3/4 - permanently set/reset
+        const auto supported = value >= 1 && value <= 3;
+        switch (mode)
         {
-            struct winsize ws;
-            if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
-            {
-                frame.set_screen_size({0, 0});
-            }
-            else
-            {
-                frame.set_screen_size({ws.ws_col, ws.ws_row});
-            }
-            frame.set_screen_capacity(_in->screen_size());
+        case 2026:
+            _caps.synchronized = supported;
+            break;
+        case 2004:
+            _caps.bracketed_paste = supported;
+            break;
+        case 1016:
+            _caps.sgr_pixels = supported;
+            break;
         }
-        // Key input
+    }
+    void TerminalProbe::on_version(std::string_view name)
+    {
+        std::unique_lock lock(_mtx);
+        if (!_pending)
+            return;
+        _caps.name = name;
+    }
+    void TerminalProbe::on_termcap(bool known, std::string_view reply)
+    {
+        const auto decode = [](std::string_view hex)
         {
-            string text;
-
-            static std::string pending;
-            static bool esc_waiting = false;
-            static std::chrono::steady_clock::time_point esc_started{};
-
-            constexpr auto esc_delay = std::chrono::milliseconds{25};
-            const auto now = std::chrono::steady_clock::now();
-            const auto is_ready = []
+            std::string res;
+            res.reserve(hex.size() / 2);
+            for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
             {
-                fd_set fds;
-                FD_ZERO(&fds);
-                FD_SET(STDIN_FILENO, &fds);
-
-                timeval timeout{};
-                timeout.tv_sec = 0;
-                timeout.tv_usec = 0;
+                unsigned int ch = 0;
+                const auto r = std::from_chars(hex.data() + i, hex.data() + i + 2, ch, 16);
+                if (r.ec != std::errc{})
+                    return std::string();
+                res.push_back(static_cast<char>(ch));
+            }
+            return res;
+        };
 
-                const auto res = ::select(STDIN_FILENO + 1, &fds, nullptr, nullptr, &timeout);
-                return res > 0 && FD_ISSET(STDIN_FILENO, &fds);
-            };
-            const auto read_av = [&]
-            {
-                while (is_ready())
-                {
-                    char buf[128];
-                    const auto n = ::read(STDIN_FILENO, buf, sizeof(buf));
+        std::unique_lock lock(_mtx);
+        if (!_pending || !known)
+            return;
 
-                    if (n > 0)
-                    {
-                        pending.append(buf, static_cast<std::size_t>(n));
-                    }
-                    else if (n < 0 && errno == EINTR)
-                    {
-                        continue;
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
-            };
+        while (!reply.empty())
+        {
+            const auto off = reply.find(';');
+            const auto entry = reply.substr(0, off);
+            const auto eq = entry.find('=');
+            const auto name = decode(entry.substr(0, eq));
+            const auto value =
+                eq == std::string_view::npos ? std::string() : decode(entry.substr(eq + 1));
+
+            if (name == "RGB" || name == "Tc")
+                _rgb = true;
+            else if (name == "colors")
+                std::from_chars(value.data(), value.data() + value.size(), _colors);
+            else if (name == "rep")
+                _caps.repeat = true;
+            else if (name == "bce")
+                _caps.erase = true;
+
+            if (off == std::string_view::npos)
+                break;
+            reply.remove_prefix(off + 1);
+        }
+    }
+    void TerminalProbe::on_kitty(std::string_view reply)
+    {
+        std::unique_lock lock(_mtx);
+        if (!_pending)
+            return;
+        // Gi=31;OK, or an error message
+        if (reply.starts_with("Gi=31;"))
+            _caps.kitty_graphics = reply.substr(6) == "OK";
+    }
 
-            const auto is_csi_final = [](unsigned char ch) { return ch >= 0x40 && ch <= 0x7e; };
-            const auto parse_int = [](std::string_view sv, int& out)
-            {
-                if (sv.empty())
-                    return false;
+    void TerminalProbe::on_keyboard(int flags)
+    {
+        std::unique_lock lock(_mtx);
+        if (!_pending)
+            return;
+        // Answering only means the protocol is understood, ESC is only unambiguous (and needs
+        // no delay) with the disambiguate flag active
+        _caps.kitty_keyboard = (flags & 1) != 0;
+        _caps.keyboard_flags = flags;
+    }
 
-                const auto* first = sv.data();
-                const auto* last = sv.data() + sv.size();
+    //
+    // Mouse
+    //
 
-                const auto res = std::from_chars(first, last, out);
-                return res.ec == std::errc{} && res.ptr == last;
-            };
-            const auto parse_params = [&](std::string_view sv)
+    void MouseCoalescer::_apply(in::internal::InputFrameView& frame, const Event& ev)
+    {
+        frame.set_mouse_position(ev.position);
+        if (ev.shift)
+            frame.pulse(in::special::Shift);
+        if (ev.alt)
+            frame.pulse(in::special::LeftAlt);
+        if (ev.control)
+            frame.pulse(in::special::LeftControl);
+        switch (ev.type)
+        {
+        case Event::Type::Motion:
+            break;
+        case Event::Type::Wheel:
+            frame.add_scroll_delta(ev.delta);
+            break;
+        case Event::Type::Button:
+            frame.set(ev.button, ev.pressed);
+            _transition = true;
+            break;
+        }
+    }
+    bool MouseCoalescer::_push(const Event& ev)
+    {
+        // Merge with the last deferred report if possible
+        if (_size != 0)
+        {
+            auto& back = _queue[(_head + _size - 1) % _capacity];
+            // Reports with different modifiers are kept apart (e.g. Ctrl+wheel and wheel)
+            const auto mergeable = back.type == ev.type && back.shift == ev.shift &&
+                                   back.alt == ev.alt && back.control == ev.control;
+            if (mergeable && ev.type == Event::Type::Motion)
             {
-                std::vector<int> res;
-
-                while (true)
-                {
-                    const auto off = sv.find(';');
-                    const auto part = sv.substr(0, off);
+                back.position = ev.position;
+                return true;
+            }
+            if (mergeable && ev.type == Event::Type::Wheel)
+            {
+                back.position = ev.position;
+                back.delta += ev.delta;
+                return true;
+            }
+        }
+        if (_size == _capacity)
+            return false;
+        _queue[(_head + _size) % _capacity] = ev;
+        _size++;
+        return true;
+    }
 
-                    int value = 0;
-                    if (!part.empty())
-                        parse_int(part, value);
+    void MouseCoalescer::begin(in::internal::InputFrameView& frame)
+    {
+        _transition = false;
+        while (_size != 0)
+        {
+            const auto& ev = _queue[_head];
+            if (ev.type == Event::Type::Button && _transition)
+                break;
+            _apply(frame, ev);
+            _head = (_head + 1) % _capacity;
+            _size--;
+        }
+    }
+    void MouseCoalescer::submit(in::internal::InputFrameView& frame, const Event& ev)
+    {
+        // Whatever comes after a deferred report has to wait as well to keep the order
+        // If there is no more room the report goes through out of order rather than being lost
+        if (_size != 0 || (ev.type == Event::Type::Button && _transition))
+        {
+            if (_push(ev))
+                return;
+        }
+        _apply(frame, ev);
+    }
+    bool MouseCoalescer::pending() const
+    {
+        return _size != 0;
+    }
 
-                    res.push_back(value);
+    //
+    // Input
+    //
 
-                    if (off == std::string_view::npos)
-                        break;
+    namespace
+    {
+        // Translates parsed input into the frame
+        class InputHandler : public TerminalParser::Handler
+        {
+        private:
+            using Sequence = TerminalParser::Sequence;
 
-                    sv.remove_prefix(off + 1);
-                }
+            // Paste payload past this is dropped (the rest of the paste is still consumed)
+            static constexpr std::size_t _max_paste = 16 * 1024 * 1024;
 
-                if (res.size() == 1 && res[0] == 0 && sv.empty())
-                    res.clear();
+            in::internal::InputFrameView& _frame;
+            TerminalProbe& _probe;
+            MouseCoalescer& _mouse;
+            std::string& _paste;
 
-                return res;
-            };
-            const auto pulse_key = [&](char ch)
+            void _pulse_key(char ch)
             {
                 if (ch >= in::keymin() && ch <= in::keymax())
                 {
                     if (ch >= 'A' && ch <= 'Z')
-                        frame.pulse(in::special::Shift);
+                        _frame.pulse(in::special::Shift);
 
-                    frame.pulse(in::key(ch));
+                    _frame.pulse(in::key(ch));
                 }
-            };
-            const auto pulse_key_raw = [&](char ch)
+            }
+            void _pulse_key_raw(char ch)
             {
                 if (ch >= in::keymin() && ch <= in::keymax())
-                    frame.pulse(in::key(ch));
-            };
-            const auto pulse_control = [&](char ch)
+                    _frame.pulse(in::key(ch));
+            }
+            void _pulse_control(char ch)
             {
-                frame.pulse(in::special::LeftControl);
-                pulse_key_raw(ch);
-            };
-            const auto apply_csi_modifier = [&](int mod)
+                _frame.pulse(in::special::LeftControl);
+                _pulse_key_raw(ch);
+            }
+            void _modifier(int mod)
             {
                 if (mod <= 1)
                     return;
 
                 const auto bits = mod - 1;
                 if ((bits & 1) != 0)
-                    frame.pulse(in::special::Shift);
+                    _frame.pulse(in::special::Shift);
                 if ((bits & 2) != 0)
-                    frame.pulse(in::special::LeftAlt);
+                    _frame.pulse(in::special::LeftAlt);
                 if ((bits & 4) != 0)
-                    frame.pulse(in::special::LeftControl);
-            };
-            const auto pulse_fn_key = [&](int n) { frame.pulse(in::fn(n) + 1); };
-            const auto parse_sgr_mouse = [&](std::string_view body, char final)
+                    _frame.pulse(in::special::LeftControl);
+                if ((bits & 8) != 0)
+                    _frame.pulse(in::special::Super);
+            }
+            // Value of a ';' separated field, or of one of its ':' separated parts
+            static int _field(const Sequence& seq, std::size_t field, std::size_t sub, int def)
             {
-                if (body.empty() || body[0] != '<')
-                    return;
-
-                body.remove_prefix(1);
-
-                const auto off1 = body.find(';');
-                if (off1 == std::string_view::npos)
-                    return;
-
-                const auto off2 = body.find(';', off1 + 1);
-                if (off2 == std::string_view::npos)
-                    return;
-
-                int button = 0;
-                int x = 0;
-                int y = 0;
-
-                if (!parse_int(body.substr(0, off1), button))
-                    return;
-                if (!parse_int(body.substr(off1 + 1, off2 - off1 - 1), x))
-                    return;
-                if (!parse_int(body.substr(off2 + 1), y))
-                    return;
-
-                Position mpos{x - 1, y - 1};
-
-                const auto is_release = final == 'm';
-                const auto is_wheel = (button & 64) != 0;
-
-                if ((button & 4) != 0)
-                    frame.pulse(in::special::Shift);
-                if ((button & 8) != 0)
-                    frame.pulse(in::special::LeftAlt);
-                if ((button & 16) != 0)
-                    frame.pulse(in::special::LeftControl);
-
-                if (is_wheel)
+                std::size_t f = 0;
+                std::size_t s = 0;
+                for (std::size_t i = 0; i < seq.params.size(); i++)
                 {
-                    Position scroll_delta{0, 0};
-
-                    if ((button & 1) == 0)
-                        scroll_delta.y = 1;
-                    else
-                        scroll_delta.y = -1;
-
-                    frame.set_scroll_delta(scroll_delta);
-                }
-                else
-                {
-                    switch (button & 3)
+                    if (i != 0 && (seq.subparams & (std::uint32_t(1) << i)) != 0)
                     {
-                    case 0:
-                        is_release ? frame.set(in::mouse::Left, false) : frame.set(in::mouse::Left);
-                        break;
-                    case 1:
-                        is_release ? frame.set(in::mouse::Middle, false)
-                                   : frame.set(in::mouse::Middle);
-                        break;
-                    case 2:
-                        is_release ? frame.set(in::mouse::Right, false)
-                                   : frame.set(in::mouse::Right);
-                        break;
+                        s++;
+                    }
+                    else if (i != 0)
+                    {
+                        f++;
+                        s = 0;
                     }
+                    if (f > field)
+                        break;
+                    if (f == field && s == sub)
+                        return seq.params[i] == 0 ? def : seq.params[i];
                 }
-
-                frame.set_mouse_position(mpos);
-            };
-            const auto parse_csi = [&](std::string_view seq)
+                return def;
+            }
+            static in::keytype _fn_key(int n)
+            {
+                return in::fn(n) + 1;
+            }
+            // Keys shared by CSI and SS3
+            static std::optional<in::keytype> _cursor_key(char final)
             {
-                if (seq.size() < 3)
-                    return;
-
-                const auto final = seq.back();
-                const auto body = seq.substr(2, seq.size() - 3);
-
-                if ((final == 'M' || final == 'm') && !body.empty() && body[0] == '<')
-                {
-                    parse_sgr_mouse(body, final);
-                    return;
-                }
-                if (final == 'Z')
-                {
-                    frame.pulse(in::special::Shift);
-                    frame.pulse(in::special::Tab);
-                    return;
-                }
-
-                const auto params = parse_params(body);
-                if (params.size() >= 2)
-                    apply_csi_modifier(params[1]);
-
                 switch (final)
                 {
                 case 'A':
-                    frame.pulse(in::special::ArrowUp);
-                    break;
+                    return in::keytype(in::special::ArrowUp);
                 case 'B':
-                    frame.pulse(in::special::ArrowDown);
-                    break;
+                    return in::keytype(in::special::ArrowDown);
                 case 'C':
-                    frame.pulse(in::special::ArrowRight);
-                    break;
+                    return in::keytype(in::special::ArrowRight);
                 case 'D':
-                    frame.pulse(in::special::ArrowLeft);
-                    break;
+                    return in::keytype(in::special::ArrowLeft);
                 case 'H':
-                    frame.pulse(in::special::Home);
-                    break;
+                    return in::keytype(in::special::Home);
                 case 'F':
-                    frame.pulse(in::special::End);
-                    break;
+                    return in::keytype(in::special::End);
                 case 'P':
-                    pulse_fn_key(0);
-                    break;
                 case 'Q':
-                    pulse_fn_key(1);
-                    break;
                 case 'R':
-                    pulse_fn_key(2);
-                    break;
                 case 'S':
-                    pulse_fn_key(3);
-                    break;
-
-                case '~':
-                {
-                    if (params.empty())
-                        break;
-                    switch (params[0])
-                    {
-                    case 1:
-                    case 7:
-                        frame.pulse(in::special::Home);
-                        break;
-                    case 4:
-                    case 8:
-                        frame.pulse(in::special::End);
-                        break;
-                    case 3:
-                        frame.pulse(in::special::Delete);
-                        break;
-                    case 15:
-                        pulse_fn_key(4);
-                        break;
-                    case 17:
-                        pulse_fn_key(5);
-                        break;
-                    case 18:
-                        pulse_fn_key(6);
-                        break;
-                    case 19:
-                        pulse_fn_key(7);
-                        break;
-                    case 20:
-                        pulse_fn_key(8);
-                        break;
-                    case 21:
-                        pulse_fn_key(9);
-                        break;
-                    case 23:
-                        pulse_fn_key(10);
-                        break;
-                    case 24:
-                        pulse_fn_key(11);
-                        break;
-                    }
-                    break;
+                    return _fn_key(final - 'P');
                 }
+                return std::nullopt;
+            }
+            static std::optional<in::keytype> _tilde_key(int code)
+            {
+                switch (code)
+                {
+                case 1:
+                case 7:
+                    return in::keytype(in::special::Home);
+                case 4:
+                case 8:
+                    return in::keytype(in::special::End);
+                case 2:
+                    return in::keytype(in::special::Insert);
+                case 3:
+                    return in::keytype(in::special::Delete);
+                case 5:
+                    return in::keytype(in::special::PgUp);
+                case 6:
+                    return in::keytype(in::special::PgDown);
+                case 11:
+                case 12:
+                case 13:
+                case 14:
+                case 15:
+                    return _fn_key(code - 11);
+                case 17:
+                case 18:
+                case 19:
+                case 20:
+                case 21:
+                    return _fn_key(code - 12);
+                case 23:
+                case 24:
+                    return _fn_key(code - 13);
                 }
-            };
-            const auto parse_ss3 = [&](std::string_view seq)
+                return std::nullopt;
+            }
+            // Kitty CSI u key codes, the unshifted codepoint or a private use one
+            static std::optional<in::keytype> _kitty_key(int code)
             {
-                if (seq.size() < 3)
+                switch (code)
+                {
+                case 27:
+                    return in::keytype(in::special::Escape);
+                case 13:
+                case 57414: // KP_ENTER
+                    return in::keytype(in::special::Enter);
+                case 9:
+                    return in::keytype(in::special::Tab);
+                case 8:
+                case 127:
+                    return in::keytype(in::special::Backspace);
+                case 57409: // KP_DECIMAL
+                    return in::key('.');
+                case 57410: // KP_DIVIDE
+                    return in::key('/');
+                case 57411: // KP_MULTIPLY
+                    return in::key('*');
+                case 57412: // KP_SUBTRACT
+                    return in::key('-');
+                case 57413: // KP_ADD
+                    return in::key('+');
+                case 57415: // KP_EQUAL
+                    return in::key('=');
+                }
+                if (code >= in::keymin() && code <= in::keymax())
+                    return in::key(static_cast<char>(code));
+                if (code >= 57399 && code <= 57408) // KP_0 - KP_9
+                    return in::key(static_cast<char>('0' + (code - 57399)));
+                if (code >= 57376 && code <= 57387) // F13 - F24
+                    return _fn_key(12 + (code - 57376));
+                return std::nullopt;
+            }
+            // Press (1), repeat (2) or release (3), only the kitty protocol reports the latter two
+            // Elements treat a held key as input on every cycle, so presses and repeats stay
+            // pulses (as with legacy autorepeat) and releases are dropped
+            void _key_event(in::keytype key, int mods, int event)
+            {
+                if (event == 3)
+                    return;
+                _modifier(mods);
+                _frame.pulse(key);
+            }
+            void _sgr_mouse(const Sequence& seq)
+            {
+                using Type = MouseCoalescer::Event::Type;
+                if (seq.params.size() != 3)
                     return;
 
-                const auto final = seq.back();
-                const auto body = seq.substr(2, seq.size() - 3);
-                const auto params = parse_params(body);
-
-                if (params.size() >= 2)
-                    apply_csi_modifier(params[1]);
-                switch (final)
+                const auto button = seq.params[0];
+                const auto is_release = seq.final == 'm';
+                const auto is_wheel = (button & 64) != 0;
+                const auto is_motion = (button & 32) != 0;
+
+                MouseCoalescer::Event ev{
+                    .position = {seq.params[1] - 1, seq.params[2] - 1},
+                    .shift = (button & 4) != 0,
+                    .alt = (button & 8) != 0,
+                    .control = (button & 16) != 0,
+                };
+                if (is_wheel)
                 {
-                case 'A':
-                    frame.pulse(in::special::ArrowUp);
-                    break;
-                case 'B':
-                    frame.pulse(in::special::ArrowDown);
-                    break;
-                case 'C':
-                    frame.pulse(in::special::ArrowRight);
-                    break;
-                case 'D':
-                    frame.pulse(in::special::ArrowLeft);
-                    break;
-                case 'H':
-                    frame.pulse(in::special::Home);
-                    break;
-                case 'F':
-                    frame.pulse(in::special::End);
-                    break;
-                case 'P':
-                    pulse_fn_key(0);
-                    break;
-                case 'Q':
-                    pulse_fn_key(1);
-                    break;
-                case 'R':
-                    pulse_fn_key(2);
-                    break;
-                case 'S':
-                    pulse_fn_key(3);
-                    break;
+                    ev.type = Type::Wheel;
+                    ev.delta = {0, (button & 1) == 0 ? 1 : -1};
                 }
-            };
-            const auto should_wait_for_escape = [&]
-            {
-                if (!esc_waiting)
+                else if (is_motion || (button & 3) == 3)
                 {
-                    esc_waiting = true;
-                    esc_started = now;
-                    return true;
+                    ev.type = Type::Motion;
                 }
-                return now - esc_started < esc_delay;
-            };
-
-            read_av();
-
-            std::size_t pos = 0;
-            while (pos < pending.size())
+                else
+                {
+                    static constexpr in::mouse buttons[] = {
+                        in::mouse::Left, in::mouse::Middle, in::mouse::Right
+                    };
+                    ev.type = Type::Button;
+                    ev.button = buttons[button & 3];
+                    ev.pressed = !is_release;
+                }
+                _mouse.submit(_frame, ev);
+            }
+            void _csi(const Sequence& seq)
             {
-                const auto ch = static_cast<unsigned char>(pending[pos]);
-
-                // Enter
-                if (ch == '\n' || ch == '\r')
+                // Replies to the capability probe (DA1, DA2, DECRPM)
+                if (seq.final == 'c' && seq.prefix == '?')
                 {
-                    frame.pulse(in::special::Enter);
-                    pos++;
+                    _probe.on_primary(seq.params);
+                    return;
                 }
-                // Tabulator exterminans
-                else if (ch == '\t')
+                if (seq.final == 'c' && seq.prefix == '>')
                 {
-                    frame.pulse(in::special::Tab);
-                    pos++;
+                    _probe.on_secondary(seq.params);
+                    return;
                 }
-                // Backspace
-                else if (ch == 127 || ch == '\b')
+                if (seq.final == 'y' && seq.prefix == '?' && seq.intermediates == "$")
                 {
-                    frame.pulse(in::special::Backspace);
-                    pos++;
+                    if (seq.params.size() == 2)
+                        _probe.on_mode(seq.params[0], seq.params[1]);
+                    return;
                 }
-                // Escape / sequences
-                else if (ch == '\x1b')
+                if (seq.final == 'u' && seq.prefix == '?')
                 {
-                    if (pos + 1 >= pending.size())
-                    {
-                        if (should_wait_for_escape())
-                            break;
+                    _probe.on_keyboard(seq.param(0));
+                    return;
+                }
+                if ((seq.final == 'M' || seq.final == 'm') && seq.prefix == '<')
+                {
+                    _sgr_mouse(seq);
+                    return;
+                }
+                if (seq.prefix != 0 || !seq.intermediates.empty())
+                    return;
+                if (seq.final == 'Z')
+                {
+                    _frame.pulse(in::special::Shift);
+                    _frame.pulse(in::special::Tab);
+                    return;
+                }
+                // Bracketed paste start/end, the payload comes through on_paste
+                if (seq.final == '~' && seq.params.size() == 1 &&
+                    (seq.params[0] == 200 || seq.params[0] == 201))
+                {
+                    if (seq.params[0] == 200)
+                        _paste.clear();
+                    else
+                        _end_paste();
+                    return;
+                }
 
-                        frame.pulse(in::special::Escape);
-                        esc_waiting = false;
-                        pos++;
-                        continue;
+                // CSI code ; mods:event [; text] final
+                const auto code = _field(seq, 0, 0, 1);
+                std::optional<in::keytype> key;
+                if (seq.final == 'u')
+                    key = _kitty_key(code);
+                else if (seq.final == '~' && !seq.params.empty())
+                    key = _tilde_key(code);
+                else if (seq.final == '~')
+                    return;
+                else
+                    key = _cursor_key(seq.final);
+                if (key)
+                    _key_event(*key, _field(seq, 1, 0, 1), _field(seq, 1, 1, 1));
+            }
+            void _end_paste()
+            {
+                // Terminals send line breaks as CR
+                std::size_t out = 0;
+                for (std::size_t i = 0; i < _paste.size(); i++)
+                {
+                    if (_paste[i] == '\r')
+                    {
+                        _paste[out++] = '\n';
+                        if (i + 1 < _paste.size() && _paste[i + 1] == '\n')
+                            i++;
                     }
-                    esc_waiting = false;
-
-                    const auto next = pending[pos + 1];
-                    if (next == '[')
+                    else
                     {
-                        std::size_t end = pos + 2;
-                        while (end < pending.size() &&
-                               !is_csi_final(static_cast<unsigned char>(pending[end])))
-                        {
-                            end++;
-                        }
-                        if (end >= pending.size())
-                        {
-                            if (should_wait_for_escape())
-                                break;
-
-                            frame.pulse(in::special::Escape);
-                            esc_waiting = false;
-                            pos++;
-                            continue;
-                        }
-                        parse_csi(std::string_view{pending.data() + pos, end - pos + 1});
-                        pos = end + 1;
+                        _paste[out++] = _paste[i];
                     }
-                    else if (next == 'O')
+                }
+                _paste.resize(out);
+                _frame.set_paste(std::exchange(_paste, {}));
+            }
+            void _dcs(const Sequence& seq)
+            {
+                if (seq.prefix == '>' && seq.final == '|')
+                    _probe.on_version(seq.data);
+                else if (seq.intermediates == "+" && seq.final == 'r')
+                    _probe.on_termcap(seq.param(0) == 1, seq.data);
+            }
+        public:
+            InputHandler(
+                in::internal::InputFrameView& frame,
+                TerminalProbe& probe,
+                MouseCoalescer& mouse,
+                std::string& paste
+            ) : _frame(frame), _probe(probe), _mouse(mouse), _paste(paste)
+            {
+            }
+
+            virtual void on_text(std::string_view text) override
+            {
+                for (decltype(auto) ch : text)
+                    _pulse_key(ch);
+                _frame.append_text(text);
+            }
+            virtual void on_control(unsigned char ch) override
+            {
+                switch (ch)
+                {
+                case '\n':
+                case '\r':
+                    _frame.pulse(in::special::Enter);
+                    break;
+                case '\t':
+                    _frame.pulse(in::special::Tab);
+                    break;
+                case 127:
+                case '\b':
+                    _frame.pulse(in::special::Backspace);
+                    break;
+                case '\x1b':
+                    _frame.pulse(in::special::Escape);
+                    break;
+                case 0:
+                    // Ctrl+@ / Ctrl+Space
+                    _frame.pulse(in::special::LeftControl);
+                    _pulse_key_raw(' ');
+                    break;
+                default:
+                    if (ch >= 1 && ch <= 26)
                     {
-                        std::size_t end = pos + 2;
-                        while (end < pending.size() &&
-                               !is_csi_final(static_cast<unsigned char>(pending[end])))
-                        {
-                            end++;
-                        }
-                        if (end >= pending.size())
-                        {
-                            if (should_wait_for_escape())
-                                break;
-
-                            frame.pulse(in::special::Escape);
-                            esc_waiting = false;
-                            pos++;
-                            continue;
-                        }
-                        parse_ss3(std::string_view{pending.data() + pos, end - pos + 1});
-                        pos = end + 1;
+                        _pulse_control(static_cast<char>('A' + (ch - 1)));
                     }
-                    else
+                    else if (ch >= 28 && ch <= 31)
                     {
-                        frame.pulse(in::special::LeftAlt);
-                        pulse_key(next);
-                        pos += 2;
+                        // Ctrl+\, Ctrl+], Ctrl+^, Ctrl+_
+                        static constexpr char ctrl_map[] = {'\\', ']', '^', '_'};
+                        _pulse_control(ctrl_map[ch - 28]);
                     }
+                    break;
                 }
-                // Control
-                else if (ch >= 1 && ch <= 26)
+            }
+            virtual void on_sequence(const Sequence& seq) override
+            {
+                switch (seq.kind)
                 {
-                    const auto res = static_cast<char>('A' + (ch - 1));
-                    pulse_control(res);
-                    pos++;
+                case Sequence::Kind::Esc:
+                    if (seq.intermediates.empty())
+                    {
+                        _frame.pulse(in::special::LeftAlt);
+                        _pulse_key(seq.final);
+                    }
+                    else if (seq.intermediates.size() == 1)
+                    {
+                        // Terminals do not send ESC sequences with intermediates as input,
+                        // this is Alt+key (e.g. Alt+Space) with the next key in the same read
+                        _frame.pulse(in::special::LeftAlt);
+                        _pulse_key(seq.intermediates[0]);
+                        _pulse_key(seq.final);
+                    }
+                    break;
+                case Sequence::Kind::Csi:
+                    _csi(seq);
+                    break;
+                case Sequence::Kind::Ss3:
+                    if (const auto key = _cursor_key(seq.final); key)
+                        _key_event(*key, _field(seq, 1, 0, 1), 1);
+                    break;
+                case Sequence::Kind::Dcs:
+                    _dcs(seq);
+                    break;
+                case Sequence::Kind::Apc:
+                    _probe.on_kitty(seq.data);
+                    break;
+                case Sequence::Kind::Osc:
+                    break;
                 }
-                else if (ch == 0)
+            }
+            virtual void on_paste(std::string_view data) override
+            {
+                if (_paste.size() + data.size() > _max_paste)
                 {
-                    // Ctrl+@ / Ctrl+Space
-                    frame.pulse(in::special::LeftControl);
-                    pulse_key_raw(' ');
-                    pos++;
+                    if (_paste.size() < _max_paste)
+                        D2_LOG(Warning, io, "Paste exceeds ", _max_paste, "B, truncating");
+                    data = data.substr(0, _max_paste - std::min(_paste.size(), _max_paste));
                 }
-                else if (ch >= 28 && ch <= 31)
+                _paste.append(data);
+            }
+        };
+    } // namespace
+
+#ifdef __linux__
+    namespace
+    {
+        // Inputs which blocked SIGWINCH for their signalfd (it was not blocked before)
+        std::atomic<std::size_t> resize_blocked{0};
+
+        // Forked children (and what they exec) would otherwise start with SIGWINCH blocked
+        // Not run for posix_spawn/vfork, which have to reset the mask themselves
+        void unblock_resize_in_child()
+        {
+            if (resize_blocked.load(std::memory_order::relaxed) == 0)
+                return;
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGWINCH);
+            pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+        }
+    } // namespace
+#endif
+
+    void UnixTerminalInput::_enable_raw_mode()
+    {
+        termios io;
+        tcgetattr(STDIN_FILENO, &_restore_termios);
+        io = _restore_termios;
+        io.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+        io.c_iflag &= ~(IXON | ICRNL | BRKINT | INPCK | ISTRIP);
+        io.c_cflag |= CS8;
+        io.c_cc[VMIN] = 0;
+        io.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &io);
+        fcntl(STDIN_FILENO, F_SETFL, O_NONBLOCK);
+
+        std::cout << "\033[?25l"
+                  << "\033[?1003h" // any-motion tracking
+                  << "\033[?1006h" // SGR extended coordinates
+                  << "\033[?2004h" // bracketed paste
+                  << "\033[>1u"    // kitty keyboard, disambiguate escape codes
+                  << std::flush;
+    }
+    void UnixTerminalInput::_disable_raw_mode()
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &_restore_termios);
+        std::cout << "\033[<u"
+                  << "\033[?2004l"
+                  << "\033[?1006l"
+                  << "\033[?1003l"
+                  << "\033[?25h" << std::flush;
+    }
+
+    void UnixTerminalInput::_enable_resize_signal()
+    {
+#ifdef __linux__
+        // The signal has to be blocked in every thread for the signalfd to receive it
+        // Workers are started after the input is loaded and inherit the mask of this thread,
+        // threads started earlier do not (see UnixTerminalInput)
+        static std::once_flag atfork;
+        std::call_once(atfork, []() { pthread_atfork(nullptr, nullptr, unblock_resize_in_child); });
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGWINCH);
+        if (pthread_sigmask(SIG_BLOCK, &mask, &_restore_sigmask) != 0)
+            return;
+        _resize_fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (_resize_fd < 0)
+        {
+            D2_TLOG(Warning, "Failed to create a signalfd for SIGWINCH, polling the size");
+            pthread_sigmask(SIG_SETMASK, &_restore_sigmask, nullptr);
+        }
+        else if (!sigismember(&_restore_sigmask, SIGWINCH))
+            resize_blocked.fetch_add(1, std::memory_order::relaxed);
+#endif
+        // Without a signalfd the size is queried every cycle
+    }
+    void UnixTerminalInput::_disable_resize_signal()
+    {
+#ifdef __linux__
+        if (_resize_fd < 0)
+            return;
+        if (auto worker = _worker.lock(); worker != nullptr)
+            worker->unwatch(_resize_fd);
+        ::close(_resize_fd);
+        _resize_fd = -1;
+        if (!sigismember(&_restore_sigmask, SIGWINCH))
+            resize_blocked.fetch_sub(1, std::memory_order::relaxed);
+        pthread_sigmask(SIG_SETMASK, &_restore_sigmask, nullptr);
+#endif
+    }
+    bool UnixTerminalInput::_drain_resize_signal()
+    {
+        bool fired = false;
+#ifdef __linux__
+        signalfd_siginfo info;
+        while (true)
+        {
+            const auto n = ::read(_resize_fd, &info, sizeof(info));
+            if (n == sizeof(info))
+                fired = true;
+            else if (n < 0 && errno == EINTR)
+                continue;
+            else
+                break;
+        }
+#endif
+        return fired;
+    }
+    void UnixTerminalInput::_update_screen_size(in::internal::InputFrameView& frame)
+    {
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
+        {
+            frame.set_screen_size({0, 0});
+        }
+        else
+        {
+            frame.set_screen_size({ws.ws_col, ws.ws_row});
+        }
+        frame.set_screen_capacity(_in->screen_size());
+    }
+
+    void UnixTerminalInput::_lock_frame_impl()
+    {
+        _mtx.lock_shared();
+    }
+    void UnixTerminalInput::_unlock_frame_impl()
+    {
+        _mtx.unlock_shared();
+    }
+
+    in::InputFrame::ptr UnixTerminalInput::_frame_impl()
+    {
+        return _in;
+    }
+
+    void UnixTerminalInput::_begincycle_impl()
+    {
+        std::unique_lock lock(_mtx);
+
+        auto frame = in::internal::InputFrameView::from(_in.get());
+        frame.swap();
+
+        // Update screen size
+        if (_resize_fd < 0 || !_size_known)
+        {
+            _update_screen_size(frame);
+            _size_known = true;
+        }
+        else
+        {
+            // Dragging a window sends a stream of signals, the layout is only redone once it
+            // settles (or every so often while it does not)
+            const auto now = std::chrono::steady_clock::now();
+            if (_drain_resize_signal())
+            {
+                if (_resize_first == std::chrono::steady_clock::time_point{})
+                    _resize_first = now;
+                _resize_last = now;
+            }
+            if (_resize_first != std::chrono::steady_clock::time_point{})
+            {
+                if (now - _resize_last >= _resize_quiet ||
+                    now - _resize_first >= _resize_max_delay)
                 {
-                    // Ctrl+\, Ctrl+], Ctrl+^, Ctrl+_
-                    static constexpr char ctrl_map[] = {'\\', ']', '^', '_'};
-                    pulse_control(ctrl_map[ch - 28]);
-                    pos++;
+                    _update_screen_size(frame);
+                    _resize_first = {};
                 }
-                // Normal keys :(
                 else
                 {
-                    const auto c = static_cast<char>(ch);
-                    // Sequence
-                    text.push_back(c);
-                    // Key
-                    pulse_key(c);
-                    pos++;
+                    context()->deadline(
+                        std::min(_resize_last + _resize_quiet, _resize_first + _resize_max_delay)
+                    );
+                }
+            }
+        }
+        // Key input
+        {
+            constexpr auto esc_delay = std::chrono::milliseconds{25};
+            const auto now = std::chrono::steady_clock::now();
+
+            // Make sure that the probe is given up on even if nothing else wakes us up
+            auto& probe = *_probe;
+            probe.expire();
+            if (probe.pending())
+                context()->deadline(probe.deadline());
+            if (const auto gen = probe.generation(); gen != _probe_generation)
+            {
+                _probe_generation = gen;
+                _kitty_keyboard = probe.capabilities().kitty_keyboard;
+            }
+
+            // Strings stay enabled once the probe is over, so that late replies are swallowed
+            // rather than read as Alt+P/Alt+_ (a lone ESC P etc. is still Alt+key on flush)
+            InputHandler handler(frame, probe, _mouse, _paste);
+            _mouse.begin(frame);
+
+            // The descriptor is non blocking, read until it runs dry
+            // Input is timestamped as it is read for measuring the latency (see SystemOutput)
+            bool received = false;
+            while (true)
+            {
+                const auto n = ::read(STDIN_FILENO, _input.data(), _input.size());
+                if (n > 0)
+                {
+                    if (!received)
+                        frame.set_input_time(std::chrono::steady_clock::now());
+                    received = true;
+                    _parser.feed({_input.data(), static_cast<std::size_t>(n)}, handler);
+                    if (static_cast<std::size_t>(n) < _input.size())
+                        break;
                 }
+                else if (n < 0 && errno == EINTR)
+                    continue;
+                else
+                    break;
             }
-            pending.erase(0, pos);
 
-            frame.set_text(std::move(text));
+            // A lone ESC (or a sequence cut short) is a key press if nothing follows it
+            // Strings are waited for while the probe is still going
+            // With the kitty protocol the Escape key is a sequence of its own, so whatever is
+            // pending should be completed by the input that follows
+            // A paste (or anything waited for) is given much longer, but one that never
+            // completes is ended with what arrived so far rather than holding the input back
+            if (!_parser.idle())
+            {
+                const auto pasting = _parser.in_paste();
+                const auto waiting =
+                    !pasting && (_kitty_keyboard || (_parser.in_string() && probe.pending()));
+                const auto delay = (pasting || waiting) ? _paste_timeout : esc_delay;
+                if (received)
+                    _input_started = now;
+                else if (now - _input_started >= delay)
+                {
+                    if (pasting)
+                    {
+                        D2_LOG(Warning, io, "Bracketed paste was not terminated, ending it");
+                    }
+                    else if (waiting)
+                    {
+                        D2_LOG(Warning, io, "Input sequence was not completed, ending it");
+                    }
+                    if (_parser.flush(handler))
+                        frame.set_input_time(_input_started);
+                }
+                if (!_parser.idle())
+                    context()->deadline(_input_started + delay);
+            }
+            // Deferred button transitions go out with the next cycle right away
+            if (_mouse.pending())
+                context()->deadline(std::chrono::milliseconds(0));
         }
     }
     void UnixTerminalInput::_endcycle_impl() {}
@@ -710,17 +1240,40 @@ namespace d2::sys
     UnixTerminalInput::Status UnixTerminalInput::_load_impl()
     {
         _enable_raw_mode();
+        _enable_resize_signal();
+        _probe->begin();
         return Status::Ok;
     }
     UnixTerminalInput::Status UnixTerminalInput::_unload_impl()
     {
+        _disable_resize_signal();
         _disable_raw_mode();
+        _size_known = false;
         return Status::Ok;
     }
 
     MainWorker::ptr UnixTerminalInput::_worker_impl()
     {
-        return mt::Worker::make<UnixWorker>();
+        // Input is read at the beginning of the cycle, readiness only has to wake the loop up
+        auto worker = mt::Worker::make<UnixWorker>();
+        worker->watch(STDIN_FILENO, POLLIN);
+        if (_resize_fd >= 0)
+            worker->watch(_resize_fd, POLLIN);
+        _worker = worker;
+        return worker;
+    }
+    std::shared_ptr<UnixWorker> UnixTerminalInput::main_worker() const
+    {
+        return _worker.lock();
+    }
+
+    std::shared_ptr<TerminalProbe> UnixTerminalInput::probe() const
+    {
+        return _probe;
+    }
+    UnixTerminalInput::Compat UnixTerminalInput::compatible()
+    {
+        return Compat::Native;
     }
 
     //
@@ -739,23 +1292,10 @@ namespace d2::sys
         seq += "\x1b_G";
         seq += payload;
         seq += "\x1b\\";
-        ::write(STDOUT_FILENO, seq.data(), seq.size());
-    }
-    void UnixTerminalOutput::_kitty_write_id(std::uint32_t id)
-    {
-        auto sp = [](std::string_view str) -> std::span<const unsigned char>
-        { return std::span(reinterpret_cast<const unsigned char*>(str.data()), str.size()); };
-
-        const auto c1 = sp("\x1b_Ga=p,i=");
-        const auto c3 = sp(",q=2\x1b\\");
 
-        std::array<char, 10> id_out;
-        const auto [end, _] = std::to_chars(id_out.data(), id_out.data() + id_out.size(), id);
-        const auto c2 = sp(std::string_view(id_out.data(), end));
-
-        _out.insert(_out.end(), c1.begin(), c1.end());
-        _out.insert(_out.end(), c2.begin(), c2.end());
-        _out.insert(_out.end(), c3.begin(), c3.end());
+        // Shares the terminal with the writer thread
+        std::unique_lock lock(mtx_);
+        ::write(STDOUT_FILENO, seq.data(), seq.size());
     }
     std::optional<std::string> _make_shm(const void* data, std::size_t len)
     {
@@ -801,154 +1341,342 @@ namespace d2::sys
         return std::nullopt;
     }
 
-    UnixTerminalOutput::position_type
-    UnixTerminalOutput::_generate_position(int x, int y, bool skip)
+    bool UnixTerminalOutput::_present_frame()
     {
-        using buffer = std::array<char, _max_pos_len>;
-
-        if (skip)
-            return std::make_pair(buffer(), 0);
+        const auto sync = _present == Present::Synchronized;
+
+        std::array<iovec, 3> iov{};
+        std::size_t cnt = 0;
+        if (sync)
+            iov[cnt++] = {const_cast<char*>(_sync_begin_code.data()), _sync_begin_code.size()};
+        iov[cnt++] = {_out.data(), _out.size()};
+        if (sync)
+            iov[cnt++] = {const_cast<char*>(_sync_end_code.data()), _sync_end_code.size()};
+
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < cnt; i++)
+            size += iov[i].iov_len;
+        _buffer_size = size;
+
+        // The whole frame is submitted at once, if the tty is full we sleep until it drains
+        std::size_t idx = 0;
+        bool begun = false;
+        while (idx < cnt)
+        {
+            const auto written = ::writev(STDOUT_FILENO, iov.data() + idx, int(cnt - idx));
+            _frame_syscalls++;
 
-        buffer result{"\x1b["};
+            if (written > 0)
+            {
+                begun = true;
+                auto rem = static_cast<std::size_t>(written);
+                while (idx < cnt && rem >= iov[idx].iov_len)
+                    rem -= iov[idx++].iov_len;
+                if (idx < cnt)
+                {
+                    iov[idx].iov_base = static_cast<char*>(iov[idx].iov_base) + rem;
+                    iov[idx].iov_len -= rem;
+                }
+                continue;
+            }
 
-        const auto [ptr1, _1] = std::to_chars(result.begin() + 2, result.end(), y + 1);
-        const auto [ptr2, _2] = std::to_chars(ptr1 + 1, result.end(), x + 1);
+            if (written == -1 && errno == EINTR)
+                continue;
 
-        *ptr1 = ';';
-        *ptr2 = 'H';
+            if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                pollfd fd{.fd = STDOUT_FILENO, .events = POLLOUT, .revents = 0};
+                const auto rc = ::poll(&fd, 1, int(_drain_timeout.count()));
+                _frame_syscalls++;
+                _frame_blocked = true;
+                if (rc > 0 || (rc == -1 && errno == EINTR))
+                    continue;
+            }
 
-        return std::make_pair(result, int(ptr2 - result.begin() + 1));
+            // The terminal would hold the update until its own timeout otherwise
+            if (sync && begun)
+                _abort_sync();
+            return false;
+        }
+        return true;
     }
-    UnixTerminalOutput::color_type UnixTerminalOutput::_generate_color(const pixel& px, bool force)
+    void UnixTerminalOutput::_abort_sync()
     {
-        using buffer = std::array<char, _max_color_len>;
-
-        constexpr std::array<const char*, 7> style_on = {"1", "4", "3", "9", "5", "7", "8"};
-        constexpr std::array<const char*, 7> style_off = {"22", "24", "23", "29", "25", "27", "28"};
-        constexpr auto style_code = std::string_view("\033[");
-        constexpr auto bg_code = std::string_view("48;2;");
-        constexpr auto fg_code = std::string_view("38;2;");
-
-        // Preds
-
-        const auto do_background = force || px.r != _track_background.r ||
-                                   px.g != _track_background.g || px.b != _track_background.b;
-        const auto do_foreground = force || px.rf != _track_foreground.r ||
-                                   px.gf != _track_foreground.g || px.bf != _track_foreground.b;
-
-        if (px.style == _track_style && !do_background && !do_foreground)
-            return std::make_pair(buffer(), 0);
-
-        buffer code{"\033["};
-
-        // Styles
-
-        buffer::iterator ptr = code.begin() + style_code.size();
-        if (force || px.style != _track_style)
+        auto rem = _sync_abort_code;
+        while (!rem.empty())
         {
-            for (std::size_t i = 0; i < 7; i++)
+            const auto written = ::write(STDOUT_FILENO, rem.data(), rem.size());
+            _frame_syscalls++;
+            if (written > 0)
+            {
+                rem.remove_prefix(std::size_t(written));
+                continue;
+            }
+            if (written == -1 && errno == EINTR)
+                continue;
+            if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                pollfd fd{.fd = STDOUT_FILENO, .events = POLLOUT, .revents = 0};
+                const auto rc = ::poll(&fd, 1, int(_drain_timeout.count()));
+                _frame_syscalls++;
+                if (rc > 0 || (rc == -1 && errno == EINTR))
+                    continue;
+            }
+            return;
+        }
+    }
+
+    UnixTerminalOutput::Status UnixTerminalOutput::_load_impl()
+    {
+        // Bands of large frames are encoded on the pool, the calling thread takes the first one
+        _encoder.set_executor(
+            [ctx = std::weak_ptr(context())](
+                std::size_t count, const std::function<void(std::size_t)>& callback
+            )
             {
-                const auto ns = px::style(std::uint8_t(px.style) & (1 << i));
-                const auto ps = px::style(std::uint8_t(_track_style) & (1 << i));
-                if (ns != ps)
+                const auto lock = ctx.lock();
+                std::vector<mt::future<void>> tasks;
+                if (lock != nullptr)
                 {
-                    if (bool(ns))
-                    {
-                        *(ptr++) = style_on[i][0];
-                    }
+                    const auto scheduler = lock->scheduler();
+                    tasks.reserve(count - 1);
+                    for (std::size_t i = 1; i < count; i++)
+                        tasks.push_back(scheduler->launch([&callback, i]() { callback(i); }));
+                }
+                else
+                {
+                    for (std::size_t i = 1; i < count; i++)
+                        callback(i);
+                }
+                callback(0);
+                // Every band has to finish before anything is rethrown, they all use the frame
+                // The main thread is a pool worker whose tasks only run while it waits for them
+                const auto done = [](const mt::future<void>& task)
+                { return task.has_value() || task.has_exception() || task.is_discarded(); };
+                if (lock != nullptr && lock->is_synced())
+                    lock->wait_until(
+                        [&]() { return std::all_of(tasks.begin(), tasks.end(), done); }
+                    );
+                else
+                    for (decltype(auto) it : tasks)
+                        it.sync_value();
+                // Bands the pool dropped (while stopping) are encoded here
+                for (std::size_t i = 0; i < tasks.size(); i++)
+                {
+                    if (tasks[i].is_discarded())
+                        callback(i + 1);
                     else
-                    {
-                        *(ptr++) = style_off[i][0];
-                        *(ptr++) = style_off[i][1];
-                    }
-                    *(ptr++) = ';';
+                        tasks[i].value();
                 }
             }
-            _track_style = px.style;
-        }
-
-        if (!(do_foreground || do_background))
-            *ptr = 'm';
+        );
+        return Status::Ok;
+    }
 
-        // Background
-        buffer::iterator ptrbe = ptr;
-        if (do_background)
-        {
-            const auto ptrb = std::copy(bg_code.begin(), bg_code.end(), ptrbe);
+    UnixTerminalOutput::Compat UnixTerminalOutput::compatible()
+    {
+        return Compat::Native;
+    }
 
-            const auto [ptr1b, _1b] = std::to_chars(ptrb, code.end(), px.r);
-            const auto [ptr2b, _2b] = std::to_chars(ptr1b + 1, code.end(), px.g);
-            const auto [ptr3b, _3b] = std::to_chars(ptr2b + 1, code.end(), px.b);
+    void UnixTerminalOutput::set_present_mode(Present mode)
+    {
+        _autoconfig = false;
+        _present = mode;
+    }
+    UnixTerminalOutput::Present UnixTerminalOutput::present_mode() const
+    {
+        return _present;
+    }
 
-            *ptr1b = ';';
-            *ptr2b = ';';
-            *ptr3b = do_foreground ? ';' : 'm';
+    void UnixTerminalOutput::_adapt_colors(std::chrono::microseconds elapsed)
+    {
+        // Only frames which filled up the tty say anything about the link
+        if (_color_mode != ColorMode::Auto || !_frame_blocked)
+            return;
 
-            ptrbe = ptr3b + 1;
+        const auto us = std::max<std::chrono::microseconds::rep>(elapsed.count(), 1);
+        const auto rate = double(_buffer_size) * 1'000'000.0 / double(us);
+        _drain_rate = _drain_blocked ? _drain_rate * 0.75 + rate * 0.25 : rate;
+        if (++_drain_blocked < _drain_samples)
+            return;
 
-            _track_background.r = px.r;
-            _track_background.g = px.g;
-            _track_background.b = px.b;
-        }
+        using Colors = TerminalEncoder::Colors;
+        auto opts = _encoder.options();
+        const auto current = opts.colors;
+        if (current == Colors::TrueColor && _drain_rate < _truecolor_rate)
+            opts.colors = Colors::Palette256;
+        else if (current == Colors::Palette256 && _drain_rate < _palette_rate)
+            opts.colors = Colors::Palette16;
 
-        // Foreground
-        buffer::iterator ptrfe = ptrbe;
-        if (do_foreground)
+        if (opts.colors != current)
         {
-            const auto ptrf = std::copy(fg_code.begin(), fg_code.end(), ptrfe);
-
-            const auto [ptr1f, _1f] = std::to_chars(ptrf, code.end(), px.rf);
-            const auto [ptr2f, _2f] = std::to_chars(ptr1f + 1, code.end(), px.gf);
-            const auto [ptr3f, _3f] = std::to_chars(ptr2f + 1, code.end(), px.bf);
-
-            *ptr1f = ';';
-            *ptr2f = ';';
-            *ptr3f = 'm';
-
-            ptrfe = ptr3f;
-
-            _track_foreground.r = px.rf;
-            _track_foreground.g = px.gf;
-            _track_foreground.b = px.bf;
+            D2_TLOG(Info, "Reducing color depth, drain rate: ", std::size_t(_drain_rate), "B/s");
+            _encoder.set_options(opts);
+            _drain_blocked = 0;
         }
-
-        return std::make_pair(code, int(ptrfe - code.begin() + 1));
     }
 
-    void UnixTerminalOutput::_push(const pixel& px)
+    void UnixTerminalOutput::_pace(std::size_t written)
     {
-        if (px.v == '\t')
+        if (!_pacing)
         {
-            _out.push_back(' ');
+            _budget = std::chrono::microseconds(0);
             return;
         }
 
-#if D2_LOCALE_MODE == UNICODE
-        if (global_extended_code_page.is_extended(px.v))
+        int queued = 0;
+        if (::ioctl(STDOUT_FILENO, TIOCOUTQ, &queued) == -1 || queued < 0)
+        {
+            _budget = std::chrono::microseconds(0);
+            return;
+        }
+
+        // The queue only says something about the link while it is non empty, an empty queue
+        // could have drained at any point since the last sample
+        const auto now = std::chrono::steady_clock::now();
+        const auto pending = std::size_t(queued);
+        if (_pace_queued != 0 && pending != 0)
+        {
+            const auto elapsed = std::chrono::duration<double>(now - _pace_last).count();
+            const auto submitted = _pace_queued + written;
+            if (elapsed > 0.0 && submitted > pending)
+            {
+                const auto rate = double(submitted - pending) / elapsed;
+                _throughput = _throughput == 0.0 ? rate : _throughput * 0.75 + rate * 0.25;
+            }
+        }
+        _pace_queued = pending;
+        _pace_last = now;
+
+        // Saturated - wait for roughly what is queued to drain before the next frame
+        // Otherwise ramp back up by halving the budget every frame
+        const auto budget = _budget.load();
+        if (pending > _pace_slack && _throughput > 0.0)
         {
-            const auto ext = global_extended_code_page.read(px.v);
-            _out.insert(_out.end(), ext.begin(), ext.end());
+            const auto drain = std::chrono::microseconds(
+                std::chrono::microseconds::rep(double(pending) * 1'000'000.0 / _throughput)
+            );
+            _budget = std::min(drain, _max_budget);
         }
+        else if (budget.count() > 1000)
+            _budget = budget / 2;
         else
+            _budget = std::chrono::microseconds(0);
+    }
+
+    void UnixTerminalOutput::set_pacing(bool value)
+    {
+        _pacing = value;
+    }
+    bool UnixTerminalOutput::pacing() const
+    {
+        return _pacing;
+    }
+
+    void UnixTerminalOutput::set_color_mode(ColorMode mode)
+    {
+        using Colors = TerminalEncoder::Colors;
+
+        std::unique_lock lock(mtx_);
+        auto opts = _encoder.options();
+        switch (mode)
         {
-            _out.push_back(px.v);
+        case ColorMode::Auto:
+        case ColorMode::TrueColor:
+            opts.colors = Colors::TrueColor;
+            break;
+        case ColorMode::Palette256:
+            opts.colors = Colors::Palette256;
+            break;
+        case ColorMode::Palette16:
+            opts.colors = Colors::Palette16;
+            break;
         }
-#else
-        out_.push_back(px.v);
-#endif
+        _color_mode = mode;
+        _drain_rate = 0.0;
+        _drain_blocked = 0;
+        _encoder.set_options(opts);
+    }
+    UnixTerminalOutput::ColorMode UnixTerminalOutput::color_mode()
+    {
+        std::unique_lock lock(mtx_);
+        return _color_mode;
     }
-    int UnixTerminalOutput::_write(std::span<const unsigned char> buffer)
+
+    void UnixTerminalOutput::set_encoder_options(TerminalEncoder::Options opts)
     {
-        return ::write(STDOUT_FILENO, buffer.data(), buffer.size());
+        std::unique_lock lock(mtx_);
+        _autoconfig = false;
+        _encoder.set_options(opts);
     }
-    int UnixTerminalOutput::_write(std::span<const char> buffer)
+    TerminalEncoder::Options UnixTerminalOutput::encoder_options()
     {
-        return ::write(STDOUT_FILENO, buffer.data(), buffer.size());
+        std::unique_lock lock(mtx_);
+        return _encoder.options();
     }
 
-    std::chrono::microseconds UnixTerminalOutput::frame_time() const
+    void UnixTerminalOutput::_resolve_probe()
     {
-        return _frame_time;
+        if (_probe_resolved)
+            return;
+        _probe_resolved = true;
+
+        // Only a terminal input is probed, with any other input the defaults are kept
+        const auto input = context()->sys_if<sys::SystemInput>();
+        if (input == nullptr)
+            return;
+        if (const auto terminal = std::dynamic_pointer_cast<UnixTerminalInput>(input.ptr());
+            terminal != nullptr)
+        {
+            std::unique_lock lock(mtx_);
+            _probe = terminal->probe();
+        }
+    }
+    void UnixTerminalOutput::_apply_capabilities()
+    {
+        if (_probe == nullptr)
+            return;
+
+        auto& probe = *_probe;
+        const auto generation = probe.generation();
+        if (generation == _caps_generation)
+            return;
+        _caps_generation = generation;
+
+        // Nothing was reported, keep the defaults
+        const auto caps = probe.capabilities();
+        if (!_autoconfig || !caps.responsive)
+            return;
+
+        auto opts = _encoder.options();
+        opts.repeat = caps.repeat;
+        opts.erase = caps.erase;
+        if (_color_mode == ColorMode::Auto)
+        {
+            opts.colors = caps.colors;
+            _drain_rate = 0.0;
+            _drain_blocked = 0;
+        }
+        _encoder.set_options(opts);
+        _present = caps.synchronized ? Present::Synchronized : Present::Direct;
+
+        D2_TLOG(
+            Info,
+            "Terminal capabilities: ",
+            caps.name.empty() ? std::string("unknown") : caps.name,
+            ", synchronized: ",
+            caps.synchronized,
+            ", repeat: ",
+            caps.repeat,
+            ", erase: ",
+            caps.erase,
+            ", kitty graphics: ",
+            caps.kitty_graphics
+        );
+    }
+    TerminalCapabilities UnixTerminalOutput::capabilities() const
+    {
+        return _probe == nullptr ? TerminalCapabilities{} : _probe->capabilities();
     }
 
     void UnixTerminalOutput::_release_image(std::any data)
@@ -958,9 +1686,21 @@ namespace d2::sys
 
     void UnixTerminalOutput::load_image(const std::string& path, ImageInstance img)
     {
+        _resolve_probe();
         if (images_.contains(path))
             release_image(path);
 
+        // The image is still tracked so that it can be laid out, but nothing is streamed to a
+        // terminal that said it cannot show it
+        if (const auto caps = capabilities(); caps.responsive && !caps.kitty_graphics)
+        {
+            images_.emplace(
+                path,
+                KittyImageState{.id = _kitty_id(), .width = img.width(), .height = img.height()}
+            );
+            return;
+        }
+
         const auto fmt = static_cast<Format>(img.format());
         const auto bytes = img.read();
         if (bytes.empty())
@@ -1009,213 +1749,170 @@ namespace d2::sys
         return std::any_cast<KittyImageState&>(images_.at(path)).id;
     }
 
-    void
-    UnixTerminalOutput::write(std::span<const pixel> buffer, std::size_t width, std::size_t height)
+    void UnixTerminalOutput::_output(
+        std::span<const pixel> buffer,
+        std::size_t width,
+        std::size_t height,
+        std::chrono::steady_clock::time_point input
+    )
     {
-        std::unique_lock lock(mtx_);
-
         const auto beg = std::chrono::high_resolution_clock::now();
 
-        _track_style = px::style::None;
-        _track_foreground = px::foreground(255, 255, 255);
-        _track_background = px::background(0, 0, 0);
-
-        _out.reserve((buffer.size()) * sizeof(value_type) + (height + 1) + _max_color_len * 2);
-
-        const auto compressed = PixelBuffer::rle_pack(buffer);
-
-        // Move to zero
-        {
-            const auto [pos, plen] = _generate_position(0, 0, false);
-            _write(std::span<const char>(pos.data(), plen));
-        }
-
-        // Clean redraw
-        if (buffer.size() != _pbuffer_size)
+        _apply_capabilities();
+        _frame_syscalls = 0;
+        _frame_blocked = false;
+        if (_encoder.encode(_out, buffer, width, height))
         {
-            std::size_t x = 0;
-            std::size_t y = 0;
-            _out.insert(_out.end(), _cls_code.begin(), _cls_code.end());
-            for (auto it = buffer.begin(); it != buffer.end();)
+            // If the frame was cut short the terminal holds a partial image
+            // so the next one has to be a clean redraw
+            const auto present = std::chrono::high_resolution_clock::now();
+            if (_present_frame())
             {
-                const auto& px = *it;
-                const auto [code, len] = _generate_color(px);
-
-                auto sit = it;
-                while (sit != buffer.end() && px.compare_colors(*sit))
-                    ++sit;
-
-                const auto abs_start = it - buffer.begin();
-                const auto abs_end = sit - buffer.begin();
-                const auto edls = (abs_end - abs_start) / width;
-
-                _out.reserve(_out.size() + len + ((sit - it) * sizeof(value_type)) + edls);
-                _out.insert(_out.end(), code.begin(), code.begin() + len);
-
-                while (it != sit)
-                {
-                    const auto abs = it - buffer.begin();
-                    if (abs && !(abs % width) && abs != abs_start)
-                    {
-                        _out.push_back('\n');
-                        y++;
-                        x = 0;
-                    }
-                    else
-                        x++;
-
-                    // Image support
-                    [[unlikely]] if (it->v == image_constant.v)
-                    {
-                        // Explicitly move cursor
-                        const auto [pos, plen] = _generate_position(x + 1, y + 1, false);
-                        _out.insert(_out.end(), pos.begin(), pos.begin() + plen);
-                        ++it;
-                        // Get ID
-                        std::uint32_t id = 0;
-                        id |= static_cast<std::uint32_t>(it->v);
-                        ++it;
-                        id |= (static_cast<std::uint32_t>(it->v) << 1) & 0xF0;
-                        ++it;
-                        id |= (static_cast<std::uint32_t>(it->v) << 2) & 0xF00;
-                        ++it;
-                        id |= (static_cast<std::uint32_t>(it->v) << 3) & 0xF000;
-                        ++it;
-                        _kitty_write_id(id);
-                        for (std::size_t i = 0; i < 5; i++)
-                            _push({});
-                    }
-                    else
-                    {
-                        _push(*it);
-                        ++it;
-                    }
-                }
-
-                if (sit == buffer.end())
-                    break;
+                _encoder.commit();
+                _record_input(input);
             }
+            else
+                _encoder.invalidate();
+            _adapt_colors(
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::high_resolution_clock::now() - present
+                )
+            );
         }
         else
         {
-            bool sequential = false;
-            bool linear = false;
-            PixelBuffer::RleIterator pv_it(_swapframe);
-            for (auto it = buffer.begin(); it != buffer.end();)
-            {
-                if (const auto& px = *it; px != pv_it.value())
-                {
-                    const auto idx = it - buffer.begin();
-                    const auto x = idx % width;
-                    const auto y = idx / width;
-                    const auto [pos, plen] = _generate_position(x, y, linear && sequential);
-                    const auto [code, len] = _generate_color(px, !sequential);
-
-                    auto sit = it;
-                    while (sit != buffer.end() && *sit != pv_it.value() && px.compare_colors(*sit))
-                    {
-                        pv_it.increment();
-                        ++sit;
-                    }
-
-                    const auto end = sit - buffer.begin();
-                    const auto edls = (end - idx) / width;
+            _buffer_size = 0;
+        }
+        _pace(_buffer_size);
+        _out.clear();
+        _swapframe_size = _encoder.swapframe_size();
+        _reference_size = _encoder.reference_size();
 
-                    _out.reserve(
-                        _out.size() + len + plen + ((sit - it) * sizeof(value_type)) + edls
-                    );
-                    _out.insert(_out.end(), pos.begin(), pos.begin() + plen);
-                    _out.insert(_out.end(), code.begin(), code.begin() + len);
+        _frame_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::high_resolution_clock::now() - beg
+        );
+    }
 
-                    linear = true;
-                    sequential = true;
-                    while (it != sit)
+    void UnixTerminalOutput::_submit(
+        std::span<const pixel> buffer, std::size_t width, std::size_t height
+    )
+    {
+        if (!_writer.joinable())
+            _start_writer();
+
+        auto& slot = _slots[_back];
+        slot.frame.assign(buffer.begin(), buffer.end());
+        slot.width = width;
+        slot.height = height;
+        slot.submitted = std::chrono::steady_clock::now();
+        slot.input = _take_input();
+        if (_dropped_input != std::chrono::steady_clock::time_point{} &&
+            (slot.input == std::chrono::steady_clock::time_point{} || _dropped_input < slot.input))
+            slot.input = _dropped_input;
+        _dropped_input = {};
+
+        // The previous frame was never picked up by the writer
+        const auto prev = _latest.exchange(_back | _slot_fresh, std::memory_order::acq_rel);
+        if (prev & _slot_fresh)
+        {
+            _dropped.fetch_add(1, std::memory_order::relaxed);
+            _dropped_input = _slots[prev & _slot_mask].input;
+        }
+        _back = prev & _slot_mask;
+        _latest.notify_one();
+    }
+    void UnixTerminalOutput::_start_writer()
+    {
+        _latest = 0;
+        _back = 1;
+        _front = 2;
+        {
+            // Extended glyphs live in the code page of the thread that composes the frames
+            std::unique_lock lock(mtx_);
+#if D2_LOCALE_MODE == UNICODE
+            _encoder.set_code_page(&global_extended_code_page);
+#endif
+        }
+        _writer = context()->launch_thread(
+            [this](std::stop_token stop)
+            {
+                std::stop_callback callback(
+                    stop,
+                    [this]()
                     {
-                        const auto abs = it - buffer.begin();
-                        if (abs && !(abs % width) && abs != idx)
-                        {
-                            linear = false;
-                            _out.push_back('\n');
-                        }
-                        // Image support
-                        [[unlikely]] if (it->v == image_constant.v)
-                        {
-                            // Explicitly move cursor
-                            const auto [pos, plen] = _generate_position(x + 1, y + 1, false);
-                            _out.insert(_out.end(), pos.begin(), pos.begin() + plen);
-                            ++it;
-                            // Get ID
-                            std::uint32_t id = 0;
-                            id |= static_cast<std::uint32_t>(it->v);
-                            ++it;
-                            id |= (static_cast<std::uint32_t>(it->v) << 1) & 0xF0;
-                            ++it;
-                            id |= (static_cast<std::uint32_t>(it->v) << 2) & 0xF00;
-                            ++it;
-                            id |= (static_cast<std::uint32_t>(it->v) << 3) & 0xF000;
-                            ++it;
-                            _kitty_write_id(id);
-                            for (std::size_t i = 0; i < 5; i++)
-                                _push({});
-                        }
-                        else
-                        {
-                            _push(*it);
-                            ++it;
-                        }
+                        _latest.fetch_or(_slot_stop, std::memory_order::release);
+                        _latest.notify_one();
                     }
-                    if (sit == buffer.end())
-                        break;
-                }
-                else
-                {
-                    const auto abs = it - buffer.begin();
-                    linear = !(abs && !(abs % width));
-                    sequential = false;
-                    pv_it.increment();
-                    ++it;
-                }
+                );
+                _write_loop();
             }
+        );
+        D2_TLOG(Info, "Started output writer thread");
+    }
+    void UnixTerminalOutput::_stop_writer()
+    {
+        if (_writer.joinable())
+        {
+            _writer.request_stop();
+            _writer.join();
+            D2_TLOG(Info, "Stopped output writer thread");
         }
-
-        if (!_out.empty())
+    }
+    void UnixTerminalOutput::_write_loop()
+    {
+        while (true)
         {
-            constexpr std::size_t chunk = 1024;
-            for (std::size_t idx = 0; idx < _out.size();)
+            auto state = _latest.load(std::memory_order::acquire);
+            if (!(state & (_slot_fresh | _slot_stop)))
             {
-                const auto size = std::min(chunk, _out.size() - idx);
-                std::size_t off = 0;
-                while (off < size)
-                {
-                    const auto written = _write({_out.data() + idx + off, size - off});
-
-                    if (written > 0)
-                    {
-                        off += static_cast<std::size_t>(written);
-                        continue;
-                    }
-
-                    if (written == -1 && errno == EINTR)
-                        continue;
-
-                    if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
-                        continue;
-
-                    break;
-                }
-                idx += size;
+                _latest.wait(state, std::memory_order::acquire);
+                continue;
             }
+            if (state & _slot_fresh)
+            {
+                while (!_latest.compare_exchange_weak(
+                    state,
+                    std::uint8_t(_front | (state & _slot_stop)),
+                    std::memory_order::acq_rel,
+                    std::memory_order::acquire
+                ));
+                _front = state & _slot_mask;
+
+                const auto& slot = _slots[_front];
+                std::unique_lock lock(mtx_);
+                _output(slot.frame, slot.width, slot.height, slot.input);
+                _latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - slot.submitted
+                );
+            }
+            if (state & _slot_stop)
+                return;
+        }
+    }
+
+    void UnixTerminalOutput::set_dispatch_mode(Dispatch mode)
+    {
+        _dispatch = mode;
+    }
+    UnixTerminalOutput::Dispatch UnixTerminalOutput::dispatch_mode() const
+    {
+        return _dispatch;
+    }
 
-            _pbuffer_size = width * height;
-            _swapframe.clear();
-            _swapframe.insert(_swapframe.end(), compressed.begin(), compressed.end());
+    void
+    UnixTerminalOutput::write(std::span<const pixel> buffer, std::size_t width, std::size_t height)
+    {
+        _resolve_probe();
+        if (_dispatch == Dispatch::Threaded)
+        {
+            _submit(buffer, width, height);
+            return;
         }
-        _buffer_size = _out.size();
-        _out.clear();
+        _stop_writer();
 
-        _frame_time = std::chrono::duration_cast<std::chrono::microseconds>(
-            std::chrono::high_resolution_clock::now() - beg
-        );
+        std::unique_lock lock(mtx_);
+        _output(buffer, width, height, _take_input());
+        _latency = _frame_time.load();
     }
 
     std::size_t UnixTerminalOutput::delta_size()
@@ -1224,6 +1921,30 @@ namespace d2::sys
     }
     std::size_t UnixTerminalOutput::swapframe_size()
     {
-        return _swapframe.size();
+        return _swapframe_size;
+    }
+    std::size_t UnixTerminalOutput::reference_size()
+    {
+        return _reference_size;
+    }
+    std::size_t UnixTerminalOutput::syscall_count()
+    {
+        return _frame_syscalls;
+    }
+    std::chrono::microseconds UnixTerminalOutput::frame_time()
+    {
+        return _frame_time;
+    }
+    std::size_t UnixTerminalOutput::dropped_frames()
+    {
+        return _dropped;
+    }
+    std::chrono::microseconds UnixTerminalOutput::encode_latency()
+    {
+        return _latency;
+    }
+    std::chrono::microseconds UnixTerminalOutput::frame_budget()
+    {
+        return _budget;
     }
 } // namespace d2::sys
@@ -1,11 +1,23 @@
 #pragma once
 
 #include <any>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <functional>
+#include <mutex>
 #include <shared_mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <core/io/d2_module.hpp>
 #include <core/mods/d2_core.hpp>
 #include <core/platform/d2_locale.hpp>
+#include <core/platform/d2_terminal_encoder.hpp>
+#include <core/platform/d2_terminal_parser.hpp>
 
 #include <fcntl.h>
 #include <poll.h>
@@ -16,6 +28,18 @@ namespace d2::sys
 {
     class UnixWorker : public MainWorker
     {
+        D2_TAG_MODULE(io)
+    public:
+        // Runs on the main thread once the descriptor is ready, before the tick
+        using watch_callback = std::function<void(int fd, short revents)>;
+    private:
+        struct Watch
+        {
+            std::size_t id{0};
+            int fd{-1};
+            short events{0};
+            watch_callback callback{};
+        };
     protected:
         virtual bool _is_current_thread_impl() const noexcept override;
         virtual bool _try_accept_impl(mt::Task& task) noexcept override;
@@ -29,6 +53,14 @@ namespace d2::sys
         mt::TaskRing<mt::Task, 16> _tasks{};
         int _wake_read{-1};
         int _wake_write{-1};
+
+        // Watches are registered from any thread, the poll set is rebuilt by the main thread
+        std::mutex _watch_mtx{};
+        std::vector<Watch> _watches{};
+        std::size_t _watch_id{0};
+        bool _watches_changed{false};
+        std::vector<pollfd> _pollfds{};
+        std::vector<std::size_t> _polled{};
     private:
         static void _closefd(int& fd) noexcept;
         static int _poll(std::chrono::steady_clock::time_point deadline) noexcept;
@@ -36,21 +68,181 @@ namespace d2::sys
         void _wake() noexcept;
         void _drain() noexcept;
         void _process_tasks();
+        void _rebuild_poll();
+        void _dispatch_watches();
     public:
+        // Polls the descriptor along with the worker, readiness wakes up the main loop
+        // Watching a descriptor again replaces the previous watch, the callback may be empty
+        void watch(int fd, short events, watch_callback callback = nullptr);
+        void unwatch(int fd);
+
         virtual void wait(std::chrono::steady_clock::time_point deadline) noexcept override;
     };
 
+    // Features reported by the terminal
+    // Until the probe is done (or if the terminal does not answer) everything is left at the
+    // conservative defaults
+    struct TerminalCapabilities
+    {
+        // The probe completed, either every reply arrived or it timed out
+        bool probed{false};
+        // The terminal answered DA1, otherwise nothing below was reported
+        bool responsive{false};
+        // DECRQM 2026 / 2004 / 1016
+        bool synchronized{false};
+        bool bracketed_paste{false};
+        bool sgr_pixels{false};
+        // XTGETTCAP rep / bce
+        bool repeat{false};
+        bool erase{false};
+        // Kitty graphics query
+        bool kitty_graphics{false};
+        // Kitty keyboard protocol (CSI ? u) with disambiguated escape codes, and the flags that
+        // were active
+        bool kitty_keyboard{false};
+        int keyboard_flags{0};
+        // XTGETTCAP RGB/Tc/colors, or COLORTERM
+        TerminalEncoder::Colors colors{TerminalEncoder::Colors::TrueColor};
+        // XTVERSION
+        std::string name{};
+        // DA1 attributes, DA2 terminal type and version
+        std::vector<int> attributes{};
+        int type{0};
+        int version{0};
+    };
+
+    // Sends the capability queries and collects the replies
+    // The input sends the probe on load and feeds it the replies as it parses them, the probe is
+    // finished by the reply to DA1 (which every terminal answers and answers last) or a timeout
+    // Owned by the input of the terminal it probes, the output of the same context shares it
+    class TerminalProbe
+    {
+    private:
+        static constexpr auto _timeout = std::chrono::milliseconds(500);
+        // Reported by XTGETTCAP for the 256 color palette
+        static constexpr auto _palette_colors = 256;
+    private:
+        mutable std::mutex _mtx{};
+        TerminalCapabilities _caps{};
+        std::chrono::steady_clock::time_point _deadline{};
+        std::atomic<bool> _pending{false};
+        std::atomic<std::size_t> _generation{0};
+        int _colors{0};
+        bool _rgb{false};
+
+        void _finish();
+    public:
+        void begin();
+        // Ends the probe if the terminal did not answer in time
+        void expire();
+        bool pending() const;
+        std::chrono::steady_clock::time_point deadline() const;
+
+        // Incremented every time the probe finishes
+        std::size_t generation() const;
+        TerminalCapabilities capabilities() const;
+
+        void on_primary(std::span<const int> attributes);
+        void on_secondary(std::span<const int> params);
+        void on_mode(int mode, int value);
+        void on_version(std::string_view name);
+        // Capabilities (<name>[=<value>];...) if known, both hex encoded
+        void on_termcap(bool known, std::string_view reply);
+        void on_kitty(std::string_view reply);
+        void on_keyboard(int flags);
+    };
+
+    // Collapses mouse reports received within a cycle
+    // Motion keeps the latest position and wheel reports add up, but only a single button
+    // transition is applied per cycle, everything after it waits (in order) for the next one
+    class MouseCoalescer
+    {
+    public:
+        struct Event
+        {
+            enum class Type : std::uint8_t
+            {
+                Motion,
+                Wheel,
+                Button,
+            };
+
+            Type type{Type::Motion};
+            in::mouse button{in::mouse::Left};
+            bool pressed{false};
+            Position position{0, 0};
+            Position delta{0, 0};
+            // Held with the report, pulsed with the cycle it is applied in
+            bool shift{false};
+            bool alt{false};
+            bool control{false};
+        };
+    private:
+        static constexpr std::size_t _capacity = 64;
+
+        std::array<Event, _capacity> _queue{};
+        std::size_t _head{0};
+        std::size_t _size{0};
+        bool _transition{false};
+
+        void _apply(in::internal::InputFrameView& frame, const Event& ev);
+        bool _push(const Event& ev);
+    public:
+        // Applies what was deferred during the previous cycles
+        void begin(in::internal::InputFrameView& frame);
+        void submit(in::internal::InputFrameView& frame, const Event& ev);
+        // Some reports have to wait for the next cycle
+        bool pending() const;
+    };
+
     class UnixTerminalInput : public SystemInput,
                               public ModuleImpl<UnixTerminalInput, Load::Immediate>
     {
+    private:
+        static constexpr auto _input_buffer_size = 4096;
+        // A burst of SIGWINCH is handled once it goes quiet, or at this rate while it lasts
+        static constexpr auto _resize_quiet = std::chrono::milliseconds(25);
+        static constexpr auto _resize_max_delay = std::chrono::milliseconds(100);
+        // A bracketed paste that goes quiet for this long without its terminator is ended,
+        // as is a sequence that is otherwise waited for (kitty keyboard, probe replies)
+        static constexpr auto _paste_timeout = std::chrono::milliseconds(1000);
     private:
         std::shared_mutex _mtx{};
         in::InputFrame::ptr _in{in::InputFrame::make()};
 
         termios _restore_termios{};
 
+        TerminalParser _parser{};
+        std::array<char, _input_buffer_size> _input{};
+        // Last time input came while a sequence was incomplete
+        std::chrono::steady_clock::time_point _input_started{};
+        std::weak_ptr<UnixWorker> _worker{};
+        MouseCoalescer _mouse{};
+        // Bracketed paste being received, handed to the frame as a whole once it ends
+        std::string _paste{};
+
+        // SIGWINCH through a signalfd (Linux), the size is only queried after it fires
+        // Elsewhere, or if the descriptor could not be created, it is queried every cycle
+        // The signal is blocked in the loading thread, threads started before the input was
+        // loaded have to block it too or they may take it and the resize is only seen with
+        // the next one; forked children get it unblocked again, posix_spawn callers have to
+        // reset the mask (posix_spawnattr_setsigmask) themselves
+        int _resize_fd{-1};
+        sigset_t _restore_sigmask{};
+        std::chrono::steady_clock::time_point _resize_first{};
+        std::chrono::steady_clock::time_point _resize_last{};
+        bool _size_known{false};
+        // Keys are reported unambiguously (kitty keyboard protocol), ESC needs no delay
+        bool _kitty_keyboard{false};
+        std::shared_ptr<TerminalProbe> _probe{std::make_shared<TerminalProbe>()};
+        std::size_t _probe_generation{0};
+
         void _enable_raw_mode();
         void _disable_raw_mode();
+        void _enable_resize_signal();
+        void _disable_resize_signal();
+        bool _drain_resize_signal();
+        void _update_screen_size(in::internal::InputFrameView& frame);
     protected:
         virtual void _lock_frame_impl() override;
         virtual void _unlock_frame_impl() override;
@@ -66,16 +258,59 @@ namespace d2::sys
         virtual MainWorker::ptr _worker_impl() override;
     public:
         using SystemInput::SystemInput;
+
+        static Compat compatible();
+
+        // Worker driving the main loop (see UnixWorker::watch), null until the context starts
+        std::shared_ptr<UnixWorker> main_worker() const;
+        // Capabilities of the terminal this input reads from
+        std::shared_ptr<TerminalProbe> probe() const;
     };
     class UnixTerminalOutput : public SystemOutput,
                                public ModuleImpl<UnixTerminalOutput, Load::Immediate>
     {
+    public:
+        // Direct - frame is written as is
+        // Synchronized - frame is wrapped in DEC mode 2026 (begin/end synchronized update) so
+        // that the terminal presents it atomically
+        enum class Present
+        {
+            Direct,
+            Synchronized,
+        };
+        // Auto - starts in truecolor and steps down to a palette if the terminal drains slowly
+        enum class ColorMode
+        {
+            Auto,
+            TrueColor,
+            Palette256,
+            Palette16,
+        };
+        // Inline - frames are encoded and written by the thread that submits them
+        // Threaded - frames are handed off to a writer thread which always presents the newest
+        // one, frames submitted while the terminal is busy replace each other
+        enum class Dispatch
+        {
+            Inline,
+            Threaded,
+        };
     private:
-        static constexpr auto _max_color_len =
-            std::string_view("\033[RX;RX;RX;RX;RX;RX;RX;m").size() +
-            (std::string_view("38;2;255;255;255").size() * 2);
-        static constexpr auto _max_pos_len = std::string_view("\x1b[XXXX;XXXXH").size();
-        static constexpr auto _cls_code = std::string_view("\033[H");
+        static constexpr auto _sync_begin_code = std::string_view("\033[?2026h");
+        static constexpr auto _sync_end_code = std::string_view("\033[?2026l");
+        // Written after a frame that was cut short, CAN aborts the sequence it was cut in
+        static constexpr auto _sync_abort_code = std::string_view("\030\033[?2026l");
+        static constexpr auto _drain_timeout = std::chrono::milliseconds(1000);
+        // Drain rates (bytes/s) under which the automatic color mode steps down
+        static constexpr auto _truecolor_rate = 256.0 * 1024.0;
+        static constexpr auto _palette_rate = 64.0 * 1024.0;
+        static constexpr auto _drain_samples = 4;
+        // Pacing - below this many queued bytes the terminal is considered to keep up
+        static constexpr auto _pace_slack = std::size_t(4096);
+        static constexpr auto _max_budget = std::chrono::microseconds(500'000);
+        // Triple buffer state, the low bits hold the index of the latest slot
+        static constexpr std::uint8_t _slot_mask = 0b0011;
+        static constexpr std::uint8_t _slot_fresh = 0b0100;
+        static constexpr std::uint8_t _slot_stop = 0b1000;
     private:
         struct KittyImageState
         {
@@ -83,41 +318,83 @@ namespace d2::sys
             std::size_t width{0};
             std::size_t height{0};
         };
-        using position_type =
-            std::pair<std::array<char, UnixTerminalOutput::_max_pos_len>, std::size_t>;
-        using color_type =
-            std::pair<std::array<char, UnixTerminalOutput::_max_color_len>, std::size_t>;
+        struct FrameSlot
+        {
+            std::vector<pixel> frame{};
+            std::size_t width{0};
+            std::size_t height{0};
+            std::chrono::steady_clock::time_point submitted{};
+            // Earliest input the frame reflects
+            std::chrono::steady_clock::time_point input{};
+        };
     private:
-        std::chrono::microseconds _frame_time{0};
+        std::atomic<std::chrono::microseconds> _frame_time{};
+        std::atomic<std::chrono::microseconds> _latency{};
+        std::atomic<std::size_t> _frame_syscalls{0};
+        std::atomic<std::size_t> _dropped{0};
+        std::atomic<std::chrono::microseconds> _budget{};
+        std::atomic<bool> _pacing{true};
+        // Options follow the probed capabilities until they are set explicitly
+        std::atomic<bool> _autoconfig{true};
+        // Probe of the terminal input of the same context, looked up by the first write
+        std::shared_ptr<TerminalProbe> _probe{};
+        bool _probe_resolved{false};
+        std::size_t _caps_generation{0};
+        std::chrono::steady_clock::time_point _pace_last{};
+        std::size_t _pace_queued{0};
+        double _throughput{0.0};
+        std::atomic<Present> _present{Present::Synchronized};
+        ColorMode _color_mode{ColorMode::Auto};
+        double _drain_rate{0.0};
+        std::size_t _drain_blocked{0};
+        bool _frame_blocked{false};
         std::vector<unsigned char> _out{};
-        std::vector<pixel> _swapframe{};
-        std::size_t _pbuffer_size{0};
-        std::size_t _buffer_size{0};
-        px::style _track_style{};
-        px::foreground _track_foreground{};
-        px::background _track_background{};
+        std::atomic<std::size_t> _buffer_size{0};
+        std::atomic<std::size_t> _swapframe_size{0};
+        std::atomic<std::size_t> _reference_size{0};
+        TerminalEncoder _encoder{};
 
         std::mutex mtx_{};
         std::unordered_map<std::string, std::any> images_{};
 
-        void _kitty_write_id(std::uint32_t id);
+        // Slots are owned by the submitting thread (back), the writer (front)
+        // and whichever one was published last
+        std::atomic<Dispatch> _dispatch{Dispatch::Inline};
+        std::array<FrameSlot, 3> _slots{};
+        std::atomic<std::uint8_t> _latest{0};
+        std::uint8_t _back{1};
+        std::uint8_t _front{2};
+        std::jthread _writer{};
+        // Input of dropped frames, accounted to the next one
+        std::chrono::steady_clock::time_point _dropped_input{};
+
         void _kitty_write(const std::string& cmd);
 
-        position_type _generate_position(int x, int y, bool skip = false);
-        color_type _generate_color(const pixel& px, bool force = false);
+        void _output(
+            std::span<const pixel> buffer,
+            std::size_t width,
+            std::size_t height,
+            std::chrono::steady_clock::time_point input
+        );
+        bool _present_frame();
+        // Closes the synchronized update of a frame that could not be written out
+        void _abort_sync();
+        void _adapt_colors(std::chrono::microseconds elapsed);
+        void _pace(std::size_t written);
+        void _resolve_probe();
+        void _apply_capabilities();
 
-        void _push(const pixel& px);
-        int _write(std::span<const unsigned char> buffer);
-        int _write(std::span<const char> buffer);
+        void _submit(std::span<const pixel> buffer, std::size_t width, std::size_t height);
+        void _start_writer();
+        void _stop_writer();
+        void _write_loop();
 
         void _release_image(std::any data);
     protected:
-        virtual Status _load_impl() override
-        {
-            return Status::Ok;
-        }
+        virtual Status _load_impl() override;
         virtual Status _unload_impl() override
         {
+            _stop_writer();
             for (decltype(auto) it : images_)
                 _release_image(it.second);
             return Status::Ok;
@@ -125,7 +402,26 @@ namespace d2::sys
     public:
         using SystemOutput::SystemOutput;
 
-        std::chrono::microseconds frame_time() const;
+        static Compat compatible();
+
+        void set_present_mode(Present mode);
+        Present present_mode() const;
+
+        // Takes effect with the next frame, the writer presents its pending frame before exiting
+        void set_dispatch_mode(Dispatch mode);
+        Dispatch dispatch_mode() const;
+
+        // Throttles the frame rate to what the terminal drains (see frame_budget())
+        void set_pacing(bool value);
+        bool pacing() const;
+
+        void set_color_mode(ColorMode mode);
+        ColorMode color_mode();
+
+        void set_encoder_options(TerminalEncoder::Options opts);
+        TerminalEncoder::Options encoder_options();
+
+        TerminalCapabilities capabilities() const;
 
         virtual void load_image(const std::string& path, ImageInstance img) override;
         virtual void release_image(const std::string& path) override;
@@ -137,5 +433,11 @@ namespace d2::sys
 
         virtual std::size_t delta_size() override;
         virtual std::size_t swapframe_size() override;
+        virtual std::size_t reference_size() override;
+        virtual std::size_t syscall_count() override;
+        virtual std::chrono::microseconds frame_time() override;
+        virtual std::size_t dropped_frames() override;
+        virtual std::chrono::microseconds encode_latency() override;
+        virtual std::chrono::microseconds frame_budget() override;
     };
 } // namespace d2::sys